@@ -16,9 +16,18 @@
 */
 
 #include <google/protobuf/message.h>
+#include <unistd.h>
 #include <uuid/uuid.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 #include "discZmq.hh"
 #include "netUtils.hh"
@@ -28,36 +37,260 @@
 #include "zmq/zmq.hpp"
 #include "zmq/zmsg.hpp"
 
+//////////////////////////////////////////////////
+/// \brief Free function used by ZeroMQ to release a payload whose ownership
+/// was transferred with Node::Publish(const std::string&, std::string&&).
+/// \param[in] _data Pointer to the payload bytes (unused).
+/// \param[in] _hint The std::string that owns the payload.
+static void ReleaseString(void * /*_data*/, void *_hint)
+{
+  delete static_cast<std::string*>(_hint);
+}
+
+//////////////////////////////////////////////////
+/// \brief Serialize a protobuf message straight into a frame.
+/// \param[in] _message Message.
+/// \param[out] _frame Frame.
+/// \return true when success.
+static bool SerializeToFrame(const google::protobuf::Message &_message,
+                             zmq::message_t &_frame)
+{
+#if GOOGLE_PROTOBUF_VERSION >= 3004000
+  size_t size = _message.ByteSizeLong();
+#else
+  size_t size = _message.ByteSize();
+#endif
+  _frame.rebuild(size);
+  return _message.SerializeToArray(_frame.data(), size);
+}
+
+//////////////////////////////////////////////////
+/// \brief Read a non empty environment variable.
+/// \param[in] _name Name of the variable.
+/// \param[out] _value Value of the variable.
+/// \return true if the variable is set and not empty.
+static bool GetEnv(const char *_name, std::string &_value)
+{
+  const char *value = getenv(_name);
+  if (!value || value[0] == '\0')
+    return false;
+
+  _value = value;
+  return true;
+}
+
+//////////////////////////////////////////////////
+/// \brief Check if an address designates this host.
+/// \param[in] _address Address (<scheme>://<host>[:port][/path]).
+/// \param[in] _host Address of this host.
+/// \return true for the loopback, IPC and in-process addresses and for the
+/// addresses of _host.
+static bool IsLocalAddress(const std::string &_address,
+                           const std::string &_host)
+{
+  size_t start = _address.find("://");
+  if (start == std::string::npos)
+    return false;
+
+  std::string scheme = _address.substr(0, start);
+  if (scheme == "ipc" || scheme == "inproc")
+    return true;
+
+  start += 3;
+  size_t end = _address.find_first_of(":/", start);
+  std::string host = _address.substr(start, end == std::string::npos ?
+                                     std::string::npos : end - start);
+  return host == _host || host == "localhost" ||
+         host.compare(0, 4, "127.") == 0;
+}
+
+//////////////////////////////////////////////////
+/// \brief Get the publisher identifier of a node, the first bytes of its
+/// GUID.
+/// \param[in] _guid String representation of the GUID.
+/// \param[out] _id Publisher identifier.
+/// \return false if the GUID is not valid.
+static bool GetPublisherId(const std::string &_guid, uint64_t &_id)
+{
+  uuid_t guid;
+  if (uuid_parse(_guid.c_str(), guid) != 0)
+    return false;
+
+  memcpy(&_id, guid, sizeof(_id));
+  return true;
+}
+
+//////////////////////////////////////////////////
+transport::Publisher::Publisher()
+  : node(nullptr),
+    info(nullptr)
+{
+}
+
+//////////////////////////////////////////////////
+bool transport::Publisher::Valid() const
+{
+  return this->node != nullptr;
+}
+
+//////////////////////////////////////////////////
+const std::string &transport::Publisher::GetTopic() const
+{
+  return this->topic;
+}
+
+//////////////////////////////////////////////////
+bool transport::Publisher::HasSubscribers() const
+{
+  return this->node && this->node->HasSubscribers(*this);
+}
+
+//////////////////////////////////////////////////
+int transport::Publisher::Publish(const std::string &_data) const
+{
+  int rc = -1;
+  if (!this->node || !this->node->MustSend(*this, rc))
+    return rc;
+
+  zmq::message_t payload(_data.size());
+  memcpy(payload.data(), _data.data(), _data.size());
+
+  return this->node->SendTopicMsg(this->info, this->topic, *this->topicFrame,
+                                  payload);
+}
+
+//////////////////////////////////////////////////
+int transport::Publisher::Publish(std::string &&_data) const
+{
+  int rc = -1;
+  if (!this->node || !this->node->MustSend(*this, rc))
+    return rc;
+
+  std::string *buffer = new std::string(std::move(_data));
+  zmq::message_t payload(&(*buffer)[0], buffer->size(), ReleaseString,
+                         buffer);
+
+  return this->node->SendTopicMsg(this->info, this->topic, *this->topicFrame,
+                                  payload);
+}
+
+//////////////////////////////////////////////////
+int transport::Publisher::Publish(
+  const google::protobuf::Message &_message) const
+{
+  int rc = -1;
+  if (!this->node || !this->node->MustSend(*this, rc))
+    return rc;
+
+  zmq::message_t payload;
+  if (!SerializeToFrame(_message, payload))
+  {
+    std::cerr << "Error serializing message for [" << this->topic << "]\n";
+    return -1;
+  }
+
+  return this->node->SendTopicMsg(this->info, this->topic, *this->topicFrame,
+                                  payload);
+}
+
+//////////////////////////////////////////////////
+transport::Subscriber::Subscriber()
+  : node(nullptr),
+    info(nullptr)
+{
+}
+
+//////////////////////////////////////////////////
+bool transport::Subscriber::Valid() const
+{
+  return this->node != nullptr;
+}
+
+//////////////////////////////////////////////////
+const std::string &transport::Subscriber::GetTopic() const
+{
+  return this->topic;
+}
+
+//////////////////////////////////////////////////
+bool transport::Subscriber::Subscribed() const
+{
+  if (!this->node)
+    return false;
+
+  std::lock_guard<std::mutex> lock(this->node->mutex);
+  return this->info->subscribed;
+}
+
+//////////////////////////////////////////////////
+int transport::Subscriber::UnSubscribe() const
+{
+  if (!this->node)
+    return -1;
+
+  return this->node->UnSubscribe(this->topic);
+}
+
 //////////////////////////////////////////////////
 transport::Node::Node(std::string _master, bool _verbose)
+  : ioThread(nullptr),
+    ioRunning(false),
+    incoming(nullptr),
+    incomingWaiting(false)
 {
   char bindEndPoint[1024];
 
-  // Initialize random seed
-  srand(time(nullptr));
-
   // Required 0MQ minimum version
   s_version_assert(2, 1);
 
   this->master = _master;
   this->verbose = _verbose;
   this->timeout = 250;           // msecs
-
-  // ToDo Read this from getenv or command line arguments
-  this->bcastAddr = "255.255.255.255";
-  this->bcastPort = 11312;
-  this->bcastSock = new UDPSocket(this->bcastPort);
+  this->spinBudget = 100;        // msgs per socket and SpinOnce()
+  this->spinFirst = 0;
+  this->executor = nullptr;
+  this->shmWriter = nullptr;
+  this->shmFirst = 0;
+  this->subscriptionsChanged = false;
+  this->statsEnabled = false;
+  this->heartbeatInterval = DefaultHeartbeatInterval;
+  this->nextHeartbeat = 0;
+  this->leaseTimeout = DefaultLeaseTimeout;
+  this->replyJitter = DefaultReplyJitter;
+  this->startTime = std::chrono::steady_clock::now();
+  this->compactDiscovery = false;
+
+  // Discovery. Without a registry, the UDP sockets are used.
+  this->bcastSock = nullptr;
+  this->ucastSock = nullptr;
+  this->multicast = false;
+  this->registry = nullptr;
   this->hostAddr = DetermineHost();
+  std::string agent;
+  if (this->master.empty() && GetEnv("DZMQ_HOST_AGENT", agent))
+    this->master = agent;
+  if (this->master.empty())
+    this->InitDiscoverySockets();
 
   // Create the GUID
   uuid_generate(this->guid);
   this->guidStr = transport::GetGuidStr(this->guid);
+  this->advBatch.GetHeader() = Header(TRNSP_VERSION, this->guid, "",
+                                      ADV_BATCH, FLAG_WIRE_V2);
+  memcpy(&this->publisherId, this->guid, sizeof(this->publisherId));
+
+  // The GUID differs between nodes even if the random device is not random
+  std::random_device device;
+  std::seed_seq seed{static_cast<uint32_t>(device()),
+                     static_cast<uint32_t>(this->publisherId),
+                     static_cast<uint32_t>(this->publisherId >> 32)};
+  this->jitterGenerator.seed(seed);
 
   // 0MQ
   try
   {
     this->context = new zmq::context_t(1);
-    this->publisher = new zmq::socket_t(*this->context, ZMQ_PUB);
+    this->publisher = new zmq::socket_t(*this->context, ZMQ_XPUB);
     this->subscriber = new zmq::socket_t(*this->context, ZMQ_SUB);
     this->srvRequester = new zmq::socket_t(*this->context, ZMQ_DEALER);
     this->srvReplier = new zmq::socket_t(*this->context, ZMQ_DEALER);
@@ -74,6 +307,16 @@ transport::Node::Node(std::string _master, bool _verbose)
     this->srvReplier->getsockopt(ZMQ_LAST_ENDPOINT, &bindEndPoint, &size);
     this->srvReplierEP = bindEndPoint;
     this->mySrvAddresses.push_back(this->srvReplierEP);
+
+    // The messages for a registry that is down are dropped after a while,
+    // so closing the node does not block
+    if (!this->master.empty())
+    {
+      int linger = RegistryLinger;
+      this->registry = new zmq::socket_t(*this->context, ZMQ_DEALER);
+      this->registry->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+      this->registry->connect(this->master.c_str());
+    }
   }
   catch(const zmq::error_t& ze)
   {
@@ -82,6 +325,18 @@ transport::Node::Node(std::string _master, bool _verbose)
      exit(EXIT_FAILURE);
   }
 
+  if (this->verbose && this->registry)
+    std::cout << "Discovery registry at: [" << this->master << "]\n";
+
+  // Addresses discovered before a restart
+  std::string value;
+  if (GetEnv("DZMQ_DISCOVERY_CACHE", value) &&
+      this->discoveryCache.Open(value) == 0)
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->LoadDiscoveryCache();
+  }
+
   if (this->verbose)
   {
     std::cout << "Current host address: " << this->hostAddr << std::endl;
@@ -93,6 +348,67 @@ transport::Node::Node(std::string _master, bool _verbose)
   }
 }
 
+//////////////////////////////////////////////////
+void transport::Node::InitDiscoverySockets()
+{
+  // It uses the limited broadcast address unless a multicast group is set
+  // in DZMQ_MULTICAST_GROUP.
+  std::string value;
+  this->bcastAddr = "255.255.255.255";
+  this->bcastPort = DefaultDiscoveryPort;
+  if (GetEnv("DZMQ_DISCOVERY_PORT", value))
+    this->bcastPort = atoi(value.c_str());
+
+  // The subscriptions are sent from an ephemeral port, where only this node
+  // receives the replies. The port constructor would bind to the broadcast
+  // address, which does not receive unicast datagrams.
+  this->ucastSock = new UDPSocket("0.0.0.0", 0);
+
+  std::string group;
+  if (GetEnv("DZMQ_MULTICAST_GROUP", group))
+  {
+    int ttl = DefaultMulticastTTL;
+    if (GetEnv("DZMQ_MULTICAST_TTL", value))
+      ttl = atoi(value.c_str());
+    std::string iface;
+    GetEnv("DZMQ_MULTICAST_IF", iface);
+
+    // The socket is bound to the group, so it only receives its datagrams
+    try
+    {
+      this->bcastSock = new UDPSocket(group, this->bcastPort);
+      this->bcastSock->setMulticastTTL(ttl);
+      this->ucastSock->setMulticastTTL(ttl);
+      if (!iface.empty())
+      {
+        this->bcastSock->setMulticastInterface(iface);
+        this->ucastSock->setMulticastInterface(iface);
+      }
+      this->bcastSock->joinGroup(group, iface);
+      this->bcastAddr = group;
+      this->multicastIface = iface;
+      this->multicast = true;
+    }
+    catch(const SocketException &e)
+    {
+      std::cerr << "Error joining the multicast group [" << group << "]: "
+                << e.what() << ". Using broadcast discovery\n";
+      delete this->bcastSock;
+      this->bcastSock = nullptr;
+    }
+  }
+
+  if (!this->bcastSock)
+    this->bcastSock = new UDPSocket(this->bcastPort);
+
+  if (this->verbose)
+  {
+    std::cout << "Discovery at: [" << this->bcastAddr << ":"
+              << this->bcastPort << "], replies at port "
+              << this->ucastSock->getLocalPort() << "\n";
+  }
+}
+
 //////////////////////////////////////////////////
 transport::Node::~Node()
 {
@@ -102,26 +418,107 @@ transport::Node::~Node()
 //////////////////////////////////////////////////
 void transport::Node::SpinOnce()
 {
+  if (this->ioThread)
+    this->DispatchIncoming();
+  else
+    this->PollSockets(this->timeout);
+}
+
+//////////////////////////////////////////////////
+void transport::Node::PollSockets(int _timeout)
+{
+  // Handlers of the polled sockets. The order matches the poll items. The
+  // shared memory rings are the last entry and cannot be polled.
+  static bool (Node::*const handlers[])() = {
+    &Node::RecvTopicUpdates,
+    &Node::RecvSrvRequest,
+    &Node::RecvDiscoveryUpdates,
+    &Node::RecvSrvReply,
+    &Node::RecvUnicastUpdates,
+    &Node::RecvShmUpdates
+  };
+  const int numSockets = sizeof(handlers) / sizeof(handlers[0]);
+  const int numPollItems = numSockets - 1;
+
+  this->ExecuteCommands();
   this->SendPendingAsyncSrvCalls();
 
+  // Advertise the topics added since the last poll and answer the
+  // subscriptions whose reply is due. Wake up for the next reply.
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    int wait = this->SendDueReplies();
+    if (wait >= 0)
+      _timeout = _timeout < 0 ? wait : std::min(_timeout, wait);
+    this->FlushAdvertiseMsgs();
+  }
+
+  this->CheckLiveness();
+
+  // Keep the queue of subscriptions of the publisher short
+  {
+    std::lock_guard<std::mutex> lock(this->pubMutex);
+    this->RecvSubscriptions();
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->UpdateSubscribers();
+  }
+
   //  Poll socket for a reply, with timeout
   zmq::pollitem_t items[] = {
     { *this->subscriber, 0, ZMQ_POLLIN, 0 },
     { *this->srvReplier, 0, ZMQ_POLLIN, 0 },
-    { 0, this->bcastSock->sockDesc, ZMQ_POLLIN, 0 },
-    { *this->srvRequester, 0, ZMQ_POLLIN, 0 }
+    { 0, this->bcastSock ? this->bcastSock->sockDesc : -1, ZMQ_POLLIN, 0 },
+    { *this->srvRequester, 0, ZMQ_POLLIN, 0 },
+    { 0, this->ucastSock ? this->ucastSock->sockDesc : -1, ZMQ_POLLIN, 0 }
   };
-  zmq::poll(&items[0], sizeof(items) / sizeof(items[0]), this->timeout);
+  if (this->registry)
+    items[2].socket = *this->registry;
+  if (!this->shmReaders.empty())
+    _timeout = std::min(_timeout, ShmPollTimeout);
+  zmq::poll(&items[0], numPollItems, _timeout);
+
+  // Messages processed per socket during this iteration
+  int served[numSockets] = {0};
+  bool ready[numSockets];
+  for (int i = 0; i < numPollItems; ++i)
+    ready[i] = items[i].revents & ZMQ_POLLIN;
+  ready[numPollItems] = !this->shmReaders.empty();
+
+  // Service the ready sockets in round robin, one message per socket and
+  // round, until every socket is drained or has consumed its budget.
+  bool pending = true;
+  while (pending)
+  {
+    pending = false;
+    for (int j = 0; j < numSockets; ++j)
+    {
+      int i = (this->spinFirst + j) % numSockets;
+      if (!ready[i])
+        continue;
 
-  //  If we got a reply, process it
-  if (items[0].revents & ZMQ_POLLIN)
-    this->RecvTopicUpdates();
-  else if (items[1].revents & ZMQ_POLLIN)
-    this->RecvSrvRequest();
-  else if (items[2].revents & ZMQ_POLLIN)
-    this->RecvDiscoveryUpdates();
-  else if (items[3].revents & ZMQ_POLLIN)
-    this->RecvSrvReply();
+      if (served[i] >= this->spinBudget || !(this->*handlers[i])())
+      {
+        ready[i] = false;
+        continue;
+      }
+
+      ++served[i];
+      pending = true;
+    }
+  }
+
+  this->spinFirst = (this->spinFirst + 1) % numSockets;
+
+  for (auto ring : this->shmClosed)
+    delete ring;
+  this->shmClosed.clear();
+
+  // Answer the subscriptions whose reply is due
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->SendDueReplies();
+  this->FlushAdvertiseMsgs();
 }
 
 //////////////////////////////////////////////////
@@ -134,552 +531,2328 @@ void transport::Node::Spin()
 }
 
 //////////////////////////////////////////////////
-int transport::Node::Advertise(const std::string &_topic)
+int transport::Node::StartIoThread()
 {
-  assert(_topic != "");
+  if (this->ioThread)
+    return -1;
 
-  this->topics.SetAdvertisedByMe(_topic, true);
+  this->incoming = new SpscQueue<IncomingMsg>(IoQueueCapacity);
+  this->ioRunning = true;
+  this->ioThread = new std::thread(&Node::RunIoThread, this);
 
-  for (auto it = this->myAddresses.begin(); it != this->myAddresses.end(); ++it)
-    this->SendAdvertiseMsg(ADV, _topic, *it);
+  if (this->verbose)
+    std::cout << "\nI/O thread started" << std::endl;
 
   return 0;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::UnAdvertise(const std::string &_topic)
+void transport::Node::StopIoThread()
 {
-  assert(_topic != "");
+  if (!this->ioThread)
+    return;
 
-  this->topics.SetAdvertisedByMe(_topic, false);
+  this->ioRunning = false;
+  this->ioThread->join();
+  delete this->ioThread;
+  this->ioThread = nullptr;
 
-  return 0;
+  // Execute the tasks forwarded after the last iteration of the thread
+  this->ExecuteCommands();
+
+  delete this->incoming;
+  this->incoming = nullptr;
+
+  if (this->verbose)
+    std::cout << "\nI/O thread stopped" << std::endl;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::Publish(const std::string &_topic,
-            const std::string &_data)
+bool transport::Node::IoThreadRunning() const
 {
-  assert(_topic != "");
-
-  if (this->topics.AdvertisedByMe(_topic))
-  {
-    zmsg msg;
-    std::string sender = this->tcpEndpoint;
-    msg.push_back((char*)_topic.c_str());
-    msg.push_back((char*)sender.c_str());
-    msg.push_back((char*)_data.c_str());
-
-    if (this->verbose)
-    {
-      std::cout << "\nPublish(" << _topic << ")" << std::endl;
-      msg.dump();
-    }
-    msg.send(*this->publisher);
-    return 0;
-  }
-  else
-  {
-    if (this->verbose)
-      std::cerr << "\nNot published. (" << _topic << ") not advertised\n";
-    return -1;
-  }
+  return this->ioThread != nullptr;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::Publish(const std::string &_topic,
-            const google::protobuf::Message &_message)
+void transport::Node::SetSpinBudget(int _budget)
 {
-  assert(_topic != "");
-
-  std::string data;
-  _message.SerializeToString(&data);
+  this->spinBudget = std::max(_budget, 1);
+}
 
-  return this->Publish(_topic, data);
+//////////////////////////////////////////////////
+int transport::Node::GetSpinBudget() const
+{
+  return this->spinBudget;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::Subscribe(const std::string &_topic,
-  void(*_cb)(const std::string &, const std::string &))
+void transport::Node::SetHeartbeatInterval(int _interval)
 {
-  assert(_topic != "");
-  if (this->verbose)
-    std::cout << "\nSubscribe (" << _topic << ")\n";
+  this->heartbeatInterval = std::max(_interval, 1);
+  this->nextHeartbeat = 0;
+  this->nextExpiryCheck = std::chrono::steady_clock::time_point();
+}
 
-  // Register our interest on the topic
-  // The last subscribe call replaces previous subscriptions. If this is
-  // a problem, we have to store a list of callbacks.
-  this->topics.SetSubscribed(_topic, true);
-  this->topics.SetCallback(_topic, _cb);
+//////////////////////////////////////////////////
+int transport::Node::GetHeartbeatInterval() const
+{
+  return this->heartbeatInterval;
+}
 
-  // Add a filter for this topic
-  this->subscriber->setsockopt(ZMQ_SUBSCRIBE, _topic.data(), _topic.size());
+//////////////////////////////////////////////////
+void transport::Node::SetLeaseTimeout(int _timeout)
+{
+  this->leaseTimeout = std::max(_timeout, 1);
+}
 
-  // Discover the list of nodes that publish on the topic
-  return this->SendSubscribeMsg(SUB, _topic);
+//////////////////////////////////////////////////
+int transport::Node::GetLeaseTimeout() const
+{
+  return this->leaseTimeout;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::UnSubscribe(const std::string &_topic)
+void transport::Node::SetReplyJitter(int _jitter)
 {
-  assert(_topic != "");
-  if (this->verbose)
-    std::cout << "\nUnubscribe (" << _topic << ")\n";
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->replyJitter = std::max(_jitter, 0);
+}
 
-  this->topics.SetSubscribed(_topic, false);
-  this->topics.SetCallback(_topic, nullptr);
+//////////////////////////////////////////////////
+int transport::Node::GetReplyJitter() const
+{
+  return this->replyJitter;
+}
 
-  // Remove the filter for this topic
-  this->subscriber->setsockopt(ZMQ_UNSUBSCRIBE, _topic.data(),
-                              _topic.size());
-  return 0;
+//////////////////////////////////////////////////
+void transport::Node::SetExecutor(Executor *_executor)
+{
+  this->executor = _executor;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::SrvAdvertise(const std::string &_topic,
-  int(*_cb)(const std::string &, const std::string &, std::string &))
+int transport::Node::EnableShm(size_t _capacity)
 {
-  assert(_topic != "");
+  if (this->shmWriter)
+    return -1;
 
-  this->topicsSrvs.SetAdvertisedByMe(_topic, true);
-  this->topicsSrvs.SetRepCallback(_topic, _cb);
+  // The segments of the nodes that crashed are never unlinked by them
+  ShmRing::RemoveStale("/dzmq-");
 
-  if (this->verbose)
-    std::cout << "\nAdvertise srv call(" << _topic << ")\n";
+  std::string segment = "/dzmq-" + std::to_string(getpid()) + "-" +
+    this->guidStr;
+  ShmRing *ring = new ShmRing();
+  if (ring->Create(segment, _capacity) != 0)
+  {
+    delete ring;
+    return -1;
+  }
 
-  for (auto it = this->mySrvAddresses.begin();
-       it != this->mySrvAddresses.end(); ++it)
-    this->SendAdvertiseMsg(ADV_SVC, _topic, *it);
+  // The shared memory address is advertised first, so the local subscribers
+  // use it before connecting via TCP.
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->shmWriter = ring;
+  this->shmEndpoint = "shm://" + this->hostAddr + segment;
+  this->myAddresses.insert(this->myAddresses.begin(), this->shmEndpoint);
+
+  if (this->verbose)
+    std::cout << "Bind at: [" << this->shmEndpoint << "] for pub/sub\n";
 
   return 0;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::SrvUnAdvertise(const std::string &_topic)
+int transport::Node::Advertise(const std::string &_topic)
 {
   assert(_topic != "");
 
-  this->topicsSrvs.SetAdvertisedByMe(_topic, false);
-  this->topicsSrvs.SetRepCallback(_topic, nullptr);
+  // The topic stays pinned once advertised: the publishers use its
+  // information without the lock, and its sequence continues if the topic
+  // is advertised again.
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->topics.Pin(_topic);
+  this->topics.SetAdvertisedByMe(_topic, true);
 
-  if (this->verbose)
-    std::cout << "\nUnadvertise srv call(" << _topic << ")\n";
+  for (auto it = this->myAddresses.begin(); it != this->myAddresses.end(); ++it)
+    this->SendAdvertiseMsg(ADV, _topic, *it);
 
   return 0;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::SrvRequest(const std::string &_topic,
-                                const std::string &_data,
-                                std::string &_response)
+int transport::Node::Advertise(const std::string &_topic,
+                               Publisher &_publisher)
 {
-  assert(_topic != "");
+  int rc = this->Advertise(_topic);
+  if (rc != 0)
+    return rc;
 
-  this->topicsSrvs.SetRequested(_topic, true);
-
-  int retries = 25;
-  while (!this->topicsSrvs.Connected(_topic) && retries > 0)
+  std::lock_guard<std::mutex> lock(this->mutex);
+  _publisher.node = this;
+  _publisher.info = this->topics.Pin(_topic);
   {
-    this->SendSubscribeMsg(SUB_SVC, _topic);
-    this->SpinOnce();
-    s_sleep(200);
-    --retries;
+    std::lock_guard<std::mutex> pubLock(this->pubMutex);
+    _publisher.info->hasSubscribers = this->MatchSubscriptions(_topic);
   }
+  _publisher.topic = _topic;
+  _publisher.topicFrame.reset(new zmq::message_t(_topic.size()));
+  memcpy(_publisher.topicFrame->data(), _topic.data(), _topic.size());
 
-  if (!this->topicsSrvs.Connected(_topic))
-    return -1;
+  return 0;
+}
 
-  // Send the request
-  zmsg msg;
-  msg.push_back((char*)_topic.c_str());
-  msg.push_back((char*)this->tcpEndpoint.c_str());
-  msg.push_back((char*)_data.c_str());
+//////////////////////////////////////////////////
+int transport::Node::UnAdvertise(const std::string &_topic)
+{
+  assert(_topic != "");
 
-  if (this->verbose)
-  {
-    std::cout << "\nRequest (" << _topic << ")" << std::endl;
-    msg.dump();
-  }
-  msg.send(*this->srvRequester);
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->topics.SetAdvertisedByMe(_topic, false);
 
-  // Poll socket for a reply, with timeout
-  zmq::pollitem_t items[] = { { *this->srvRequester, 0, ZMQ_POLLIN, 0 } };
-  zmq::poll(items, 1, this->timeout);
+  return 0;
+}
 
-  //  If we got a reply, process it
-  if (items[0].revents & ZMQ_POLLIN)
-  {
-    zmsg *reply = new zmsg(*this->srvRequester);
+//////////////////////////////////////////////////
+int transport::Node::Publish(const std::string &_topic,
+            const std::string &_data)
+{
+  assert(_topic != "");
+
+  TopicInfo *info = this->CanPublish(_topic);
+  if (!info)
+    return -1;
+
+  if (!this->HasSubscribers(_topic))
+    return 0;
+
+  // The payload is copied once, straight into the outgoing frame.
+  zmq::message_t payload(_data.size());
+  memcpy(payload.data(), _data.data(), _data.size());
+
+  return this->SendTopicMsg(info, _topic, payload);
+}
+
+//////////////////////////////////////////////////
+int transport::Node::Publish(const std::string &_topic, std::string &&_data)
+{
+  assert(_topic != "");
+
+  TopicInfo *info = this->CanPublish(_topic);
+  if (!info)
+    return -1;
+
+  if (!this->HasSubscribers(_topic))
+    return 0;
+
+  // Move the payload to the heap and let ZeroMQ own the buffer. Moving a
+  // std::string keeps its storage, so the data is never copied.
+  std::string *buffer = new std::string(std::move(_data));
+  zmq::message_t payload(&(*buffer)[0], buffer->size(), ReleaseString,
+                         buffer);
+
+  return this->SendTopicMsg(info, _topic, payload);
+}
+
+//////////////////////////////////////////////////
+int transport::Node::Publish(const std::string &_topic,
+            const google::protobuf::Message &_message)
+{
+  assert(_topic != "");
 
-    std::string((char*)reply->pop_front().c_str());
-    std::string((char*)reply->pop_front().c_str());
-    _response = std::string((char*)reply->pop_front().c_str());
+  TopicInfo *info = this->CanPublish(_topic);
+  if (!info)
+    return -1;
 
+  if (!this->HasSubscribers(_topic))
     return 0;
+
+  zmq::message_t payload;
+  if (!SerializeToFrame(_message, payload))
+  {
+    std::cerr << "Error serializing message for [" << _topic << "]\n";
+    return -1;
   }
 
-  return -1;
+  return this->SendTopicMsg(info, _topic, payload);
 }
 
 //////////////////////////////////////////////////
-int transport::Node::SrvRequestAsync(const std::string &_topic,
-                                     const std::string &_data,
-  void(*_cb)(const std::string &_topic, int rc, const std::string &_rep))
+bool transport::Node::HasSubscribers(const std::string &_topic)
+{
+  if (this->shmWriter && this->shmWriter->GetReaders() > 0)
+    return true;
+
+  std::lock_guard<std::mutex> lock(this->pubMutex);
+  this->RecvSubscriptions();
+  return this->MatchSubscriptions(_topic);
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::HasSubscribers(const Publisher &_publisher) const
+{
+  if (this->shmWriter && this->shmWriter->GetReaders() > 0)
+    return true;
+
+  return _publisher.info->hasSubscribers;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::MatchSubscriptions(const std::string &_topic) const
+{
+  // The subscriptions are prefixes, as the filters of ZeroMQ
+  for (auto &subscription : this->subscriptions)
+  {
+    if (_topic.compare(0, subscription.first.size(), subscription.first) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::UpdateSubscribers()
+{
+  std::lock_guard<std::mutex> lock(this->pubMutex);
+  if (!this->subscriptionsChanged)
+    return;
+
+  this->subscriptionsChanged = false;
+  for (TopicsInfo::TopicId id = 0; id < this->topics.GetIdCount(); ++id)
+  {
+    TopicInfo *info = this->topics.GetTopicInfo(id);
+    if (info && info->pinned)
+    {
+      info->hasSubscribers =
+        this->MatchSubscriptions(this->topics.GetTopicName(id));
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+uint64_t transport::Node::GetLostUpdates(const std::string &_topic)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  TopicInfo *info = this->topics.GetTopicInfo(_topic);
+  return info ? info->lost : 0;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::HasPublishers(const std::string &_topic)
+{
+  std::vector<std::string> addresses;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->topics.GetAdvAddresses(_topic, addresses);
+}
+
+//////////////////////////////////////////////////
+void transport::Node::EnableStats(bool _enable)
+{
+  this->statsEnabled = _enable;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::GetTopicStats(const std::string &_topic,
+                                    TopicStats &_stats)
+{
+  std::shared_ptr<TopicStatsCollector> stats;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    TopicInfo *info = this->topics.GetTopicInfo(_topic);
+    if (!info || !info->stats)
+      return false;
+
+    stats = info->stats;
+    _stats.lost = info->lost;
+  }
+
+  stats->Get(_stats);
+  return true;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::RecvSubscriptions()
+{
+  // Each message has a byte (1 subscribe, 0 unsubscribe) and the prefix.
+  // The publisher only forwards the first subscription and the last
+  // unsubscription of a prefix.
+  zmq::message_t msg;
+  try
+  {
+    while (this->publisher->recv(&msg, ZMQ_DONTWAIT))
+    {
+      if (msg.size() == 0)
+        continue;
+
+      const char *data = static_cast<char*>(msg.data());
+      std::string prefix(data + 1, msg.size() - 1);
+      if (data[0] == 1 && ++this->subscriptions[prefix] == 1)
+        this->subscriptionsChanged = true;
+      else if (data[0] == 0 && --this->subscriptions[prefix] <= 0)
+      {
+        this->subscriptions.erase(prefix);
+        this->subscriptionsChanged = true;
+      }
+    }
+  }
+  catch(const zmq::error_t& ze)
+  {
+    std::cerr << "Error receiving subscriptions: " << ze.what() << "\n";
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::MustSend(const Publisher &_publisher, int &_rc)
+{
+  if (!_publisher.info->advertisedByMe)
+  {
+    if (this->verbose)
+    {
+      std::cerr << "\nNot published. (" << _publisher.topic
+                << ") not advertised\n";
+    }
+    _rc = -1;
+    return false;
+  }
+
+  if (!this->HasSubscribers(_publisher))
+  {
+    _rc = 0;
+    return false;
+  }
+
+  return true;
+}
+
+//////////////////////////////////////////////////
+transport::TopicInfo *transport::Node::CanPublish(const std::string &_topic)
+{
+  TopicInfo *info;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    info = this->topics.GetTopicInfo(_topic);
+    if (info && !info->advertisedByMe)
+      info = nullptr;
+  }
+
+  if (!info && this->verbose)
+    std::cerr << "\nNot published. (" << _topic << ") not advertised\n";
+
+  return info;
+}
+
+//////////////////////////////////////////////////
+int transport::Node::Subscribe(const std::string &_topic,
+  void(*_cb)(const std::string &, const std::string &))
+{
+  assert(_topic != "");
+  if (this->verbose)
+    std::cout << "\nSubscribe (" << _topic << ")\n";
+
+  // Register our interest on the topic
+  // The last subscribe call replaces previous subscriptions. If this is
+  // a problem, we have to store a list of callbacks.
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->topics.SetSubscribed(_topic, true);
+    this->topics.SetCallback(_topic, _cb);
+    this->topics.SetRawCallback(_topic, nullptr);
+  }
+
+  // Add a filter for this topic and connect the publishers already known
+  this->RunInIoThread([this, _topic]()
+  {
+    this->subscriber->setsockopt(ZMQ_SUBSCRIBE, _topic.data(), _topic.size());
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ConnectKnownPublishers(_topic);
+  });
+
+  // Discover the list of nodes that publish on the topic
+  return this->SendSubscribeMsg(SUB, _topic);
+}
+
+//////////////////////////////////////////////////
+int transport::Node::Subscribe(const std::string &_topic,
+  void(*_cb)(const std::string &, const char *, size_t))
+{
+  return this->SubscribeRaw(_topic, _cb);
+}
+
+//////////////////////////////////////////////////
+int transport::Node::Subscribe(const std::string &_topic,
+  void(*_cb)(const std::string &, const std::string &),
+  Subscriber &_subscriber)
+{
+  int rc = this->Subscribe(_topic, _cb);
+  this->BindSubscriber(_topic, _subscriber);
+  return rc;
+}
+
+//////////////////////////////////////////////////
+int transport::Node::Subscribe(const std::string &_topic,
+  void(*_cb)(const std::string &, const char *, size_t),
+  Subscriber &_subscriber)
+{
+  int rc = this->SubscribeRaw(_topic, _cb);
+  this->BindSubscriber(_topic, _subscriber);
+  return rc;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::BindSubscriber(const std::string &_topic,
+                                     Subscriber &_subscriber)
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+  _subscriber.node = this;
+  _subscriber.info = this->topics.Pin(_topic);
+  _subscriber.topic = _topic;
+}
+
+//////////////////////////////////////////////////
+int transport::Node::SubscribeRaw(const std::string &_topic,
+                                  const TopicInfo::RawCallback &_cb)
 {
   assert(_topic != "");
+  if (this->verbose)
+    std::cout << "\nSubscribe (" << _topic << ")\n";
+
+  // Register our interest on the topic. A raw callback replaces any previous
+  // callback registered for the topic.
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->topics.SetSubscribed(_topic, true);
+    this->topics.SetCallback(_topic, nullptr);
+    this->topics.SetRawCallback(_topic, _cb);
+  }
+
+  // Add a filter for this topic and connect the publishers already known
+  this->RunInIoThread([this, _topic]()
+  {
+    this->subscriber->setsockopt(ZMQ_SUBSCRIBE, _topic.data(), _topic.size());
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->ConnectKnownPublishers(_topic);
+  });
 
-  this->topicsSrvs.SetRequested(_topic, true);
-  this->topicsSrvs.SetReqCallback(_topic, _cb);
-  this->topicsSrvs.AddReq(_topic, _data);
+  // Discover the list of nodes that publish on the topic
+  return this->SendSubscribeMsg(SUB, _topic);
+}
 
+//////////////////////////////////////////////////
+int transport::Node::UnSubscribe(const std::string &_topic)
+{
+  assert(_topic != "");
   if (this->verbose)
-    std::cout << "\nAsync request (" << _topic << ")" << std::endl;
+    std::cout << "\nUnubscribe (" << _topic << ")\n";
 
-  this->SendSubscribeMsg(SUB_SVC, _topic);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->topics.SetSubscribed(_topic, false);
+    this->topics.SetCallback(_topic, nullptr);
+    this->topics.SetRawCallback(_topic, nullptr);
+  }
 
+  // Remove the filter for this topic and close the connections that are
+  // not used by other topics
+  this->RunInIoThread([this, _topic]()
+  {
+    this->subscriber->setsockopt(ZMQ_UNSUBSCRIBE, _topic.data(),
+                                 _topic.size());
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->topics.SetConnected(_topic, false);
+    this->ReleaseEndpoints(_topic);
+
+    // The sequences start again on the next subscription
+    TopicInfo *info = this->topics.GetTopicInfo(_topic);
+    if (info && !info->subscribed)
+      info->lastSeqs.clear();
+  });
   return 0;
 }
 
 //////////////////////////////////////////////////
-void transport::Node::Fini()
+int transport::Node::SrvAdvertise(const std::string &_topic,
+  int(*_cb)(const std::string &, const std::string &, std::string &))
 {
-  if (this->publisher) delete this->publisher;
-  if (this->publisher) delete this->subscriber;
-  if (this->publisher) delete this->srvRequester;
-  if (this->publisher) delete this->srvReplier;
-  if (this->publisher) delete this->context;
+  assert(_topic != "");
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->topicsSrvs.SetAdvertisedByMe(_topic, true);
+  this->topicsSrvs.SetRepCallback(_topic, _cb);
+
+  if (this->verbose)
+    std::cout << "\nAdvertise srv call(" << _topic << ")\n";
+
+  for (auto it = this->mySrvAddresses.begin();
+       it != this->mySrvAddresses.end(); ++it)
+    this->SendAdvertiseMsg(ADV_SVC, _topic, *it);
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+int transport::Node::SrvUnAdvertise(const std::string &_topic)
+{
+  assert(_topic != "");
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->topicsSrvs.SetAdvertisedByMe(_topic, false);
+  this->topicsSrvs.SetRepCallback(_topic, nullptr);
+
+  if (this->verbose)
+    std::cout << "\nUnadvertise srv call(" << _topic << ")\n";
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+int transport::Node::SrvRequest(const std::string &_topic,
+                                const std::string &_data,
+                                std::string &_response)
+{
+  assert(_topic != "");
+
+  auto connected = [this, &_topic]()
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->topicsSrvs.Connected(_topic);
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->topicsSrvs.SetRequested(_topic, true);
+  }
+
+  // Connect to a provider already known, e.g. from the discovery cache
+  this->RunInIoThread([this, _topic]()
+  {
+    std::vector<std::string> addresses;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->topicsSrvs.Connected(_topic) &&
+        this->topicsSrvs.GetAdvAddresses(_topic, addresses))
+    {
+      this->DispatchAdv("", ADV_SVC, _topic, addresses.front());
+    }
+  });
+
+  // Ask for the service until it is found. The interval between requests
+  // doubles, so many nodes starting at once do not flood the discovery.
+  // When the I/O thread is running, it processes the discovery messages.
+  auto now = std::chrono::steady_clock::now();
+  auto deadline = now + std::chrono::milliseconds(SubRetryTimeout);
+  auto nextSub = now;
+  int interval = SubRetryMinInterval;
+  while (!connected() && now < deadline)
+  {
+    if (now >= nextSub)
+    {
+      this->SendSubscribeMsg(SUB_SVC, _topic);
+      nextSub = now + std::chrono::milliseconds(interval);
+      interval = std::min(interval * 2, SubRetryMaxInterval);
+    }
+
+    if (this->ioThread)
+      s_sleep(SubRetryMinInterval / 4);
+    else
+      this->SpinOnce();
+    now = std::chrono::steady_clock::now();
+  }
+
+  if (!connected())
+    return -1;
+
+  if (this->verbose)
+    std::cout << "\nRequest (" << _topic << ")" << std::endl;
+
+  if (this->ioThread)
+  {
+    // The I/O thread sends the request and fulfills the promise when the
+    // reply arrives.
+    std::promise<std::string> reply;
+    std::future<std::string> future = reply.get_future();
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      if (this->srvWaiters.find(_topic) != this->srvWaiters.end())
+      {
+        std::cerr << "A blocking request on [" << _topic << "] is already "
+                  << "waiting for a reply\n";
+        return -1;
+      }
+      this->srvWaiters[_topic] = &reply;
+    }
+
+    this->RunInIoThread([this, _topic, _data]()
+    {
+      this->SendFrames(*this->srvRequester, _topic, this->tcpEndpoint, _data);
+    });
+
+    bool received = future.wait_for(std::chrono::milliseconds(this->timeout))
+      == std::future_status::ready;
+
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->srvWaiters.erase(_topic);
+    }
+
+    if (!received)
+      return -1;
+
+    _response = future.get();
+    return 0;
+  }
+
+  // Send the request
+  this->SendFrames(*this->srvRequester, _topic, this->tcpEndpoint, _data);
+
+  // Poll socket for a reply, with timeout
+  zmq::pollitem_t items[] = { { *this->srvRequester, 0, ZMQ_POLLIN, 0 } };
+  zmq::poll(items, 1, this->timeout);
+
+  //  If we got a reply, process it
+  if (items[0].revents & ZMQ_POLLIN)
+  {
+    // Frames: topic, sender and response
+    zmq::message_t reply[3];
+    if (this->RecvFrames(*this->srvRequester, reply, 3, "service reply", 0)
+        != 3)
+    {
+      return -1;
+    }
+
+    _response.assign(static_cast<char*>(reply[2].data()), reply[2].size());
+    return 0;
+  }
+
+  return -1;
+}
+
+//////////////////////////////////////////////////
+int transport::Node::SrvRequestAsync(const std::string &_topic,
+                                     const std::string &_data,
+  void(*_cb)(const std::string &_topic, int rc, const std::string &_rep))
+{
+  assert(_topic != "");
+
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->topicsSrvs.SetRequested(_topic, true);
+    this->topicsSrvs.SetReqCallback(_topic, _cb);
+    this->topicsSrvs.AddReq(_topic, _data);
+  }
+
+  if (this->verbose)
+    std::cout << "\nAsync request (" << _topic << ")" << std::endl;
+
+  this->SendSubscribeMsg(SUB_SVC, _topic);
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::Fini()
+{
+  // Wait for the callbacks in flight and send their responses
+  if (this->executor)
+  {
+    this->executor->Wait();
+    this->executor = nullptr;
+  }
+  this->StopIoThread();
+  this->ExecuteCommands();
+
+  // Leave the registry at once, instead of waiting for the lease. The I/O
+  // thread is stopped and no command would run anymore, so the message is
+  // sent from here.
+  if (this->registry)
+  {
+    Header header(TRNSP_VERSION, this->guid, "", BYE, FLAG_WIRE_V2);
+    std::vector<char> buffer(header.GetHeaderLength());
+    header.Pack(&buffer[0]);
+    this->SendRegistryMsg(&buffer[0], buffer.size());
+    delete this->registry;
+    this->registry = nullptr;
+  }
+
+  if (this->publisher) delete this->publisher;
+  if (this->publisher) delete this->subscriber;
+  if (this->publisher) delete this->srvRequester;
+  if (this->publisher) delete this->srvReplier;
+  if (this->publisher) delete this->context;
+
+  this->myAddresses.clear();
+  this->mySrvAddresses.clear();
+
+  for (auto ring : this->shmReaders)
+    delete ring;
+  this->shmReaders.clear();
+  for (auto ring : this->shmClosed)
+    delete ring;
+  this->shmClosed.clear();
+  delete this->shmWriter;
+  this->shmWriter = nullptr;
+
+  // Leave the multicast group before closing the discovery port
+  if (this->bcastSock && this->multicast)
+  {
+    try
+    {
+      this->bcastSock->leaveGroup(this->bcastAddr, this->multicastIface);
+    }
+    catch(const SocketException &e)
+    {
+      std::cerr << "Error leaving the multicast group [" << this->bcastAddr
+                << "]: " << e.what() << "\n";
+    }
+    this->multicast = false;
+  }
+  delete this->bcastSock;
+  this->bcastSock = nullptr;
+  delete this->ucastSock;
+  this->ucastSock = nullptr;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvDiscoveryUpdates()
+{
+  if (this->registry)
+    return this->RecvRegistryUpdates();
+
+  return this->RecvDiscoveryMsg(this->bcastSock);
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvUnicastUpdates()
+{
+  return this->RecvDiscoveryMsg(this->ucastSock);
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvDiscoveryMsg(UDPSocket *_sock)
+{
+  char rcvStr[MaxRcvStr];     // Buffer for data
+  std::string srcAddr;           // Address of datagram source
+  unsigned short srcPort;        // Port of datagram source
+  int bytes;                 // Rcvd from the UDP socket
+
+  // Check if a datagram is available without blocking
+  zmq::pollitem_t item = { 0, _sock->sockDesc, ZMQ_POLLIN, 0 };
+  if (zmq::poll(&item, 1, 0) == 0)
+    return false;
+
+  try
+  {
+    bytes = _sock->recvFrom(rcvStr, MaxRcvStr, srcAddr, srcPort);
+  }
+  catch(const SocketException &e)
+  {
+    cerr << "Exception receiving from the UDP socket: " << e.what() << endl;
+    return false;
+  }
+
+  if (this->verbose)
+    cout << "\nReceived discovery update from " << srcAddr <<
+            ": " << srcPort << " (" << bytes << " bytes)" << endl;
+
+  // The message is parsed in place
+  DiscoveryMsgView msg;
+  if (!msg.Parse(rcvStr, bytes))
+  {
+    std::cerr << "Truncated discovery message from " << srcAddr << "\n";
+    return true;
+  }
+
+  if (this->DispatchDiscoveryMsg(msg, srcAddr, srcPort) != 0)
+    std::cerr << "Something went wrong parsing a discovery message\n";
+
+  return true;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvRegistryUpdates()
+{
+  zmq::message_t msg;
+  try
+  {
+    if (!this->registry->recv(&msg, ZMQ_DONTWAIT))
+      return false;
+  }
+  catch(const zmq::error_t& ze)
+  {
+    std::cerr << "Error receiving from the registry: " << ze.what() << "\n";
+    return false;
+  }
+
+  if (this->verbose)
+  {
+    std::cout << "\nReceived discovery update from the registry ("
+              << msg.size() << " bytes)" << std::endl;
+  }
+
+  DiscoveryMsgView header;
+  if (!header.Parse(static_cast<char*>(msg.data()), msg.size()))
+  {
+    std::cerr << "Truncated message from the registry\n";
+    return true;
+  }
+
+  // The registry acknowledges the heartbeats, and asks the node to register
+  // again when it did not know it, e.g. it restarted. The nodes learned
+  // from a previous registry are forgotten, the new one tells which are
+  // still alive.
+  if (header.GetType() == HEARTBEAT)
+  {
+    std::string registryGuid = transport::GetGuidStr(header.GetGuid());
+    std::lock_guard<std::mutex> lock(this->mutex);
+    bool changed =
+      !this->registryGuid.empty() && this->registryGuid != registryGuid;
+    if (changed)
+    {
+      for (auto &node : this->remoteNodes)
+        this->ExpireNode(node.first, node.second);
+      this->remoteNodes.clear();
+    }
+    if (changed || (header.GetFlags() & FLAG_REGISTER))
+      this->Register();
+    this->registryGuid = registryGuid;
+    return true;
+  }
+
+  if (this->DispatchDiscoveryMsg(header, this->master, 0) != 0)
+    std::cerr << "Something went wrong parsing a registry message\n";
+
+  return true;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::Register()
+{
+  if (this->verbose)
+    std::cout << "\nRegistering again with [" << this->master << "]\n";
+
+  for (TopicsInfo::TopicId id = 0; id < this->topics.GetIdCount(); ++id)
+  {
+    TopicInfo *info = this->topics.GetTopicInfo(id);
+    if (!info)
+      continue;
+
+    const std::string &topic = this->topics.GetTopicName(id);
+    if (info->advertisedByMe)
+    {
+      for (auto &address : this->myAddresses)
+        this->SendAdvertiseMsg(ADV, topic, address);
+    }
+    if (info->subscribed)
+      this->SendSubscribeMsg(SUB, topic);
+  }
+
+  for (TopicsInfo::TopicId id = 0; id < this->topicsSrvs.GetIdCount(); ++id)
+  {
+    TopicInfo *info = this->topicsSrvs.GetTopicInfo(id);
+    if (!info)
+      continue;
+
+    const std::string &topic = this->topicsSrvs.GetTopicName(id);
+    if (info->advertisedByMe)
+    {
+      for (auto &address : this->mySrvAddresses)
+        this->SendAdvertiseMsg(ADV_SVC, topic, address);
+    }
+    if (info->requested)
+      this->SendSubscribeMsg(SUB_SVC, topic);
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvTopicUpdates()
+{
+  // Leave the messages in the socket while the user catches up
+  if (this->ioThread && this->incoming->Full())
+    return false;
+
+  // Frames: topic, data header and data
+  zmq::message_t msg[3];
+  size_t parts =
+    this->RecvFrames(*this->subscriber, msg, 3, "topic update", ZMQ_DONTWAIT);
+  if (parts == 0)
+    return false;
+
+  if (parts == 3)
+    this->Deliver(TopicUpdate, msg);
+
+  return true;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvSrvRequest()
+{
+  // Leave the messages in the socket while the user catches up
+  if (this->ioThread && this->incoming->Full())
+    return false;
+
+  // Frames: topic, sender and data
+  zmq::message_t msg[3];
+  size_t parts =
+    this->RecvFrames(*this->srvReplier, msg, 3, "service request",
+                     ZMQ_DONTWAIT);
+  if (parts == 0)
+    return false;
+
+  if (parts == 3)
+    this->Deliver(SrvRequestMsg, msg);
+
+  return true;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvSrvReply()
+{
+  // Leave the messages in the socket while the user catches up
+  if (this->ioThread && this->incoming->Full())
+    return false;
+
+  // Frames: topic, sender and response
+  zmq::message_t msg[3];
+  size_t parts =
+    this->RecvFrames(*this->srvRequester, msg, 3, "service reply",
+                     ZMQ_DONTWAIT);
+  if (parts == 0)
+    return false;
+
+  if (parts != 3)
+    return true;
+
+  // A blocking request issued from another thread might be waiting for it
+  if (this->ioThread)
+  {
+    std::string topic(static_cast<char*>(msg[0].data()), msg[0].size());
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto waiter = this->srvWaiters.find(topic);
+    if (waiter != this->srvWaiters.end())
+    {
+      waiter->second->set_value(
+        std::string(static_cast<char*>(msg[2].data()), msg[2].size()));
+      this->srvWaiters.erase(waiter);
+      return true;
+    }
+  }
+
+  this->Deliver(SrvReplyMsg, msg);
+  return true;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::RecvShmUpdates()
+{
+  // Leave the messages in the rings while the user catches up
+  if (this->ioThread && this->incoming->Full())
+    return false;
+
+  std::string topic;
+  const char *data;
+  size_t size;
+
+  for (size_t i = 0; i < this->shmReaders.size(); ++i)
+  {
+    size_t index = (this->shmFirst + i) % this->shmReaders.size();
+    ShmRing *ring = this->shmReaders[index];
+
+    // A ring carries every topic of its publisher
+    while (ring->Read(topic, data, size))
+    {
+      bool subscribed;
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        subscribed = this->topics.Subscribed(topic);
+      }
+      if (!subscribed)
+        continue;
+
+      // The data header is written in front of the data
+      if (size < DataHeader::Length)
+      {
+        std::cerr << "Update on [" << topic << "] without header discarded\n";
+        continue;
+      }
+
+      this->shmFirst = index + 1;
+
+      // Frames: topic, data header and data
+      zmq::message_t msg[3];
+      msg[0].rebuild(topic.size());
+      memcpy(msg[0].data(), topic.data(), topic.size());
+      msg[1].rebuild(DataHeader::Length);
+      memcpy(msg[1].data(), data, DataHeader::Length);
+      data += DataHeader::Length;
+      size -= DataHeader::Length;
+
+      // The writer never waits, so the data is copied and checked before
+      // the callbacks see it.
+      msg[2].rebuild(size);
+      memcpy(msg[2].data(), data, size);
+      if (!ring->Intact())
+      {
+        std::cerr << "Update on [" << topic << "] overwritten in shared "
+                  << "memory before it was read\n";
+        return true;
+      }
+
+      this->Deliver(TopicUpdate, msg);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::ConnectShm(const std::string &_address)
+{
+  // shm://<host>/<segment>
+  const std::string scheme = "shm://";
+  size_t slash = _address.find('/', scheme.size());
+  if (slash == std::string::npos)
+    return false;
+
+  // Only the rings created on this host can be attached
+  if (_address.compare(scheme.size(), slash - scheme.size(),
+                       this->hostAddr) != 0)
+  {
+    return false;
+  }
+
+  std::string segment = _address.substr(slash);
+  for (auto ring : this->shmReaders)
+  {
+    if (ring->GetName() == segment)
+      return true;
+  }
+
+  ShmRing *ring = new ShmRing();
+  if (ring->Open(segment) != 0)
+  {
+    delete ring;
+    return false;
+  }
+
+  this->shmReaders.push_back(ring);
+  return true;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::DisconnectShm(const std::string &_address)
+{
+  std::string segment = _address.substr(_address.find('/', 6));
+  for (auto it = this->shmReaders.begin(); it != this->shmReaders.end(); ++it)
+  {
+    if ((*it)->GetName() == segment)
+    {
+      // The ring may be in use by RecvShmUpdates() if a callback
+      // unsubscribed, so it is released at the end of PollSockets().
+      this->shmClosed.push_back(*it);
+      this->shmReaders.erase(it);
+      this->shmFirst = 0;
+      return;
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::ConnectEndpoint(const std::string &_guid,
+                                      const std::string &_address,
+                                      const std::string &_topic)
+{
+  // The publisher is already connected through one of its addresses
+  auto pub = this->pubEndpoints.find(_guid);
+  if (pub != this->pubEndpoints.end())
+  {
+    this->endpoints[pub->second].topics.insert(_topic);
+    return true;
+  }
+
+  // The endpoint is connected but it belonged to another publisher, e.g. a
+  // node restarted on the same port
+  auto endpoint = this->endpoints.find(_address);
+  if (endpoint != this->endpoints.end())
+  {
+    this->pubEndpoints.erase(endpoint->second.guid);
+    this->pubEndpoints[_guid] = _address;
+    endpoint->second.guid = _guid;
+    endpoint->second.topics.insert(_topic);
+    return true;
+  }
+
+  // Shared memory rings are only reachable from the same host. The
+  // publisher also advertises a TCP address for the rest.
+  if (_address.compare(0, 6, "shm://") == 0)
+  {
+    if (!this->ConnectShm(_address))
+      return false;
+  }
+  else
+  {
+    try
+    {
+      this->subscriber->connect(_address.c_str());
+    }
+    catch(const zmq::error_t& ze)
+    {
+      std::cout << "Error connecting [" << ze.what() << "]\n";
+      return false;
+    }
+  }
+
+  if (this->verbose)
+    std::cout << "\t* Connected to [" << _address << "]\n";
+
+  this->pubEndpoints[_guid] = _address;
+  EndpointInfo &info = this->endpoints[_address];
+  info.guid = _guid;
+  info.topics.insert(_topic);
+  return true;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::ReleaseEndpoints(const std::string &_topic)
+{
+  for (auto it = this->endpoints.begin(); it != this->endpoints.end();)
+  {
+    it->second.topics.erase(_topic);
+    if (!it->second.topics.empty())
+    {
+      ++it;
+      continue;
+    }
+
+    std::string address = it->first;
+    ++it;
+    this->DisconnectEndpoint(address);
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Node::DisconnectEndpoint(const std::string &_address)
+{
+  auto endpoint = this->endpoints.find(_address);
+  if (endpoint == this->endpoints.end())
+    return;
+
+  if (_address.compare(0, 6, "shm://") == 0)
+    this->DisconnectShm(_address);
+  else
+  {
+    try
+    {
+      this->subscriber->disconnect(_address.c_str());
+    }
+    catch(const zmq::error_t& ze)
+    {
+      std::cerr << "Error disconnecting [" << ze.what() << "]\n";
+    }
+  }
+
+  if (this->verbose)
+    std::cout << "\t* Disconnected from [" << _address << "]\n";
+
+  this->pubEndpoints.erase(endpoint->second.guid);
+  this->endpoints.erase(endpoint);
+}
+
+//////////////////////////////////////////////////
+void transport::Node::CheckLiveness()
+{
+  auto now = std::chrono::steady_clock::now();
+  this->SendDueHeartbeat(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    now.time_since_epoch()).count());
+  if (now < this->nextExpiryCheck)
+    return;
+
+  this->nextExpiryCheck =
+    now + std::chrono::milliseconds(this->heartbeatInterval);
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto lease = std::chrono::milliseconds(this->leaseTimeout);
+  for (auto it = this->remoteNodes.begin(); it != this->remoteNodes.end();)
+  {
+    if (it->second.heartbeats && now - it->second.lastSeen > lease)
+    {
+      if (this->verbose)
+        std::cout << "\nNode [" << it->first << "] expired\n";
+
+      this->ExpireNode(it->first, it->second);
+      it = this->remoteNodes.erase(it);
+    }
+    else
+      ++it;
+  }
+
+  this->UpdateWireVersion();
+}
+
+//////////////////////////////////////////////////
+void transport::Node::SendDueHeartbeat(int64_t _now)
+{
+  int64_t due = this->nextHeartbeat.load(std::memory_order_relaxed);
+  if (_now < due)
+    return;
+
+  int64_t next = _now + std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::milliseconds(this->heartbeatInterval)).count();
+  if (this->nextHeartbeat.compare_exchange_strong(due, next))
+    this->SendHeartbeatMsg();
+}
+
+//////////////////////////////////////////////////
+void transport::Node::UpdateWireVersion()
+{
+  auto now = std::chrono::steady_clock::now();
+  auto lease = std::chrono::milliseconds(this->leaseTimeout);
+  for (auto it = this->legacyNodes.begin(); it != this->legacyNodes.end();)
+  {
+    if (now - it->second > lease)
+      it = this->legacyNodes.erase(it);
+    else
+      ++it;
+  }
+
+  bool compact = this->legacyNodes.empty() && now - this->startTime > lease;
+  if (this->verbose && compact != this->compactDiscovery)
+  {
+    std::cout << "\nDiscovery messages sent in version "
+              << (compact ? TRNSP_VERSION_COMPACT : TRNSP_VERSION) << "\n";
+  }
+  this->compactDiscovery = compact;
+}
+
+//////////////////////////////////////////////////
+bool transport::Node::ResolveTopicHash(uint8_t _type, uint64_t _hash,
+                                       std::string &_topic)
+{
+  TopicsInfo &topics = _type == ADV ? this->topics : this->topicsSrvs;
+  TopicsInfo::TopicId id = topics.GetIdByHash(_hash);
+  TopicInfo *info = topics.GetTopicInfo(id);
+  if (!info || !(_type == ADV ? info->subscribed : info->requested))
+    return false;
+
+  _topic = topics.GetTopicName(id);
+  return true;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::ConnectKnownPublishers(const std::string &_topic)
+{
+  for (auto &node : this->remoteNodes)
+  {
+    for (auto &adv : node.second.advs)
+    {
+      if (adv.first == _topic &&
+          this->ConnectEndpoint(node.first, adv.second, _topic))
+      {
+        this->topics.SetConnected(_topic, true);
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Node::LoadDiscoveryCache()
+{
+  std::vector<CachedAdv> advs;
+  this->discoveryCache.Load(DiscoveryCacheMaxAge, advs);
+  for (auto &adv : advs)
+  {
+    if (this->guidStr.compare(adv.guid) == 0 ||
+        (adv.type != ADV && adv.type != ADV_SVC))
+    {
+      continue;
+    }
+
+    this->DispatchAdv(adv.guid, adv.type, adv.topic, adv.address);
+
+    // Live discovery has to confirm the node before its lease expires
+    this->remoteNodes[adv.guid].heartbeats = true;
+  }
+
+  if (this->verbose)
+    std::cout << "Loaded " << advs.size() << " cached addresses\n";
+}
+
+//////////////////////////////////////////////////
+void transport::Node::ExpireNode(const std::string &_guid,
+                                 const RemoteNodeInfo &_info)
+{
+  this->discoveryCache.Remove(_guid);
+
+  // Forget the sequence numbers of the node, so they do not accumulate
+  uint64_t id;
+  if (GetPublisherId(_guid, id))
+  {
+    this->localPublishers.erase(id);
+    for (TopicsInfo::TopicId t = 0; t < this->topics.GetIdCount(); ++t)
+    {
+      TopicInfo *info = this->topics.GetTopicInfo(t);
+      if (info)
+        info->lastSeqs.erase(id);
+    }
+  }
+
+  for (auto &adv : _info.advs)
+    this->topics.RemoveAdvAddress(adv.first, adv.second);
+  for (auto &adv : _info.srvAdvs)
+    this->topicsSrvs.RemoveAdvAddress(adv.first, adv.second);
+
+  // Close the connection to the publisher. Its topics stay connected
+  // through the other publishers, if any.
+  std::set<std::string> orphans;
+  auto pub = this->pubEndpoints.find(_guid);
+  if (pub != this->pubEndpoints.end())
+  {
+    orphans = this->endpoints[pub->second].topics;
+    this->DisconnectEndpoint(pub->second);
+  }
+  for (auto &endpoint : this->endpoints)
+  {
+    for (auto &topic : endpoint.second.topics)
+      orphans.erase(topic);
+  }
+
+  // Ask again for the topics left without publishers
+  for (auto &topic : orphans)
+  {
+    this->topics.SetConnected(topic, false);
+    this->SendSubscribeMsg(SUB, topic);
+  }
+
+  // Fail over the services to another known provider
+  std::vector<std::string> addresses;
+  for (auto &adv : _info.srvAdvs)
+  {
+    const std::string &topic = adv.first;
+    try
+    {
+      this->srvRequester->disconnect(adv.second.c_str());
+    }
+    catch(const zmq::error_t& ze)
+    {
+      // The address was not connected
+    }
+
+    if (!this->topicsSrvs.Requested(topic))
+      continue;
+
+    this->topicsSrvs.SetConnected(topic, false);
+    if (this->topicsSrvs.GetAdvAddresses(topic, addresses))
+      this->DispatchAdv("", ADV_SVC, topic, addresses.front());
+    else
+      this->SendSubscribeMsg(SUB_SVC, topic);
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Node::Deliver(IncomingType _type, zmq::message_t *_frames)
+{
+  if (!this->ioThread)
+  {
+    this->Dispatch(_type, _frames);
+    return;
+  }
+
+  IncomingMsg msg;
+  msg.type = _type;
+  for (int i = 0; i < 3; ++i)
+    msg.frames[i].move(&_frames[i]);
+
+  // The handlers check that there is room before reading from the socket
+  this->incoming->Push(std::move(msg));
+
+  // Wake up the user thread if it is waiting for messages. The fence pairs
+  // with the one in DispatchIncoming(): either the waiter sees the message
+  // or this thread sees the flag, otherwise the wakeup would be lost.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (this->incomingWaiting.load(std::memory_order_relaxed))
+  {
+    std::lock_guard<std::mutex> lock(this->incomingMutex);
+    this->incomingCv.notify_one();
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Node::Dispatch(IncomingType _type, zmq::message_t *_frames)
+{
+  if (this->executor)
+  {
+    // The frames are kept alive by the task, so the data is not copied
+    std::shared_ptr<IncomingMsg> msg(new IncomingMsg());
+    msg->type = _type;
+    for (int i = 0; i < 3; ++i)
+      msg->frames[i].move(&_frames[i]);
+
+    std::string topic(static_cast<char*>(msg->frames[0].data()),
+                      msg->frames[0].size());
+
+    this->executor->Post(topic, [this, msg, topic]()
+    {
+      switch (msg->type)
+      {
+        case TopicUpdate:
+          this->DispatchTopicUpdate(topic, msg->frames[1], msg->frames[2]);
+          break;
+        case SrvRequestMsg:
+          this->DispatchSrvRequest(msg->frames);
+          break;
+        case SrvReplyMsg:
+          this->DispatchSrvReply(msg->frames);
+          break;
+      }
+    });
+    return;
+  }
+
+  switch (_type)
+  {
+    case TopicUpdate:
+      this->rcvTopic.assign(static_cast<char*>(_frames[0].data()),
+                            _frames[0].size());
+      this->DispatchTopicUpdate(this->rcvTopic, _frames[1], _frames[2]);
+      break;
+    case SrvRequestMsg:
+      this->DispatchSrvRequest(_frames);
+      break;
+    case SrvReplyMsg:
+      this->DispatchSrvReply(_frames);
+      break;
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Node::DispatchTopicUpdate(const std::string &_topic,
+                                          zmq::message_t &_header,
+                                          zmq::message_t &_data)
+{
+  const std::string &topic = _topic;
+  const char *data = static_cast<char*>(_data.data());
+  size_t size = _data.size();
+
+  DataHeader header;
+  if (!header.Unpack(static_cast<char*>(_header.data()), _header.size()))
+  {
+    std::cerr << "Update on [" << topic << "] with an invalid header\n";
+    return;
+  }
+
+  // The callbacks are executed without holding the lock, so they can use
+  // the node.
+  bool subscribed = false;
+  TopicInfo::RawCallback rawCb;
+  TopicInfo::Callback cb;
+  std::shared_ptr<TopicStatsCollector> stats;
+  bool collect = this->statsEnabled.load(std::memory_order_relaxed);
+  bool sameHost = false;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    TopicInfo *info = this->topics.GetTopicInfo(topic);
+    if (info && info->subscribed)
+    {
+      // A jump in the sequence of a publisher means that updates were lost.
+      // The first update received from a publisher only sets the reference.
+      uint64_t seq = header.GetSequence();
+      auto last = info->lastSeqs.find(header.GetPublisherId());
+      if (last == info->lastSeqs.end())
+        info->lastSeqs[header.GetPublisherId()] = seq;
+      else if (seq > last->second)
+      {
+        uint64_t gap = seq - last->second - 1;
+        if (gap > 0 && this->verbose)
+        {
+          std::cerr << "\n" << gap << " update(s) lost on [" << topic
+                    << "]\n";
+        }
+        info->lost += gap;
+        last->second = seq;
+      }
+
+      if (collect)
+      {
+        if (!info->stats)
+          info->stats.reset(new TopicStatsCollector());
+        stats = info->stats;
+        sameHost = header.GetPublisherId() == this->publisherId ||
+          this->localPublishers.count(header.GetPublisherId()) > 0;
+      }
+
+      subscribed = true;
+      rawCb = info->rawCb;
+      if (!rawCb)
+        cb = info->cb;
+    }
+  }
+
+  // The steady clocks of different hosts are not comparable, so only the
+  // updates of the publishers on this host have a latency
+  if (stats && sameHost)
+  {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    stats->Record(size, now - header.GetTimestamp());
+  }
+  else if (stats)
+    stats->Record(size);
+
+  if (subscribed)
+  {
+    // Execute the callback registered. The raw callback receives a view of
+    // the frame, the regular callback receives its own copy of the data.
+    if (rawCb)
+      rawCb(topic, data, size);
+    else if (cb)
+      cb(topic, std::string(data, size));
+    else
+      std::cerr << "I don't have a callback for topic [" << topic << "]\n";
+  }
+  else
+    std::cerr << "I am not subscribed to topic [" << topic << "]\n";
+}
+
+//////////////////////////////////////////////////
+void transport::Node::DispatchSrvRequest(zmq::message_t *_frames)
+{
+  std::string topic(static_cast<char*>(_frames[0].data()), _frames[0].size());
+  std::string data(static_cast<char*>(_frames[2].data()), _frames[2].size());
+
+  bool advertised;
+  TopicInfo::RepCallback cb;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    advertised = this->topicsSrvs.AdvertisedByMe(topic);
+    if (advertised)
+      this->topicsSrvs.GetRepCallback(topic, cb);
+  }
+
+  if (advertised)
+  {
+    // Execute the callback registered
+    std::string response;
+    if (cb)
+      cb(topic, data, response);
+    else
+      std::cerr << "I don't have a REP cback for topic [" << topic << "]\n";
+
+    // Send the service call response
+    // Todo: include the return code
+    if (this->verbose)
+      std::cout << "\nResponse (" << topic << ")" << std::endl;
+
+    this->RunInIoThread([this, topic, response]()
+    {
+      this->SendFrames(*this->srvReplier, topic, this->srvReplierEP, response);
+    });
+  }
+  else
+  {
+    std::cerr << "Received a svc call not advertised (" << topic << ")\n";
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Node::DispatchSrvReply(zmq::message_t *_frames)
+{
+  std::string topic(static_cast<char*>(_frames[0].data()), _frames[0].size());
+  std::string response(static_cast<char*>(_frames[2].data()),
+                       _frames[2].size());
+
+  // Execute the callback registered
+  TopicInfo::ReqCallback cb;
+  bool found;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    found = this->topicsSrvs.GetReqCallback(topic, cb);
+  }
+
+  if (found)
+    // ToDo: send the return code
+    cb(topic, 0, response);
+  else
+    std::cerr << "REQ callback for topic [" << topic << "] not found\n";
+}
+
+//////////////////////////////////////////////////
+void transport::Node::RunIoThread()
+{
+  while (this->ioRunning)
+  {
+    // Give the user a chance to catch up if the queue is full
+    if (this->incoming->Full())
+    {
+      this->ExecuteCommands();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    this->PollSockets(IoThreadTimeout);
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Node::DispatchIncoming()
+{
+  IncomingMsg msg;
+
+  if (this->incoming->Empty())
+  {
+    // Wait for the I/O thread to queue a new message
+    std::unique_lock<std::mutex> lock(this->incomingMutex);
+    this->incomingWaiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    this->incomingCv.wait_for(lock, std::chrono::milliseconds(this->timeout),
+      [this]() {return !this->incoming->Empty();});
+    this->incomingWaiting = false;
+  }
+
+  // Bound the work of one iteration, as in the single threaded mode
+  for (int i = 0; i < this->spinBudget && this->incoming->Pop(msg); ++i)
+    this->Dispatch(msg.type, msg.frames);
+}
+
+//////////////////////////////////////////////////
+void transport::Node::RunInIoThread(std::function<void()> &&_task)
+{
+  if (this->ioThread || this->executor)
+    this->commands.Push(std::move(_task));
+  else
+    _task();
+}
+
+//////////////////////////////////////////////////
+void transport::Node::ExecuteCommands()
+{
+  std::function<void()> task;
+  while (this->commands.Pop(task))
+    task();
+}
+
+//////////////////////////////////////////////////
+int transport::Node::SendFrames(zmq::socket_t &_socket,
+                                const std::string &_topic,
+                                const std::string &_sender,
+                                const std::string &_data)
+{
+  zmq::message_t topic(_topic.size());
+  memcpy(topic.data(), _topic.data(), _topic.size());
+  zmq::message_t sender(_sender.size());
+  memcpy(sender.data(), _sender.data(), _sender.size());
+  zmq::message_t data(_data.size());
+  memcpy(data.data(), _data.data(), _data.size());
+
+  if (this->verbose)
+  {
+    std::cout << "\t[" << _topic << "][" << _sender << "]["
+              << _data.size() << " bytes]" << std::endl;
+  }
+
+  try
+  {
+    _socket.send(topic, ZMQ_SNDMORE);
+    _socket.send(sender, ZMQ_SNDMORE);
+    _socket.send(data, 0);
+  }
+  catch(const zmq::error_t& ze)
+  {
+    std::cerr << "Error sending [" << _topic << "]: " << ze.what() << "\n";
+    return -1;
+  }
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+size_t transport::Node::RecvFrames(zmq::socket_t &_socket,
+                                   zmq::message_t *_frames, size_t _count,
+                                   const std::string &_what, int _flags)
+{
+  size_t parts = 0;
+  bool more = true;
+
+  try
+  {
+    while (more)
+    {
+      // Extra frames are received in the last slot and discarded. The frames
+      // of a multipart message arrive together, so only the first receive
+      // can return without data.
+      zmq::message_t &frame = _frames[std::min(parts, _count - 1)];
+      if (!_socket.recv(&frame, parts == 0 ? _flags : 0))
+        return parts;
+
+      ++parts;
+      more = frame.more();
+    }
+  }
+  catch(const zmq::error_t& ze)
+  {
+    std::cerr << "Error receiving a " << _what << ": " << ze.what() << "\n";
+    return parts;
+  }
+
+  if (this->verbose)
+  {
+    std::cout << "\nReceived " << _what << std::endl;
+    for (size_t i = 0; i < std::min(parts, _count); ++i)
+      std::cout << "\t[" << _frames[i].size() << " bytes]" << std::endl;
+  }
+
+  if (parts != _count)
+  {
+    std::cerr << "Unexpected " << _what << ". Expected " << _count
+              << " message parts but received a message with " << parts
+              << std::endl;
+  }
+
+  return parts;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::SendPendingAsyncSrvCalls()
+{
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  // Check if there are any pending requests ready to send
+  for (TopicsInfo::TopicId id = 0; id < this->topicsSrvs.GetIdCount(); ++id)
+  {
+    TopicInfo *info = this->topicsSrvs.GetTopicInfo(id);
+    if (!info || !info->connected)
+      continue;
+
+    const std::string &topic = this->topicsSrvs.GetTopicName(id);
+    while (!info->pendingReqs.empty())
+    {
+      std::string data = info->pendingReqs.front();
+      info->pendingReqs.pop_front();
+
+      // Send the service call request
+      if (this->verbose)
+        std::cout << "\nAsync request [" << topic << "][" << data << "]\n";
+
+      this->SendFrames(*this->srvRequester, topic, this->srvRequesterEP, data);
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+int transport::Node::SendTopicMsg(TopicInfo *_info, const std::string &_topic,
+                                  zmq::message_t &_payload)
+{
+  zmq::message_t topic(_topic.size());
+  memcpy(topic.data(), _topic.data(), _topic.size());
 
-  this->myAddresses.clear();
-  this->mySrvAddresses.clear();
+  return this->SendTopicMsg(_info, _topic, topic, _payload);
 }
 
 //////////////////////////////////////////////////
-void transport::Node::RecvDiscoveryUpdates()
+int transport::Node::SendTopicMsg(TopicInfo *_info, const std::string &_topic,
+                                  zmq::message_t &_topicFrame,
+                                  zmq::message_t &_payload)
 {
-  char rcvStr[MaxRcvStr];     // Buffer for data
-  std::string srcAddr;           // Address of datagram source
-  unsigned short srcPort;        // Port of datagram source
-  int bytes;                 // Rcvd from the UDP broadcast socket
+  if (this->verbose)
+  {
+    std::cout << "\nPublish(" << _topic << ")" << std::endl;
+    std::cout << "\t[" << _topic << "][" << this->tcpEndpoint << "]["
+              << _payload.size() << " bytes]" << std::endl;
+  }
+
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
 
   try
   {
-    bytes = this->bcastSock->recvFrom(rcvStr, MaxRcvStr, srcAddr, srcPort);
+    std::lock_guard<std::mutex> lock(this->pubMutex);
+
+    // The sequence is assigned under the lock, so the updates leave in order
+    zmq::message_t header(DataHeader::Length);
+    DataHeader(this->publisherId, _info->pubSeq.fetch_add(1) + 1, now, 0).Pack(
+      static_cast<char*>(header.data()));
+
+    // The local subscribers read the update from shared memory
+    if (this->shmWriter &&
+        this->shmWriter->Write(_topic, static_cast<char*>(header.data()),
+                               header.size(),
+                               static_cast<char*>(_payload.data()),
+                               _payload.size()) != 0)
+    {
+      std::cerr << "Update on [" << _topic << "] (" << _payload.size()
+                << " bytes) does not fit in the shared memory ring\n";
+    }
+
+    // The copy shares the data of the frame built in advance
+    zmq::message_t topic;
+    topic.copy(&_topicFrame);
+
+    this->publisher->send(topic, ZMQ_SNDMORE);
+    this->publisher->send(header, ZMQ_SNDMORE);
+    this->publisher->send(_payload, 0);
   }
-  catch(const SocketException &e)
+  catch(const zmq::error_t& ze)
   {
-    cerr << "Exception receiving from the UDP socket: " << e.what() << endl;
-    return;
+    std::cerr << "Error publishing [" << _topic << "]: " << ze.what() << "\n";
+    return -1;
   }
 
-  if (this->verbose)
-    cout << "\nReceived discovery update from " << srcAddr <<
-            ": " << srcPort << " (" << bytes << " bytes)" << endl;
+  // A node that publishes without spinning keeps its lease
+  this->SendDueHeartbeat(now);
 
-  if (this->DispatchDiscoveryMsg(rcvStr) != 0)
-    std::cerr << "Something went wrong parsing a discovery message\n";
+  return 0;
 }
 
 //////////////////////////////////////////////////
-void transport::Node::RecvTopicUpdates()
+int transport::Node::DispatchDiscoveryMsg(DiscoveryMsgView &_msg,
+                                           const std::string &_srcAddr,
+                                           unsigned short _srcPort)
 {
-  zmsg *msg = new zmsg(*this->subscriber);
+  AdvRecordView record;
+
   if (this->verbose)
+    _msg.Print();
+
+  std::lock_guard<std::mutex> lock(this->mutex);
+
+  // The strings keep their capacity between messages
+  transport::GetGuidStr(_msg.GetGuid(), this->rcvdGuid);
+  _msg.GetTopic().AssignTo(this->rcvdTopic);
+  const std::string &rcvdGuid = this->rcvdGuid;
+  const std::string &topic = this->rcvdTopic;
+
+  // Any message renews the lease of its node
+  auto remote = this->remoteNodes.find(rcvdGuid);
+  if (remote != this->remoteNodes.end())
   {
-    std::cout << "\nReceived topic update" << std::endl;
-    msg->dump();
+    remote->second.lastSeen = std::chrono::steady_clock::now();
+    if (_msg.GetType() == HEARTBEAT)
+      remote->second.heartbeats = true;
   }
 
-  if (msg->parts() != 3)
+  // A node that does not decode the compact encoding needs version 1. It is
+  // detected from any of its messages, not only from its heartbeats.
+  if (_msg.GetVersion() == TRNSP_VERSION &&
+      !(_msg.GetFlags() & FLAG_WIRE_V2))
   {
-    std::cerr << "Unexpected topic update. Expected 3 message parts but "
-              << "received a message with " << msg->parts() << std::endl;
-    return;
+    bool known = this->legacyNodes.count(rcvdGuid) > 0;
+    this->legacyNodes[rcvdGuid] = std::chrono::steady_clock::now();
+    if (!known)
+      this->UpdateWireVersion();
   }
+  // The subscriptions are answered in the encoding of their message. A
+  // version 1 message without FLAG_WIRE_V2 comes from a node that may
+  // predate ADV_BATCH.
+  AdvEncoding encoding = BatchAdvs;
+  if (_msg.GetVersion() == TRNSP_VERSION_COMPACT)
+    encoding = CompactAdvs;
+  else if (!(_msg.GetFlags() & FLAG_WIRE_V2))
+    encoding = SingleAdvs;
+
+  switch (_msg.GetType())
+  {
+    case ADV:
+    case ADV_SVC:
+      // Read the address
+      _msg.GetAddress().AssignTo(this->rcvdAddress);
 
-  // Read the DATA message
-  std::string topic = std::string((char*)msg->pop_front().c_str());
-  msg->pop_front(); // Sender
-  std::string data = std::string((char*)msg->pop_front().c_str());
+      this->DispatchAdv(rcvdGuid, _msg.GetType(), topic, this->rcvdAddress);
+      if (this->guidStr.compare(rcvdGuid) != 0)
+      {
+        this->discoveryCache.Store(rcvdGuid, _msg.GetType(), topic,
+                                   this->rcvdAddress);
+      }
+      break;
 
-  if (this->topics.Subscribed(topic))
-  {
-    // Execute the callback registered
-    TopicInfo::Callback cb;
-    if (this->topics.GetCallback(topic, cb))
-      cb(topic, data);
-    else
-      std::cerr << "I don't have a callback for topic [" << topic << "]\n";
+    case ADV_BATCH:
+      // Read the records
+      while (_msg.NextRecord(record))
+      {
+        if (record.type != ADV && record.type != ADV_SVC)
+        {
+          std::cerr << "Unknown record type [" << record.type << "]\n";
+          continue;
+        }
+        // The records with the hash only answer our own subscriptions
+        if (record.topic.GetSize() > 0)
+          record.topic.AssignTo(this->rcvdTopic);
+        else if (!this->ResolveTopicHash(record.type, record.topicHash,
+                                         this->rcvdTopic))
+        {
+          continue;
+        }
+        record.address.AssignTo(this->rcvdAddress);
+        this->DispatchAdv(rcvdGuid, record.type, this->rcvdTopic,
+                          this->rcvdAddress);
+        if (this->guidStr.compare(rcvdGuid) != 0)
+        {
+          this->discoveryCache.Store(rcvdGuid, record.type, this->rcvdTopic,
+                                     this->rcvdAddress);
+        }
+      }
+      break;
+
+    case SUB:
+      // Check if I advertise the topic requested
+      if (this->topics.AdvertisedByMe(topic))
+        this->ScheduleReply(ADV, topic, _srcAddr, _srcPort, encoding);
+
+      break;
+
+    case SUB_SVC:
+      // Check if I advertise the service call requested
+      if (this->topicsSrvs.AdvertisedByMe(topic))
+        this->ScheduleReply(ADV_SVC, topic, _srcAddr, _srcPort, encoding);
+
+      break;
+
+    case HEARTBEAT:
+      // The node is alive, so are its cached addresses
+      this->discoveryCache.Touch(rcvdGuid);
+      break;
+
+    case BYE:
+      // The node left
+      if (remote != this->remoteNodes.end())
+      {
+        if (this->verbose)
+          std::cout << "\nNode [" << rcvdGuid << "] left\n";
+
+        this->ExpireNode(rcvdGuid, remote->second);
+        this->remoteNodes.erase(remote);
+      }
+      break;
+
+    default:
+      std::cerr << "Unknown message type [" << _msg.GetType() << "]\n";
+      break;
   }
-  else
-    std::cerr << "I am not subscribed to topic [" << topic << "]\n";
+
+  return 0;
 }
 
 //////////////////////////////////////////////////
-void transport::Node::RecvSrvRequest()
+void transport::Node::DispatchAdv(const std::string &_guid, uint8_t _type,
+                                  const std::string &_topic,
+                                  const std::string &_address)
 {
-  zmsg *msg = new zmsg(*this->srvReplier);
-  if (this->verbose)
+  // Remember what every remote node advertised, to remove it on expiry
+  if (!_guid.empty() && this->guidStr.compare(_guid) != 0)
   {
-    std::cout << "\nReceived service request" << std::endl;
-    msg->dump();
+    RemoteNodeInfo &node = this->remoteNodes[_guid];
+    if (_type == ADV)
+      node.advs.insert(std::make_pair(_topic, _address));
+    else
+      node.srvAdvs.insert(std::make_pair(_topic, _address));
+
+    // The latency of the updates is only measured for the publishers that
+    // share our steady clock
+    uint64_t id;
+    if (_type == ADV && IsLocalAddress(_address, this->hostAddr) &&
+        GetPublisherId(_guid, id))
+    {
+      this->localPublishers.insert(id);
+    }
   }
 
-  if (msg->parts() != 3)
+  if (_type == ADV)
   {
-    std::cerr << "Unexpected service request. Expected 3 message parts but "
-              << "received a message with " << msg->parts() << std::endl;
+    // Register the advertised address for the topic
+    this->topics.AddAdvAddress(_topic, _address);
+
+    // Check if we are interested in this topic. Every publisher of the
+    // topic is connected, but only once: a connection carries all the
+    // topics of its publisher.
+    if (this->topics.Subscribed(_topic) &&
+        this->guidStr.compare(_guid) != 0 &&
+        this->ConnectEndpoint(_guid, _address, _topic))
+    {
+      this->topics.SetConnected(_topic, true);
+    }
+
     return;
   }
 
-  // Read the REQ message
-  std::string topic = std::string((char*)msg->pop_front().c_str());
-  std::string sender = std::string((char*)msg->pop_front().c_str());
-  std::string data = std::string((char*)msg->pop_front().c_str());
+  // Register the advertised address for the service call
+  this->topicsSrvs.AddAdvAddress(_topic, _address);
 
-  if (this->topicsSrvs.AdvertisedByMe(topic))
+  // Check if we are interested in this service call
+  if (this->topicsSrvs.Requested(_topic) &&
+      !this->topicsSrvs.Connected(_topic) &&
+      this->guidStr.compare(_guid) != 0)
   {
-    // Execute the callback registered
-    TopicInfo::RepCallback cb;
-    std::string response;
-    if (this->topicsSrvs.GetRepCallback(topic, cb))
-      cb(topic, data, response);
-    else
-      std::cerr << "I don't have a REP cback for topic [" << topic << "]\n";
-
-    // Send the service call response
-    zmsg reply;
-    reply.push_back((char*)topic.c_str());
-    reply.push_back((char*)this->srvReplierEP.c_str());
-    reply.push_back((char*)response.c_str());
-    // Todo: include the return code
-
-    if (this->verbose)
+    try
     {
-      std::cout << "\nResponse (" << topic << ")" << std::endl;
-      reply.dump();
+      this->srvRequester->connect(_address.c_str());
+      this->topicsSrvs.SetConnected(_topic, true);
+      if (this->verbose)
+        std::cout << "\t* Connected to [" << _address << "]\n";
+    }
+    catch(const zmq::error_t& ze)
+    {
+      std::cout << "Error connecting [" << ze.what() << "]\n";
     }
-    reply.send(*this->srvReplier);
-  }
-  else
-  {
-    std::cerr << "Received a svc call not advertised (" << topic << ")\n";
   }
 }
 
 //////////////////////////////////////////////////
-void transport::Node::RecvSrvReply()
+int transport::Node::SendAdvertiseMsg(uint8_t _type, const std::string &_topic,
+                                      const std::string &_address)
 {
-  zmsg *msg = new zmsg(*this->srvRequester);
+  assert(_topic != "");
+
   if (this->verbose)
+    std::cout << "\t* Queuing ADV msg [" << _topic << "][" << _address
+              << "]" << std::endl;
+
+  // The record also answers the subscriptions waiting for a reply
+  this->pendingReplies.erase(std::make_pair(_type, _topic));
+
+  // Send the pending records when the batch is full
+  if (!this->advBatch.AddRecord(_type, _topic, _address))
   {
-    std::cout << "\nReceived async service reply" << std::endl;
-    msg->dump();
+    int rc = this->FlushAdvertiseMsgs();
+    this->advBatch.AddRecord(_type, _topic, _address);
+    return rc;
   }
 
-  if (msg->parts() != 3)
+  return 0;
+}
+
+//////////////////////////////////////////////////
+void transport::Node::ScheduleReply(uint8_t _type, const std::string &_topic,
+                                    const std::string &_srcAddr,
+                                    unsigned short _srcPort,
+                                    AdvEncoding _encoding)
+{
+  // A reply already scheduled answers this subscription too
+  auto key = std::make_pair(_type, _topic);
+  auto it = this->pendingReplies.find(key);
+  if (it == this->pendingReplies.end())
   {
-    std::cerr << "Unexpected service reply. Expected 3 message parts but "
-              << "received a message with " << msg->parts() << std::endl;
-    return;
+    int delay = 0;
+    if (this->replyJitter > 0)
+    {
+      delay = std::uniform_int_distribution<int>(0, this->replyJitter)(
+        this->jitterGenerator);
+    }
+    it = this->pendingReplies.insert(std::make_pair(key, PendingReply())).first;
+    it->second.due =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
   }
 
-  // Read the SRV_REP message
-  std::string topic = std::string((char*)msg->pop_front().c_str());
-  std::string((char*)msg->pop_front().c_str());
-  std::string response = std::string((char*)msg->pop_front().c_str());
+  // The subscriptions sent from the discovery port come from nodes without
+  // a unicast socket, or share the port with other nodes of the host.
+  PendingReply &reply = it->second;
+  if (_srcPort == this->bcastPort)
+    reply.broadcast = true;
+  else if (!reply.broadcast)
+  {
+    // A requester that also subscribed in a simpler encoding is answered
+    // in it
+    auto requester = reply.requesters.insert(
+      std::make_pair(std::make_pair(_srcAddr, _srcPort), _encoding)).first;
+    requester->second = std::min(requester->second, _encoding);
+  }
 
-  // Execute the callback registered
-  TopicInfo::ReqCallback cb;
-  if (this->topicsSrvs.GetReqCallback(topic, cb))
-    // ToDo: send the return code
-    cb(topic, 0, response);
-  else
-    std::cerr << "REQ callback for topic [" << topic << "] not found\n";
+  if (reply.requesters.size() > MaxUnicastReplies)
+  {
+    reply.broadcast = true;
+    reply.requesters.clear();
+  }
 }
 
 //////////////////////////////////////////////////
-void transport::Node::SendPendingAsyncSrvCalls()
+int transport::Node::SendDueReplies()
 {
-  // Check if there are any pending requests ready to send
-  for (auto it = this->topicsSrvs.GetTopicsInfo().begin();
-       it != this->topicsSrvs.GetTopicsInfo().end(); ++it)
+  // Unicast records, by destination and encoding
+  std::map<std::pair<std::pair<std::string, unsigned short>, AdvEncoding>,
+           AdvBatchMsg> batches;
+  auto now = std::chrono::steady_clock::now();
+  int wait = -1;
+  for (auto it = this->pendingReplies.begin();
+       it != this->pendingReplies.end();)
   {
-    std::string topic = it->first;
+    if (it->second.due > now)
+    {
+      int left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        it->second.due - now).count() + 1;
+      wait = wait < 0 ? left : std::min(wait, left);
+      ++it;
+      continue;
+    }
+
+    uint8_t type = it->first.first;
+    std::string topic = it->first.second;
+    PendingReply reply = it->second;
+    it = this->pendingReplies.erase(it);
 
-    if (!this->topicsSrvs.Connected(topic))
+    const std::vector<std::string> &addresses =
+      type == ADV ? this->myAddresses : this->mySrvAddresses;
+    if (reply.broadcast)
+    {
+      for (auto &address : addresses)
+        this->SendAdvertiseMsg(type, topic, address);
       continue;
+    }
 
-    while (this->topicsSrvs.PendingReqs(topic))
+    for (auto &requester : reply.requesters)
     {
-      std::string data;
-      if (!this->topicsSrvs.DelReq(topic, data))
+      auto batch = batches.find(requester);
+      if (batch == batches.end())
       {
-        std::cerr << "Something went wrong removing a service request on "
-                  << "topic (" << topic << ")\n";
-        continue;
+        batch = batches.insert(
+          std::make_pair(requester, AdvBatchMsg(this->advBatch.GetHeader())))
+          .first;
       }
 
-      // Send the service call request
-      zmsg msg;
-      msg.push_back((char*)topic.c_str());
-      msg.push_back((char*)this->srvRequesterEP.c_str());
-      msg.push_back((char*)data.c_str());
-
-      if (this->verbose)
+      for (auto &address : addresses)
       {
-        std::cout << "\nAsync request [" << topic << "][" << data << "]\n";
-        msg.dump();
+        // Send the pending records when the batch is full
+        if (!batch->second.AddRecord(type, topic, address))
+        {
+          this->SendAdvBatchMsg(batch->second, this->ucastSock,
+                                requester.first.first, requester.first.second,
+                                requester.second, true);
+          batch->second.AddRecord(type, topic, address);
+        }
       }
-      msg.send(*this->srvRequester);
     }
   }
+
+  for (auto &batch : batches)
+  {
+    this->SendAdvBatchMsg(batch.second, this->ucastSock,
+                          batch.first.first.first, batch.first.first.second,
+                          batch.first.second, true);
+  }
+
+  return wait;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::DispatchDiscoveryMsg(char *_msg)
+int transport::Node::FlushAdvertiseMsgs()
 {
-  Header header;
-  AdvMsg advMsg;
-  std::string address;
-  char *pBody = _msg;
-
-  header.Unpack(_msg);
-  pBody += header.GetHeaderLength();
-
-  std::string topic = header.GetTopic();
-  std::string rcvdGuid = transport::GetGuidStr(header.GetGuid());
-
-  if (this->verbose)
-    header.Print();
-
-  switch (header.GetType())
+  if (this->registry)
   {
-    case ADV:
-      // Read the address
-      advMsg.UnpackBody(pBody);
-      address = advMsg.GetAddress();
-
-      if (this->verbose)
-        advMsg.PrintBody();
-
-      // Register the advertised address for the topic
-      this->topics.AddAdvAddress(topic, address);
-
-      // Check if we are interested in this topic
-      if (this->topics.Subscribed(topic) &&
-          !this->topics.Connected(topic) &&
-          this->guidStr.compare(rcvdGuid) != 0)
-      {
-        try
-        {
-          this->subscriber->connect(address.c_str());
-          this->topics.SetConnected(topic, true);
-          if (this->verbose)
-            std::cout << "\t* Connected to [" << address << "]\n";
-        }
-        catch(const zmq::error_t& ze)
-        {
-          std::cout << "Error connecting [" << ze.what() << "]\n";
-        }
-      }
-
-      break;
+    if (this->advBatch.GetRecords().empty())
+      return 0;
 
-    case ADV_SVC:
-      // Read the address
-      advMsg.UnpackBody(pBody);
-      address = advMsg.GetAddress();
+    std::vector<char> buffer(this->advBatch.GetMsgLength());
+    this->advBatch.Pack(&buffer[0]);
+    this->advBatch.Clear();
+    return this->SendToRegistry(&buffer[0], buffer.size());
+  }
 
-      if (this->verbose)
-        advMsg.PrintBody();
+  // The broadcasts are batched from the start. The nodes that predate
+  // ADV_BATCH get single records in the replies to their subscriptions.
+  return this->SendAdvBatchMsg(this->advBatch, this->bcastSock,
+                               this->bcastAddr, this->bcastPort,
+                               this->compactDiscovery ? CompactAdvs :
+                               BatchAdvs, false);
+}
 
-      // Register the advertised address for the service call
-      this->topicsSrvs.AddAdvAddress(topic, address);
+//////////////////////////////////////////////////
+int transport::Node::SendAdvBatchMsg(AdvBatchMsg &_batch, UDPSocket *_sock,
+                                     const std::string &_addr,
+                                     unsigned short _port,
+                                     AdvEncoding _encoding, bool _hashOnly)
+{
+  if (_batch.GetRecords().empty())
+    return 0;
 
-      // Check if we are interested in this service call
-      if (this->topicsSrvs.Requested(topic) &&
-          !this->topicsSrvs.Connected(topic) &&
-          this->guidStr.compare(rcvdGuid) != 0)
-      {
-        try
-        {
-          this->srvRequester->connect(address.c_str());
-          this->topicsSrvs.SetConnected(topic, true);
-          if (this->verbose)
-            std::cout << "\t* Connected to [" << address << "]\n";
-        }
-        catch(const zmq::error_t& ze)
-        {
-          std::cout << "Error connecting [" << ze.what() << "]\n";
-        }
-      }
+  if (this->verbose)
+  {
+    std::cout << "\t* Sending ADV_BATCH msg to [" << _addr << ":" << _port
+              << "] (" << _batch.GetRecords().size() << " records)"
+              << std::endl;
+  }
 
-      break;
+  if (_encoding == SingleAdvs)
+    return this->SendAdvRecords(_batch, _sock, _addr, _port);
 
-    case SUB:
-      // Check if I advertise the topic requested
-      if (this->topics.AdvertisedByMe(topic))
-      {
-        // Send to the broadcast socket an ADVERTISE message
-        for (auto it = this->myAddresses.begin();
-             it != this->myAddresses.end(); ++it)
-          this->SendAdvertiseMsg(ADV, topic, *it);
-      }
+  // The addresses without binary form are sent in version 1
+  std::vector<char> buffer;
+  size_t bytes = 0;
+  if (_encoding == CompactAdvs)
+  {
+    buffer.resize(_batch.GetCompactLength(_hashOnly));
+    bytes = _batch.PackCompact(&buffer[0], _hashOnly);
+  }
+  if (bytes == 0)
+  {
+    buffer.resize(_batch.GetMsgLength());
+    bytes = _batch.Pack(&buffer[0]);
+  }
+  _batch.Clear();
 
-      break;
+  try
+  {
+    _sock->sendTo(&buffer[0], bytes, _addr, _port);
+  }
+  catch(const SocketException &e)
+  {
+    cerr << "Exception sending an ADV_BATCH msg: " << e.what() << endl;
+    return -1;
+  }
 
-    case SUB_SVC:
-      // Check if I advertise the service call requested
-      if (this->topicsSrvs.AdvertisedByMe(topic))
-      {
-        // Send to the broadcast socket an ADV_SVC message
-        for (auto it = this->mySrvAddresses.begin();
-             it != this->mySrvAddresses.end(); ++it)
-        {
-          this->SendAdvertiseMsg(ADV_SVC, topic, *it);
-        }
-      }
+  return 0;
+}
 
-      break;
+//////////////////////////////////////////////////
+int transport::Node::SendAdvRecords(AdvBatchMsg &_batch, UDPSocket *_sock,
+                                    const std::string &_addr,
+                                    unsigned short _port)
+{
+  int result = 0;
+  std::vector<char> buffer;
+  for (auto &record : _batch.GetRecords())
+  {
+    AdvMsg msg(Header(TRNSP_VERSION, this->guid, record.topic, record.type,
+                      FLAG_WIRE_V2), record.address);
+    buffer.resize(msg.GetMsgLength());
+    size_t bytes = msg.Pack(&buffer[0]);
 
-    default:
-      std::cerr << "Unknown message type [" << header.GetType() << "]\n";
-      break;
+    try
+    {
+      _sock->sendTo(&buffer[0], bytes, _addr, _port);
+    }
+    catch(const SocketException &e)
+    {
+      cerr << "Exception sending an ADV msg: " << e.what() << endl;
+      result = -1;
+    }
   }
+  _batch.Clear();
 
-  return 0;
+  return result;
 }
 
 //////////////////////////////////////////////////
-int transport::Node::SendAdvertiseMsg(uint8_t _type, const std::string &_topic,
-                                      const std::string &_address)
+int transport::Node::SendHeartbeatMsg()
 {
-  assert(_topic != "");
-
-  if (this->verbose)
-    std::cout << "\t* Sending ADV msg [" << _topic << "][" << _address
-              << "]" << std::endl;
+  // The heartbeats are always sent in version 1, so every node learns that
+  // this one decodes the compact encoding
+  Header header(TRNSP_VERSION, this->guid, "", HEARTBEAT, FLAG_WIRE_V2);
 
-  Header header(TRNSP_VERSION, this->guid, _topic, _type, 0);
-  AdvMsg advMsg(header, _address);
+  std::vector<char> buffer(header.GetHeaderLength());
+  header.Pack(&buffer[0]);
 
-  char *buffer = new char[advMsg.GetMsgLength()];
-  advMsg.Pack(buffer);
+  if (this->registry)
+    return this->SendToRegistry(&buffer[0], buffer.size());
 
   // Send the data through the UDP broadcast socket
   try
   {
-    this->bcastSock->sendTo(buffer, advMsg.GetMsgLength(),
+    this->bcastSock->sendTo(&buffer[0], buffer.size(),
       this->bcastAddr, this->bcastPort);
   }
   catch(const SocketException &e)
   {
-    cerr << "Exception sending an ADV msg: " << e.what() << endl;
-    delete[] buffer;
+    cerr << "Exception sending a HEARTBEAT msg: " << e.what() << endl;
     return -1;
   }
 
-  delete[] buffer;
   return 0;
 }
 
@@ -691,16 +2864,29 @@ int transport::Node::SendSubscribeMsg(uint8_t _type, const std::string &_topic)
   if (this->verbose)
     std::cout << "\t* Sending SUB msg [" << _topic << "]" << std::endl;
 
-  Header header(TRNSP_VERSION, this->guid, _topic, _type, 0);
+  Header header(TRNSP_VERSION, this->guid, _topic, _type, FLAG_WIRE_V2);
 
-  char *buffer = new char[header.GetHeaderLength()];
-  header.Pack(buffer);
+  // The registry only takes version 1
+  bool compact = !this->registry && this->compactDiscovery;
+  size_t bytes =
+    compact ? header.GetCompactLength() : header.GetHeaderLength();
+  char *buffer = new char[bytes];
+  if (compact)
+    header.PackCompact(buffer);
+  else
+    header.Pack(buffer);
 
-  // Send the data through the UDP broadcast socket
+  if (this->registry)
+  {
+    int rc = this->SendToRegistry(buffer, bytes);
+    delete[] buffer;
+    return rc;
+  }
+
+  // Send the data from the unicast socket to the discovery address
   try
   {
-    this->bcastSock->sendTo(buffer, header.GetHeaderLength(),
-      this->bcastAddr, this->bcastPort);
+    this->ucastSock->sendTo(buffer, bytes, this->bcastAddr, this->bcastPort);
   }
   catch(const SocketException &e)
   {
@@ -712,3 +2898,37 @@ int transport::Node::SendSubscribeMsg(uint8_t _type, const std::string &_topic)
   delete[] buffer;
   return 0;
 }
+
+//////////////////////////////////////////////////
+int transport::Node::SendToRegistry(const char *_msg, size_t _size)
+{
+  // The registry socket belongs to the thread that polls the sockets
+  std::string msg(_msg, _size);
+  this->RunInIoThread([this, msg]()
+  {
+    this->SendRegistryMsg(msg.data(), msg.size());
+  });
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+int transport::Node::SendRegistryMsg(const char *_msg, size_t _size)
+{
+  try
+  {
+    // The message is dropped if the registry is down and the queue full
+    if (!this->registry->send(_msg, _size, ZMQ_DONTWAIT))
+    {
+      std::cerr << "Registry unreachable, discovery message dropped\n";
+      return -1;
+    }
+  }
+  catch(const zmq::error_t& ze)
+  {
+    std::cerr << "Error sending to the registry: " << ze.what() << "\n";
+    return -1;
+  }
+
+  return 0;
+}
@@ -20,9 +20,28 @@
 
 #include <google/protobuf/message.h>
 #include <uuid/uuid.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "discoveryCache.hh"
+#include "executor.hh"
+#include "lockFreeQueues.hh"
 #include "packet.hh"
+#include "shmRing.hh"
 #include "sockets/socket.hh"
+#include "topicStats.hh"
 #include "topicsInfo.hh"
 #include "zmq/zmq.hpp"
 #include "zmq/zmsg.hpp"
@@ -35,39 +54,343 @@ namespace transport
   /// \brief ZMQ endpoint used for inproc communication.
   const std::string InprocAddr = "inproc://local";
 
+  /// \brief Capacity of the queue between the I/O thread and the user.
+  const size_t IoQueueCapacity = 4096;
+
+  /// \brief Poll timeout of the I/O thread (msecs). It bounds the latency of
+  /// the requests forwarded from the user threads.
+  const int IoThreadTimeout = 10;
+
+  /// \brief Default UDP port of the discovery messages. It can be changed
+  /// with DZMQ_DISCOVERY_PORT.
+  const int DefaultDiscoveryPort = 11312;
+
+  /// \brief Default TTL of the multicast discovery messages. It can be
+  /// changed with DZMQ_MULTICAST_TTL.
+  const int DefaultMulticastTTL = 1;
+
+  /// \brief Default maximum delay of the replies to the subscriptions
+  /// (msecs).
+  const int DefaultReplyJitter = 50;
+
+  /// \brief Maximum number of nodes answered by unicast for the same reply.
+  /// The reply is broadcast when more nodes are waiting for it.
+  const size_t MaxUnicastReplies = 4;
+
+  /// \brief First interval between the subscriptions sent while waiting for
+  /// a service (msecs). It doubles after every retry.
+  const int SubRetryMinInterval = 100;
+
+  /// \brief Maximum interval between the subscriptions sent while waiting
+  /// for a service (msecs).
+  const int SubRetryMaxInterval = 1600;
+
+  /// \brief Time waiting for a service before giving up (msecs).
+  const int SubRetryTimeout = 5000;
+
+  /// \brief Default interval between heartbeats (msecs).
+  const int DefaultHeartbeatInterval = 1000;
+
+  /// \brief Default time without news from a node before its addresses are
+  /// removed (msecs).
+  const int DefaultLeaseTimeout = 3000;
+
+  /// \brief Time a node waits on exit to deliver its last messages to the
+  /// registry (msecs).
+  const int RegistryLinger = 100;
+
+  /// \brief Maximum age of the entries of the discovery cache used by a
+  /// node that starts (secs).
+  const int DiscoveryCacheMaxAge = 600;
+
+  /// \brief Default size of the shared memory ring of a node (bytes).
+  const size_t ShmDefaultCapacity = 32 * 1024 * 1024;
+
+  /// \brief Maximum poll timeout while reading from shared memory rings
+  /// (msecs). The rings cannot be polled, so it bounds their latency.
+  const int ShmPollTimeout = 1;
+
+  class Node;
+
+  /// \brief Handle to publish on a topic advertised by a node. It keeps a
+  /// direct reference to the state of the topic and the topic frame already
+  /// built, so publishing does not look up or build anything per update. The
+  /// handle can be copied and must not outlive its node.
+  class Publisher
+  {
+    /// \brief Constructor. The handle is not valid until it is returned by
+    /// Node::Advertise().
+    public: Publisher();
+
+    /// \brief Return true if the handle is bound to a node.
+    /// \return true if the handle is valid.
+    public: bool Valid() const;
+
+    /// \brief Get the topic of the handle.
+    /// \return Topic name.
+    public: const std::string &GetTopic() const;
+
+    /// \brief Check if there are subscribers for the topic. The
+    /// subscriptions are received while the node spins. With shared memory
+    /// enabled, it has the limits of Node::HasSubscribers().
+    /// \return true if the topic has at least one subscriber.
+    public: bool HasSubscribers() const;
+
+    /// \brief Publish data. See Node::Publish().
+    /// \param[in] _data Data to publish.
+    /// \return 0 when success.
+    public: int Publish(const std::string &_data) const;
+
+    /// \brief Publish data without copying it. See Node::Publish().
+    /// \param[in] _data Data to publish. It is left empty after the call.
+    /// \return 0 when success.
+    public: int Publish(std::string &&_data) const;
+
+    /// \brief Publish a protobuf message. See Node::Publish().
+    /// \param[in] _message protobuf message.
+    /// \return 0 when success.
+    public: int Publish(const google::protobuf::Message &_message) const;
+
+    /// \brief Node that advertised the topic.
+    private: Node *node;
+
+    /// \brief State of the topic in the node.
+    private: TopicInfo *info;
+
+    /// \brief Topic name.
+    private: std::string topic;
+
+    /// \brief Topic frame, copied into every update.
+    private: std::shared_ptr<zmq::message_t> topicFrame;
+
+    friend class Node;
+  };
+
+  /// \brief Handle to a topic subscription of a node. It keeps a direct
+  /// reference to the state of the topic. The handle can be copied and must
+  /// not outlive its node.
+  class Subscriber
+  {
+    /// \brief Constructor. The handle is not valid until it is returned by
+    /// Node::Subscribe().
+    public: Subscriber();
+
+    /// \brief Return true if the handle is bound to a node.
+    /// \return true if the handle is valid.
+    public: bool Valid() const;
+
+    /// \brief Get the topic of the handle.
+    /// \return Topic name.
+    public: const std::string &GetTopic() const;
+
+    /// \brief Return true while the node is subscribed to the topic.
+    /// \return true if subscribed.
+    public: bool Subscribed() const;
+
+    /// \brief Unsubscribe from the topic.
+    /// \return 0 when success.
+    public: int UnSubscribe() const;
+
+    /// \brief Node subscribed to the topic.
+    private: Node *node;
+
+    /// \brief State of the topic in the node.
+    private: TopicInfo *info;
+
+    /// \brief Topic name.
+    private: std::string topic;
+
+    friend class Node;
+  };
+
   class Node
   {
-    /// \brief Constructor.
-    /// \param[in] _master End point with the master's endpoint.
+    /// \brief Constructor. The discovery is configured with environment
+    /// variables: DZMQ_DISCOVERY_PORT (UDP port), DZMQ_MULTICAST_GROUP
+    /// (multicast group used instead of broadcast), DZMQ_MULTICAST_TTL and
+    /// DZMQ_MULTICAST_IF (IPv4 address of the outgoing interface).
+    /// DZMQ_DISCOVERY_CACHE is the path of a file where the addresses
+    /// discovered are kept, so they are known again after a restart. The
+    /// cached publishers are connected at once and expire after the lease
+    /// timeout unless live discovery confirms them. DZMQ_HOST_AGENT is the
+    /// ipc endpoint of a host agent (see tools/agent.cc), used as registry
+    /// when _master is empty.
+    /// \param[in] _master Endpoint of the discovery registry (see
+    /// tools/registry.cc). If it is not empty, the discovery messages are
+    /// exchanged with the registry instead of broadcast, and the UDP
+    /// sockets are not created.
     /// \param[in] _verbose true for enabling verbose mode.
     public: Node (std::string _master, bool _verbose);
 
     /// \brief Destructor.
     public: virtual ~Node();
 
-    /// \brief Run one iteration of the transport.
+    /// \brief Run one iteration of the transport. Every socket with pending
+    /// data is serviced, and each one is drained up to the spin budget.
+    /// When the I/O thread is running, the sockets are serviced by that
+    /// thread and SpinOnce() executes the callbacks of the messages it
+    /// queued. Only one thread at a time should call SpinOnce() in that mode.
     public: void SpinOnce();
 
     /// \brief Receive messages forever.
     public: void Spin();
 
+    /// \brief Start a background thread that owns the sockets. It polls them,
+    /// processes the discovery messages and hands the received messages to
+    /// the user threads through a lock-free queue. Application work executed
+    /// from SpinOnce() never delays socket servicing or discovery.
+    /// \return 0 when success or -1 if the thread was already running.
+    public: int StartIoThread();
+
+    /// \brief Stop the background I/O thread started with StartIoThread().
+    /// Messages still queued are discarded.
+    public: void StopIoThread();
+
+    /// \brief Return true if the background I/O thread is running.
+    /// \return true if the I/O thread is running.
+    public: bool IoThreadRunning() const;
+
+    /// \brief Set the maximum number of messages that a single socket can
+    /// process during one SpinOnce() call. The ready sockets are serviced in
+    /// round robin, one message at a time, so a busy socket cannot starve
+    /// the others.
+    /// \param[in] _budget Messages per socket and iteration (at least 1).
+    public: void SetSpinBudget(int _budget);
+
+    /// \brief Get the maximum number of messages that a single socket can
+    /// process during one SpinOnce() call.
+    /// \return The spin budget.
+    public: int GetSpinBudget() const;
+
+    /// \brief Set the interval between the heartbeats that this node sends
+    /// to the discovery socket. They keep its addresses alive in the tables
+    /// of the other nodes. They are sent while the node spins or publishes,
+    /// so a node that does neither for longer than the lease of the other
+    /// nodes expires.
+    /// \param[in] _interval Interval (msecs, at least 1).
+    public: void SetHeartbeatInterval(int _interval);
+
+    /// \brief Get the interval between heartbeats.
+    /// \return Interval (msecs).
+    public: int GetHeartbeatInterval() const;
+
+    /// \brief Set how long the addresses of a remote node are kept without
+    /// receiving any discovery message from it. Then they are removed and
+    /// their connections closed. Only the nodes that send heartbeats expire.
+    /// \param[in] _timeout Lease (msecs, at least 1).
+    public: void SetLeaseTimeout(int _timeout);
+
+    /// \brief Get the lease of the remote nodes.
+    /// \return Lease (msecs).
+    public: int GetLeaseTimeout() const;
+
+    /// \brief Set the maximum delay of the replies to the subscriptions. Each
+    /// reply waits a random time up to this value, and the subscriptions
+    /// received meanwhile are answered by the same reply. It spreads the
+    /// replies of many nodes when all of them are subscribing at once.
+    /// \param[in] _jitter Maximum delay (msecs) or 0 to reply at the end of
+    /// the current iteration.
+    public: void SetReplyJitter(int _jitter);
+
+    /// \brief Get the maximum delay of the replies to the subscriptions.
+    /// \return Maximum delay (msecs).
+    public: int GetReplyJitter() const;
+
+    /// \brief Execute the subscription and service callbacks in an executor
+    /// instead of the thread that calls SpinOnce(). The updates of a topic
+    /// are posted with the topic name as ordering key, so they are delivered
+    /// in order while different topics run in parallel. Services use the
+    /// same keys as topics. The responses and the socket operations requested
+    /// from the callbacks are executed on the next iteration of the thread
+    /// that owns the sockets. Set the executor before spinning.
+    /// \param[in] _executor Executor (not owned by the node) or nullptr to
+    /// execute the callbacks in the spinning thread.
+    public: void SetExecutor(Executor *_executor);
+
+    /// \brief Publish the topic updates through a shared memory ring too. The
+    /// ring is advertised with the rest of the addresses as
+    /// "shm://<host>/<segment>", and the subscribers running on the same
+    /// host read the updates from it instead of connecting via TCP. The data
+    /// is written once, and every local subscriber copies it and checks that
+    /// it was not overwritten before executing the callback. The segments
+    /// left by the nodes of this host that crashed are removed. Call it
+    /// before advertising any topic. Once a local subscriber attaches to the
+    /// ring, HasSubscribers() is true for every topic (see its limitation).
+    /// \param[in] _capacity Size of the ring (bytes). An update cannot be
+    /// larger than half of the ring.
+    /// \return 0 when success or -1 if it was already enabled or the
+    /// shared memory segment could not be created.
+    public: int EnableShm(size_t _capacity = ShmDefaultCapacity);
+
     /// \brief Advertise a new service.
     /// \param[in] _topic Topic to be advertised.
     /// \return 0 when success.
     public: int Advertise(const std::string &_topic);
 
+    /// \brief Advertise a new service and get a handle to publish on it.
+    /// \param[in] _topic Topic to be advertised.
+    /// \param[out] _publisher Handle used to publish on the topic.
+    /// \return 0 when success.
+    public: int Advertise(const std::string &_topic, Publisher &_publisher);
+
     /// \brief Unadvertise a new service.
     /// \param[in] _topic Topic to be unadvertised.
     /// \return 0 when success.
     public: int UnAdvertise(const std::string &_topic);
 
-    /// \brief Publish data.
+    /// \brief Check if there are subscribers for a topic. The publishers
+    /// can use it to avoid building messages that nobody receives.
+    /// Limitation: the shared memory ring does not tell which topics its
+    /// readers want, so once a subscriber is attached to the ring of the
+    /// node, this returns true for every topic. A reader that crashed stays
+    /// counted, so the answer can remain true until the node restarts.
+    /// \param[in] _topic Topic name.
+    /// \return true if the topic has at least one subscriber.
+    public: bool HasSubscribers(const std::string &_topic);
+
+    /// \brief Get the number of updates of a topic that were published but
+    /// not received, detected from gaps in the sequence numbers.
+    /// \param[in] _topic Topic name.
+    /// \return Number of updates lost.
+    public: uint64_t GetLostUpdates(const std::string &_topic);
+
+    /// \brief Check if a remote node advertising a topic is known.
+    /// \param[in] _topic Topic name.
+    /// \return true if at least one address is known for the topic.
+    public: bool HasPublishers(const std::string &_topic);
+
+    /// \brief Enable or disable the statistics of the topic updates
+    /// received. The latency is measured from the send time of the
+    /// publisher, so it is only recorded for the publishers running on the
+    /// same host. The updates of the other publishers are only counted.
+    /// \param[in] _enable true to collect the statistics.
+    public: void EnableStats(bool _enable);
+
+    /// \brief Get the statistics of a topic collected since they were
+    /// enabled.
+    /// \param[in] _topic Topic name.
+    /// \param[out] _stats Statistics of the topic.
+    /// \return true if there are statistics for the topic.
+    public: bool GetTopicStats(const std::string &_topic, TopicStats &_stats);
+
+    /// \brief Publish data. Nothing is sent if the topic has no
+    /// subscribers.
     /// \param[in] _topic Topic to be published.
     /// \param[in] _data Data to publish.
     /// \return 0 when success.
     public: int Publish(const std::string &_topic, const std::string &_data);
 
-    /// \brief Publish data.
+    /// \brief Publish data without copying it. The node takes ownership of
+    /// the payload buffer and hands it to ZeroMQ, which releases it once the
+    /// message has been sent.
+    /// \param[in] _topic Topic to be published.
+    /// \param[in] _data Data to publish. It is left empty after the call.
+    /// \return 0 when success.
+    public: int Publish(const std::string &_topic, std::string &&_data);
+
+    /// \brief Publish data. The message is serialized straight into the
+    /// outgoing frame, without temporary buffers. It is not serialized at
+    /// all if the topic has no subscribers.
     /// \param[in] _topic Topic to be published.
     /// \param[in] _message protobuf message.
     /// \return 0 when success.
@@ -81,6 +404,64 @@ namespace transport
     public: int Subscribe(const std::string &_topic,
                           void(*_cb)(const std::string &, const std::string &));
 
+    /// \brief Subscribe to a topic registering a callback that receives a
+    /// read-only view of the data. No copies of the payload are made; the
+    /// pointer references the received frame and is only valid during the
+    /// execution of the callback. Use the std::string variant if the data
+    /// must be kept.
+    /// \param[in] _topic Topic to be subscribed.
+    /// \param[in] _cb Pointer to the callback function.
+    /// \return 0 when success.
+    public: int Subscribe(const std::string &_topic,
+      void(*_cb)(const std::string &, const char *, size_t));
+
+    /// \brief Subscribe to a topic registering a callback and get a handle
+    /// to the subscription.
+    /// \param[in] _topic Topic to be subscribed.
+    /// \param[in] _cb Pointer to the callback function.
+    /// \param[out] _subscriber Handle to the subscription.
+    /// \return 0 when success.
+    public: int Subscribe(const std::string &_topic,
+      void(*_cb)(const std::string &, const std::string &),
+      Subscriber &_subscriber);
+
+    /// \brief Subscribe to a topic registering a callback that receives a
+    /// read-only view of the data and get a handle to the subscription.
+    /// \param[in] _topic Topic to be subscribed.
+    /// \param[in] _cb Pointer to the callback function.
+    /// \param[out] _subscriber Handle to the subscription.
+    /// \return 0 when success.
+    public: int Subscribe(const std::string &_topic,
+      void(*_cb)(const std::string &, const char *, size_t),
+      Subscriber &_subscriber);
+
+    /// \brief Subscribe to a topic registering a callback that receives the
+    /// parsed protobuf message. Every update is parsed from the received
+    /// frame into the same message instance, owned by the subscription, so
+    /// its memory is reused. The instance is only valid during the execution
+    /// of the callback; copy it if it must be kept.
+    /// \param[in] _topic Topic to be subscribed.
+    /// \param[in] _cb Pointer to the callback function.
+    /// \return 0 when success.
+    public: template<typename MsgT> int Subscribe(const std::string &_topic,
+      void(*_cb)(const std::string &, const MsgT &))
+    {
+      static_assert(std::is_base_of<google::protobuf::Message, MsgT>::value,
+                    "MsgT must be a protobuf message");
+
+      std::shared_ptr<MsgT> msg(new MsgT());
+      return this->SubscribeRaw(_topic,
+        [_cb, msg](const std::string &_t, const char *_data, size_t _size)
+        {
+          if (!msg->ParseFromArray(_data, _size))
+          {
+            std::cerr << "Error parsing message for [" << _t << "]\n";
+            return;
+          }
+          _cb(_t, *msg);
+        });
+    }
+
     /// \brief Subscribe to a topic registering a callback.
     /// \param[in] _topic Topic to be unsubscribed.
     /// \return 0 when success.
@@ -115,30 +496,296 @@ namespace transport
                                 const std::string &_data,
       void(*_cb)(const std::string &_topic, int rc, const std::string &_rep));
 
+    /// \brief Kind of message handed from the I/O thread to the user.
+    private: enum IncomingType {TopicUpdate, SrvRequestMsg, SrvReplyMsg};
+
+    /// \brief Message received by the I/O thread. The frames are moved
+    /// through the queue, so the data is never copied.
+    private: struct IncomingMsg
+    {
+      /// \brief Kind of message.
+      IncomingType type;
+
+      /// \brief Frames of the message: topic, sender (or data header) and data.
+      zmq::message_t frames[3];
+    };
+
     /// \brief Deallocate resources.
     private: void Fini();
 
+    /// \brief Poll the sockets and service every socket with pending data.
+    /// \param[in] _timeout Poll timeout (msecs).
+    private: void PollSockets(int _timeout);
+
+    /// \brief Main loop of the I/O thread.
+    private: void RunIoThread();
+
+    /// \brief Execute the callbacks of the messages queued by the I/O thread.
+    /// Waits up to the node timeout if the queue is empty.
+    private: void DispatchIncoming();
+
+    /// \brief Execute a task in the thread that owns the sockets. The task is
+    /// queued if the I/O thread or an executor is in use, or executed now.
+    /// \param[in] _task Task to execute.
+    private: void RunInIoThread(std::function<void()> &&_task);
+
+    /// \brief Execute the tasks queued with RunInIoThread().
+    private: void ExecuteCommands();
+
+    /// \brief Execute the callbacks of a received message, or post them to
+    /// the executor if there is one.
+    /// \param[in] _type Kind of message.
+    /// \param[in] _frames Frames of the message. They are consumed.
+    private: void Dispatch(IncomingType _type, zmq::message_t *_frames);
+
+    /// \brief Hand a received message to the user threads, or dispatch it now
+    /// if the I/O thread is not running.
+    /// \param[in] _type Kind of message.
+    /// \param[in] _frames Frames of the message. They are consumed.
+    private: void Deliver(IncomingType _type, zmq::message_t *_frames);
+
+    /// \brief Execute the callback registered for a topic update.
+    /// \param[in] _topic Topic of the update.
+    /// \param[in] _header Frame with the data header.
+    /// \param[in] _data Frame with the data.
+    private: void DispatchTopicUpdate(const std::string &_topic,
+                                      zmq::message_t &_header,
+                                      zmq::message_t &_data);
+
+    /// \brief Execute the callback registered for a service request and send
+    /// the response.
+    /// \param[in] _frames Frames of the message: topic, sender and data.
+    private: void DispatchSrvRequest(zmq::message_t *_frames);
+
+    /// \brief Execute the callback registered for a service reply.
+    /// \param[in] _frames Frames of the message: topic, sender and response.
+    private: void DispatchSrvReply(zmq::message_t *_frames);
+
+    /// \brief Send a three part message (topic, sender and data).
+    /// \param[in] _socket Socket used to send the message.
+    /// \param[in] _topic Topic.
+    /// \param[in] _sender Address of the sender.
+    /// \param[in] _data Data.
+    /// \return 0 when success.
+    private: int SendFrames(zmq::socket_t &_socket, const std::string &_topic,
+                            const std::string &_sender,
+                            const std::string &_data);
+
     /// \brief Method in charge of receiving the discovery updates.
-    private: void RecvDiscoveryUpdates();
+    /// \return true if a datagram was read, false if none was available.
+    private: bool RecvDiscoveryUpdates();
+
+    /// \brief Method in charge of receiving the discovery messages sent to
+    /// the unicast socket of the node.
+    /// \return true if a datagram was read, false if none was available.
+    private: bool RecvUnicastUpdates();
+
+    /// \brief Method in charge of receiving the discovery messages sent by
+    /// the registry.
+    /// \return true if a message was read, false if none was available.
+    private: bool RecvRegistryUpdates();
+
+    /// \brief Receive a discovery message from a UDP socket.
+    /// \param[in] _sock Socket to read.
+    /// \return true if a datagram was read, false if none was available.
+    private: bool RecvDiscoveryMsg(UDPSocket *_sock);
 
     /// \brief Method in charge of receiving the topic updates.
-    private: void RecvTopicUpdates();
+    /// \return true if a message was read, false if none was available.
+    private: bool RecvTopicUpdates();
 
     /// \brief Method in charge of receiving the service call requests.
-    private: void RecvSrvRequest();
+    /// \return true if a message was read, false if none was available.
+    private: bool RecvSrvRequest();
 
     /// \brief Method in charge of receiving the async service call replies.
-    private: void RecvSrvReply();
+    /// \return true if a message was read, false if none was available.
+    private: bool RecvSrvReply();
+
+    /// \brief Method in charge of receiving the topic updates published
+    /// through shared memory.
+    /// \return true if a message was read, false if none was available.
+    private: bool RecvShmUpdates();
+
+    /// \brief Attach to the shared memory ring of a publisher.
+    /// \param[in] _address Address advertised (shm://<host>/<segment>).
+    /// \return true if the ring is on this host and it was attached.
+    private: bool ConnectShm(const std::string &_address);
+
+    /// \brief Detach from the shared memory ring of a publisher.
+    /// \param[in] _address Address of the ring (shm://<host>/<segment>).
+    private: void DisconnectShm(const std::string &_address);
+
+    /// \brief Register a topic received from a remote publisher and connect
+    /// its endpoint, unless it is already connected. The caller must hold
+    /// the mutex.
+    /// \param[in] _guid GUID of the publisher.
+    /// \param[in] _address Endpoint advertised by the publisher.
+    /// \param[in] _topic Topic advertised.
+    /// \return true if the topic is received through a connected endpoint.
+    private: bool ConnectEndpoint(const std::string &_guid,
+                                  const std::string &_address,
+                                  const std::string &_topic);
+
+    /// \brief Release the references of a topic to the endpoints, and
+    /// disconnect the endpoints no longer used. The caller must hold the
+    /// mutex.
+    /// \param[in] _topic Topic unsubscribed.
+    private: void ReleaseEndpoints(const std::string &_topic);
+
+    /// \brief Close the connection to an endpoint and remove it from the
+    /// registry. The caller must hold the mutex.
+    /// \param[in] _address Endpoint.
+    private: void DisconnectEndpoint(const std::string &_address);
+
+    /// \brief Send a heartbeat if due and expire the remote nodes without
+    /// news when the heartbeat interval has elapsed.
+    private: void CheckLiveness();
+
+    /// \brief Send a heartbeat if the heartbeat interval has elapsed. It is
+    /// also called when publishing, so a node that publishes without
+    /// spinning keeps its lease. Only one of the concurrent callers sends it.
+    /// \param[in] _now Current time (nsecs of the steady clock).
+    private: void SendDueHeartbeat(int64_t _now);
+
+    /// \brief Decide if the discovery messages are sent in the compact
+    /// encoding: once the node has been up for a lease, so every node alive
+    /// sent a heartbeat, and no message without FLAG_WIRE_V2 was received
+    /// within the lease. The caller must hold the mutex.
+    private: void UpdateWireVersion();
+
+    /// \brief Find the topic of a record that only carries its hash, among
+    /// the topics subscribed or the services requested. The caller must
+    /// hold the mutex.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _hash Hash of the topic.
+    /// \param[out] _topic Topic found.
+    /// \return true if the topic was found.
+    private: bool ResolveTopicHash(uint8_t _type, uint64_t _hash,
+                                   std::string &_topic);
+
+    /// \brief Connect to the remote publishers of a topic that are already
+    /// known. The caller must hold the mutex.
+    /// \param[in] _topic Topic.
+    private: void ConnectKnownPublishers(const std::string &_topic);
+
+    /// \brief Register the addresses of the discovery cache. The remote
+    /// nodes found expire unless they are confirmed. The caller must hold
+    /// the mutex.
+    private: void LoadDiscoveryCache();
+
+    /// \brief Remove the addresses of a remote node, close its connections
+    /// and look for other nodes providing the same topics. The caller must
+    /// hold the mutex.
+    /// \param[in] _guid GUID of the node.
+    /// \param[in] _info Information of the node.
+    private: void ExpireNode(const std::string &_guid,
+                             const RemoteNodeInfo &_info);
+
+    /// \brief Receive a multipart message with a known number of frames.
+    /// \param[in] _socket Socket to read from.
+    /// \param[out] _frames Array where the frames will be stored.
+    /// \param[in] _count Number of frames expected.
+    /// \param[in] _what Description of the message used in the error output.
+    /// \param[in] _flags ZMQ_DONTWAIT for a non-blocking receive or 0.
+    /// \return Number of frames received. 0 when no message was available.
+    /// A value different than _count means that the message was malformed.
+    private: size_t RecvFrames(zmq::socket_t &_socket,
+                               zmq::message_t *_frames, size_t _count,
+                               const std::string &_what, int _flags);
 
     /// \brief Send all the pendings asynchronous service calls (if possible)
     private: void SendPendingAsyncSrvCalls();
 
-    /// \brief Parse a discovery message received via the UDP broadcast socket.
-    /// \param[in] _msg Received message.
+    /// \brief Subscribe to a topic registering a callback that receives a
+    /// view of the data.
+    /// \param[in] _topic Topic to be subscribed.
+    /// \param[in] _cb Callback.
     /// \return 0 when success.
-    private: int DispatchDiscoveryMsg(char *_msg);
+    private: int SubscribeRaw(const std::string &_topic,
+                              const TopicInfo::RawCallback &_cb);
 
-    /// \brief Send an ADVERTISE message to the discovery socket.
+    /// \brief Bind a subscription handle to a topic.
+    /// \param[in] _topic Topic subscribed.
+    /// \param[out] _subscriber Handle.
+    private: void BindSubscriber(const std::string &_topic,
+                                 Subscriber &_subscriber);
+
+    /// \brief Check if an update has to be sent through a publisher handle.
+    /// \param[in] _publisher Publisher handle.
+    /// \param[out] _rc Result of the publication when nothing is sent: -1 if
+    /// the topic is not advertised or 0 if it has no subscribers.
+    /// \return true if the update has to be sent.
+    private: bool MustSend(const Publisher &_publisher, int &_rc);
+
+    /// \brief Check that a topic is advertised before publishing on it.
+    /// \param[in] _topic Topic to be published.
+    /// \return Information of the topic or nullptr if the topic is not
+    /// advertised by this node.
+    private: TopicInfo *CanPublish(const std::string &_topic);
+
+    /// \brief Update the subscriptions from the messages received by the
+    /// publisher socket. The caller must hold pubMutex.
+    private: void RecvSubscriptions();
+
+    /// \brief Check if a topic matches the subscriptions received by the
+    /// publisher socket. The caller must hold pubMutex.
+    /// \param[in] _topic Topic name.
+    /// \return true if the topic has at least one subscriber.
+    private: bool MatchSubscriptions(const std::string &_topic) const;
+
+    /// \brief Update the flag of subscribers of the pinned topics if the
+    /// subscriptions changed. The caller must hold the mutex.
+    private: void UpdateSubscribers();
+
+    /// \brief Check if there are subscribers for the topic of a publisher
+    /// handle. Only the flags kept by the poll loop are read.
+    /// \param[in] _publisher Publisher handle.
+    /// \return true if the topic has at least one subscriber.
+    private: bool HasSubscribers(const Publisher &_publisher) const;
+
+    /// \brief Send a topic update through the publisher socket.
+    /// \param[in] _info Information of the topic.
+    /// \param[in] _topic Topic of the update.
+    /// \param[in] _payload Frame containing the data. The frame is consumed.
+    /// \return 0 when success.
+    private: int SendTopicMsg(TopicInfo *_info, const std::string &_topic,
+                              zmq::message_t &_payload);
+
+    /// \brief Send a topic update through the publisher socket using a topic
+    /// frame already built.
+    /// \param[in] _info Information of the topic.
+    /// \param[in] _topic Topic of the update.
+    /// \param[in] _topicFrame Topic frame. It is copied, not consumed.
+    /// \param[in] _payload Frame containing the data. The frame is consumed.
+    /// \return 0 when success.
+    private: int SendTopicMsg(TopicInfo *_info, const std::string &_topic,
+                              zmq::message_t &_topicFrame,
+                              zmq::message_t &_payload);
+
+    /// \brief Process a discovery message received via the UDP sockets or
+    /// from the registry.
+    /// \param[in] _msg Received message, already parsed.
+    /// \param[in] _srcAddr Address of the sender.
+    /// \param[in] _srcPort Port of the sender.
+    /// \return 0 when success.
+    private: int DispatchDiscoveryMsg(DiscoveryMsgView &_msg,
+                                      const std::string &_srcAddr,
+                                      unsigned short _srcPort);
+
+    /// \brief Register an address advertised by another node and connect
+    /// to it if needed. The caller must hold the mutex.
+    /// \param[in] _guid GUID of the node.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _topic Topic advertised.
+    /// \param[in] _address Address advertised with the topic.
+    private: void DispatchAdv(const std::string &_guid, uint8_t _type,
+                              const std::string &_topic,
+                              const std::string &_address);
+
+    /// \brief Queue an ADVERTISE record. The records are sent in batches to
+    /// the discovery socket, when a batch is full or at the next poll. The
+    /// caller must hold the mutex.
     /// \param[in] _type ADV or ADV_SVC.
     /// \param[in] _topic Topic to be advertised.
     /// \param[in] _address Address to be advertised with the topic.
@@ -146,13 +793,94 @@ namespace transport
     private: int SendAdvertiseMsg(uint8_t _type, const std::string &_topic,
                          const std::string &_address);
 
-    /// \brief Send a SUBSCRIBE message to the discovery socket.
+    /// \brief Send the queued ADVERTISE records in an ADV_BATCH message. The
+    /// caller must hold the mutex.
+    /// \return 0 when success.
+    private: int FlushAdvertiseMsgs();
+
+    /// \brief Schedule the reply to a subscription after a random delay,
+    /// unless a reply for the same topic is already scheduled. The reply is
+    /// sent by unicast to the requester if it subscribed from its unicast
+    /// socket, in the version of its subscription. The caller must hold the
+    /// mutex.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _topic Topic requested.
+    /// \param[in] _srcAddr Address of the requester.
+    /// \param[in] _srcPort Port of the requester.
+    /// \param[in] _encoding Encoding that the requester decodes, seen from
+    /// its subscription.
+    private: void ScheduleReply(uint8_t _type, const std::string &_topic,
+                                const std::string &_srcAddr,
+                                unsigned short _srcPort,
+                                AdvEncoding _encoding);
+
+    /// \brief Send the replies that are due. The broadcast replies are
+    /// queued as ADVERTISE records. The caller must hold the mutex.
+    /// \return Time until the next reply is due (msecs) or -1 if there are
+    /// no replies left.
+    private: int SendDueReplies();
+
+    /// \brief Send an ADV_BATCH message and clear its records. It uses the
+    /// compact encoding when the destination decodes it and the addresses
+    /// have a binary form. The destinations that predate ADV_BATCH receive
+    /// one ADV message per record instead.
+    /// \param[in] _batch Records to send.
+    /// \param[in] _sock Socket used to send the message.
+    /// \param[in] _addr Destination address.
+    /// \param[in] _port Destination port.
+    /// \param[in] _encoding Encoding that the destination decodes.
+    /// \param[in] _hashOnly true if the destination knows the topics of the
+    /// records, which then carry their hash only in the compact encoding.
+    /// \return 0 when success.
+    private: int SendAdvBatchMsg(AdvBatchMsg &_batch, UDPSocket *_sock,
+                                 const std::string &_addr,
+                                 unsigned short _port, AdvEncoding _encoding,
+                                 bool _hashOnly);
+
+    /// \brief Send the records of a batch as single ADV and ADV_SVC
+    /// messages, which every version decodes, and clear them.
+    /// \param[in] _batch Records to send.
+    /// \param[in] _sock Socket used to send the messages.
+    /// \param[in] _addr Destination address.
+    /// \param[in] _port Destination port.
+    /// \return 0 when success.
+    private: int SendAdvRecords(AdvBatchMsg &_batch, UDPSocket *_sock,
+                                const std::string &_addr,
+                                unsigned short _port);
+
+    /// \brief Send a discovery message to the registry. The message is sent
+    /// by the thread that polls the sockets.
+    /// \param[in] _msg Message.
+    /// \param[in] _size Size of the message.
+    /// \return 0 when success.
+    private: int SendToRegistry(const char *_msg, size_t _size);
+
+    /// \brief Send a discovery message on the registry socket, from the
+    /// thread that owns it.
+    /// \param[in] _msg Message.
+    /// \param[in] _size Size of the message.
+    /// \return 0 when success.
+    private: int SendRegistryMsg(const char *_msg, size_t _size);
+
+    /// \brief Send again the advertisements and subscriptions of this node
+    /// to the registry. The caller must hold the mutex.
+    private: void Register();
+
+    /// \brief Create the UDP sockets of the discovery.
+    private: void InitDiscoverySockets();
+
+    /// \brief Send a HEARTBEAT message to the discovery socket.
+    /// \return 0 when success.
+    private: int SendHeartbeatMsg();
+
+    /// \brief Send a SUBSCRIBE message to the discovery address. It is sent
+    /// from the unicast socket, so the replies can be addressed to this node.
     /// \param[in] _type SUB or SUB_SVC.
     /// \param[in] _topic Topic name.
     /// \return 0 when success.
     private: int SendSubscribeMsg(uint8_t _type, const std::string &_topic);
 
-    /// \brief Master address.
+    /// \brief Endpoint of the discovery registry, empty without registry.
     private: std::string master;
 
     /// \brief Print activity to stdout.
@@ -173,15 +901,39 @@ namespace transport
     /// \brief IP address of this host.
     private: std::string hostAddr;
 
-    /// \brief Broadcast IP address.
+    /// \brief Broadcast IP address or multicast group of the discovery.
     private: std::string bcastAddr;
 
+    /// \brief true if bcastSock joined the multicast group bcastAddr.
+    private: bool multicast;
+
+    /// \brief Interface that joined the multicast group, or empty if the
+    /// system chose it.
+    private: std::string multicastIface;
+
     /// \brief UDP broadcast port used for the transport.
     private: int bcastPort;
 
     /// \brief UDP socket used for the discovery protocol.
     private: UDPSocket *bcastSock;
 
+    /// \brief UDP socket bound to an ephemeral port. The subscriptions are
+    /// sent from it and the replies are received on it.
+    private: UDPSocket *ucastSock;
+
+    /// \brief ZMQ socket connected to the registry, or null without
+    /// registry.
+    private: zmq::socket_t *registry;
+
+    /// \brief GUID of the registry that acknowledged the last heartbeat.
+    private: std::string registryGuid;
+
+    /// \brief GUID, topic and address of the discovery message dispatched.
+    /// They are reused, so the messages are dispatched without allocating.
+    private: std::string rcvdGuid;
+    private: std::string rcvdTopic;
+    private: std::string rcvdAddress;
+
     /// \brief 0MQ context.
     private: zmq::context_t *context;
 
@@ -206,14 +958,151 @@ namespace transport
     /// \brief ZMQ endpoing used to answer the service calls.
     private: std::string srvReplierEP;
 
+    /// \brief Buffer reused to hold the topic of every topic update received.
+    private: std::string rcvTopic;
+
     /// \brief Timeout used for the blocking service requests.
     private: int timeout;
 
+    /// \brief Protects the topic information, which is shared between the
+    /// user threads and the I/O thread.
+    private: std::mutex mutex;
+
+    /// \brief Serializes the access to the publisher socket and the
+    /// subscriptions.
+    private: std::mutex pubMutex;
+
+    /// \brief Subscriptions received by the publisher socket. The key is the
+    /// prefix subscribed and the value the number of subscriptions.
+    private: std::map<std::string, int> subscriptions;
+
+    /// \brief Did the subscriptions change since the last call to
+    /// UpdateSubscribers()? Protected by pubMutex.
+    private: bool subscriptionsChanged;
+
+    /// \brief Background thread that owns the sockets (if running).
+    private: std::thread *ioThread;
+
+    /// \brief Tells the I/O thread to keep running.
+    private: std::atomic<bool> ioRunning;
+
+    /// \brief Messages received by the I/O thread waiting for dispatch.
+    private: SpscQueue<IncomingMsg> *incoming;
+
+    /// \brief Tasks that the user threads forward to the I/O thread.
+    private: MpscQueue<std::function<void()>> commands;
+
+    /// \brief Used to wait for new messages when the queue is empty.
+    private: std::mutex incomingMutex;
+
+    /// \brief Notifies that a new message was queued.
+    private: std::condition_variable incomingCv;
+
+    /// \brief true while the user thread waits for new messages.
+    private: std::atomic<bool> incomingWaiting;
+
+    /// \brief Blocking service requests waiting for a reply in threaded mode.
+    private: std::map<std::string, std::promise<std::string>*> srvWaiters;
+
+    /// \brief Maximum number of messages per socket and SpinOnce() call.
+    private: int spinBudget;
+
+    /// \brief Socket serviced first in the next SpinOnce() call. It rotates
+    /// so that no socket is always ahead of the others.
+    private: int spinFirst;
+
+    /// \brief Identifier of this node in the headers of the topic updates.
+    private: uint64_t publisherId;
+
+    /// \brief Identifiers of the remote publishers running on this host,
+    /// whose updates have a meaningful latency.
+    private: std::set<uint64_t> localPublishers;
+
+    /// \brief true while the statistics of the topics are collected.
+    private: std::atomic<bool> statsEnabled;
+
+    /// \brief Executor of the callbacks (if any).
+    private: Executor *executor;
+
+    /// \brief Shared memory ring where this node publishes (if enabled).
+    private: ShmRing *shmWriter;
+
+    /// \brief Address of the shared memory ring of this node.
+    private: std::string shmEndpoint;
+
+    /// \brief Shared memory rings of the local publishers.
+    private: std::vector<ShmRing*> shmReaders;
+
+    /// \brief Rings disconnected during this spin, released at its end.
+    private: std::vector<ShmRing*> shmClosed;
+
+    /// \brief Ring read first in the next RecvShmUpdates() call.
+    private: size_t shmFirst;
+
+    /// \brief Endpoint connected for each remote publisher, by GUID. The
+    /// updates of all the publishers are fair-queued by the subscriber
+    /// socket.
+    private: std::map<std::string, std::string> pubEndpoints;
+
+    /// \brief ADVERTISE records not sent yet.
+    private: AdvBatchMsg advBatch;
+
+    /// \brief Replies to the subscriptions, by type (ADV or ADV_SVC) and
+    /// topic.
+    private: std::map<std::pair<uint8_t, std::string>,
+                      PendingReply> pendingReplies;
+
+    /// \brief Maximum delay of the replies to the subscriptions (msecs).
+    private: int replyJitter;
+
+    /// \brief Generator of the delays of the replies. Each node has its own,
+    /// seeded with its GUID, so nodes started together do not answer at the
+    /// same time.
+    private: std::mt19937 jitterGenerator;
+
+    /// \brief Interval between heartbeats (msecs).
+    private: int heartbeatInterval;
+
+    /// \brief Lease of the remote nodes (msecs).
+    private: int leaseTimeout;
+
+    /// \brief Time of the next heartbeat (nsecs of the steady clock). It is
+    /// sent by the poll loop or by the threads that publish, whichever
+    /// finds it due first.
+    private: std::atomic<int64_t> nextHeartbeat;
+
+    /// \brief Time of the next check of the leases of the remote nodes.
+    private: std::chrono::steady_clock::time_point nextExpiryCheck;
+
+    /// \brief Creation time of the node.
+    private: std::chrono::steady_clock::time_point startTime;
+
+    /// \brief Nodes that do not decode the compact encoding, by GUID, with
+    /// the time of their last message.
+    private: std::map<std::string,
+                      std::chrono::steady_clock::time_point> legacyNodes;
+
+    /// \brief Are the discovery messages sent in the compact encoding?
+    private: std::atomic<bool> compactDiscovery;
+
+    /// \brief Remote nodes that advertised topics or services, by GUID.
+    private: std::map<std::string, RemoteNodeInfo> remoteNodes;
+
+    /// \brief Addresses discovered, kept across restarts.
+    private: DiscoveryCache discoveryCache;
+
+    /// \brief Connected endpoints of the remote publishers, with the topics
+    /// that reference them.
+    private: std::map<std::string, EndpointInfo> endpoints;
+
     /// \brief Local GUID.
     private: uuid_t guid;
 
     /// \brief String conversion of the GUID.
     private: std::string guidStr;
+
+    friend class Publisher;
+    friend class Subscriber;
   };
 }
 
@@ -15,11 +15,20 @@
  *
 */
 
+#include <google/protobuf/wrappers.pb.h>
 #include <limits.h>
+#include <unistd.h>
+#include <map>
+#include <thread>
+#include <vector>
 #include "discZmq.hh"
+#include "registry.hh"
 #include "gtest/gtest.h"
 
 bool callbackExecuted;
+int callbackCounter;
+std::map<std::string, std::vector<std::string>> callbackData;
+transport::Node *unSubscribeNode = nullptr;
 
 //////////////////////////////////////////////////
 /// \brief Function is called everytime a topic update is received.
@@ -30,6 +39,95 @@ void cb(const std::string &_topic, const std::string &_data)
   callbackExecuted = true;
 }
 
+//////////////////////////////////////////////////
+/// \brief Function is called everytime a topic update is received. The data
+/// is received as a view of the frame.
+void rawCb(const std::string &_topic, const char *_data, size_t _size)
+{
+  assert(_topic != "");
+  EXPECT_EQ(std::string(_data, _size), std::string("some\0Data", 9));
+  callbackExecuted = true;
+}
+
+//////////////////////////////////////////////////
+/// \brief Function is called everytime a topic update is received. Checks
+/// that binary data is not truncated.
+void binaryCb(const std::string &_topic, const std::string &_data)
+{
+  assert(_topic != "");
+  EXPECT_EQ(_data, std::string("some\0Data", 9));
+  callbackExecuted = true;
+}
+
+//////////////////////////////////////////////////
+/// \brief Function is called everytime a topic update is received. Counts
+/// the number of updates received.
+void counterCb(const std::string &_topic, const std::string &_data)
+{
+  assert(_topic != "");
+  ++callbackCounter;
+}
+
+//////////////////////////////////////////////////
+/// \brief Function is called everytime a topic update is received. Counts
+/// the update and unsubscribes from the topic.
+void unSubscribeCb(const std::string &_topic, const std::string &_data)
+{
+  ++callbackCounter;
+  EXPECT_EQ(unSubscribeNode->UnSubscribe(_topic), 0);
+}
+
+//////////////////////////////////////////////////
+/// \brief Count the advertised records received by a socket, in ADV and
+/// ADV_BATCH messages of any version, until it has no more datagrams
+/// waiting. The malformed datagrams are skipped.
+/// \param[in] _listener Socket bound to the discovery port.
+/// \return Number of records.
+int CountAdvs(UDPSocket &_listener)
+{
+  char buffer[transport::MaxRcvStr];
+  std::string srcAddr;
+  unsigned short srcPort;
+  transport::DiscoveryMsgView msg;
+  transport::AdvRecordView record;
+  int advs = 0;
+  zmq::pollitem_t item = { 0, _listener.sockDesc, ZMQ_POLLIN, 0 };
+  while (zmq::poll(&item, 1, 0) > 0)
+  {
+    int bytes = _listener.recvFrom(buffer, sizeof(buffer), srcAddr, srcPort);
+    if (bytes <= 0 || !msg.Parse(buffer, bytes))
+      continue;
+
+    if (msg.GetType() == ADV)
+      ++advs;
+    else if (msg.GetType() == ADV_BATCH)
+    {
+      while (msg.NextRecord(record))
+        ++advs;
+    }
+  }
+  return advs;
+}
+
+//////////////////////////////////////////////////
+/// \brief Function is called everytime a topic update is received. Stores
+/// the data received on each topic.
+void sequenceCb(const std::string &_topic, const std::string &_data)
+{
+  callbackData[_topic].push_back(_data);
+}
+
+//////////////////////////////////////////////////
+/// \brief Function is called everytime a topic update is received. The data
+/// is received as a parsed protobuf message.
+void protobufCb(const std::string &_topic,
+                const google::protobuf::StringValue &_msg)
+{
+  assert(_topic != "");
+  EXPECT_EQ(_msg.value(), "someData");
+  callbackExecuted = true;
+}
+
 //////////////////////////////////////////////////
 TEST(DiscZmqTest, PubWithoutAdvertise)
 {
@@ -86,6 +184,1081 @@ TEST(DiscZmqTest, PubSub)
 	EXPECT_FALSE(callbackExecuted);
 }
 
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubZeroCopy)
+{
+	callbackExecuted = false;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	// Subscribe to topic1
+	transport::Node node(master, verbose);
+	EXPECT_EQ(node.Subscribe(topic1, cb), 0);
+	node.SpinOnce();
+
+	// Publishing without advertising must not consume the data
+	EXPECT_NE(node.Publish(topic1, std::move(data)), 0);
+	EXPECT_EQ(data, "someData");
+
+	// Advertise and hand the data over to the transport
+	EXPECT_EQ(node.Advertise(topic1), 0);
+	EXPECT_EQ(node.Publish(topic1, std::move(data)), 0);
+	s_sleep(100);
+	node.SpinOnce();
+
+	// Check that the data was received
+	EXPECT_TRUE(callbackExecuted);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubBinary)
+{
+	callbackExecuted = false;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data("some\0Data", 9);
+
+	// Subscribe to topic1 receiving a copy of the data
+	transport::Node node(master, verbose);
+	EXPECT_EQ(node.Subscribe(topic1, binaryCb), 0);
+	node.SpinOnce();
+
+	EXPECT_EQ(node.Advertise(topic1), 0);
+	EXPECT_EQ(node.Publish(topic1, data), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_TRUE(callbackExecuted);
+	callbackExecuted = false;
+
+	// Replace the subscription with a callback receiving a view of the data
+	EXPECT_EQ(node.Subscribe(topic1, rawCb), 0);
+	EXPECT_EQ(node.Publish(topic1, data), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_TRUE(callbackExecuted);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubProtobuf)
+{
+	callbackExecuted = false;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	google::protobuf::StringValue msg;
+	msg.set_value("someData");
+
+	// Subscribe to topic1 with a typed callback
+	transport::Node node(master, verbose);
+	EXPECT_EQ(node.Subscribe(topic1, protobufCb), 0);
+	node.SpinOnce();
+
+	// Advertise and publish a message on topic1
+	EXPECT_EQ(node.Advertise(topic1), 0);
+	EXPECT_EQ(node.Publish(topic1, msg), 0);
+	s_sleep(100);
+	node.SpinOnce();
+
+	// Check that the message was received
+	EXPECT_TRUE(callbackExecuted);
+	callbackExecuted = false;
+
+	// The second message is parsed into the same instance
+	EXPECT_EQ(node.Publish(topic1, msg), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_TRUE(callbackExecuted);
+	callbackExecuted = false;
+
+	// Invalid data is not delivered
+	EXPECT_EQ(node.Publish(topic1, std::string("\xff\xff\xff")), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_FALSE(callbackExecuted);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubHandles)
+{
+	callbackExecuted = false;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Node node(master, verbose);
+
+	// Handles not bound to a node
+	transport::Publisher publisher;
+	transport::Subscriber subscriber;
+	EXPECT_FALSE(publisher.Valid());
+	EXPECT_FALSE(subscriber.Valid());
+	EXPECT_NE(publisher.Publish(data), 0);
+	EXPECT_NE(subscriber.UnSubscribe(), 0);
+
+	// Subscribe to topic1
+	EXPECT_EQ(node.Subscribe(topic1, cb, subscriber), 0);
+	EXPECT_TRUE(subscriber.Valid());
+	EXPECT_EQ(subscriber.GetTopic(), topic1);
+	EXPECT_TRUE(subscriber.Subscribed());
+	node.SpinOnce();
+
+	// Advertise and publish some data on topic1 through the handle
+	EXPECT_EQ(node.Advertise(topic1, publisher), 0);
+	EXPECT_TRUE(publisher.Valid());
+	EXPECT_EQ(publisher.GetTopic(), topic1);
+	EXPECT_TRUE(publisher.HasSubscribers());
+	EXPECT_EQ(publisher.Publish(data), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_TRUE(callbackExecuted);
+	callbackExecuted = false;
+
+	// A copy of the handle publishes on the same topic
+	transport::Publisher copy = publisher;
+	EXPECT_EQ(copy.Publish(std::string(data)), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_TRUE(callbackExecuted);
+	callbackExecuted = false;
+
+	// Unsubscribe through the handle
+	EXPECT_EQ(subscriber.UnSubscribe(), 0);
+	EXPECT_FALSE(subscriber.Subscribed());
+	s_sleep(100);
+
+	// The handle sees the unsubscription once the node spins
+	node.SpinOnce();
+	EXPECT_FALSE(publisher.HasSubscribers());
+
+	// Unadvertise topic1
+	node.UnAdvertise(topic1);
+	EXPECT_NE(publisher.Publish(data), 0);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, HasSubscribers)
+{
+	callbackExecuted = false;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Node node(master, verbose);
+	EXPECT_EQ(node.Advertise(topic1), 0);
+	EXPECT_FALSE(node.HasSubscribers(topic1));
+
+	// Nothing is sent without subscribers
+	EXPECT_EQ(node.Publish(topic1, data), 0);
+
+	// The subscriptions are prefixes
+	EXPECT_EQ(node.Subscribe(topic1, cb), 0);
+	s_sleep(100);
+	EXPECT_TRUE(node.HasSubscribers(topic1));
+	EXPECT_TRUE(node.HasSubscribers("foobar"));
+	EXPECT_FALSE(node.HasSubscribers("bar"));
+	node.SpinOnce();
+	EXPECT_FALSE(callbackExecuted);
+
+	EXPECT_EQ(node.UnSubscribe(topic1), 0);
+	s_sleep(100);
+	EXPECT_FALSE(node.HasSubscribers(topic1));
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, SpinBudget)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Node node(master, verbose);
+	EXPECT_EQ(node.GetSpinBudget(), 100);
+	node.SetSpinBudget(0);
+	EXPECT_EQ(node.GetSpinBudget(), 1);
+
+	EXPECT_EQ(node.Subscribe(topic1, counterCb), 0);
+	node.SpinOnce();
+	EXPECT_EQ(node.Advertise(topic1), 0);
+
+	// A single iteration processes as many messages as the budget allows
+	node.SetSpinBudget(10);
+	for (int i = 0; i < 25; ++i)
+		EXPECT_EQ(node.Publish(topic1, data), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_EQ(callbackCounter, 10);
+
+	// The rest of the queue is drained in one iteration
+	node.SetSpinBudget(100);
+	node.SpinOnce();
+	EXPECT_EQ(callbackCounter, 25);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubIoThread)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Node node(master, verbose);
+	EXPECT_FALSE(node.IoThreadRunning());
+	EXPECT_EQ(node.StartIoThread(), 0);
+	EXPECT_TRUE(node.IoThreadRunning());
+	EXPECT_NE(node.StartIoThread(), 0);
+
+	// Subscribe to topic1. The filter is installed by the I/O thread.
+	EXPECT_EQ(node.Subscribe(topic1, counterCb), 0);
+	s_sleep(100);
+
+	// Publish from another thread while this thread executes the callbacks
+	EXPECT_EQ(node.Advertise(topic1), 0);
+	std::thread publisher([&node, &topic1, &data]()
+	{
+		for (int i = 0; i < 10; ++i)
+			EXPECT_EQ(node.Publish(topic1, data), 0);
+	});
+	publisher.join();
+
+	for (int i = 0; i < 10 && callbackCounter < 10; ++i)
+		node.SpinOnce();
+	EXPECT_EQ(callbackCounter, 10);
+
+	node.StopIoThread();
+	EXPECT_FALSE(node.IoThreadRunning());
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubExecutor)
+{
+	std::string master = "";
+	bool verbose = false;
+	std::vector<std::string> topics = {"foo", "bar"};
+
+	// The entries are created here, so the callbacks only modify the vectors
+	callbackData.clear();
+	for (auto &topic : topics)
+		callbackData[topic];
+
+	transport::ThreadPoolExecutor executor(2);
+	EXPECT_EQ(executor.GetNumThreads(), 2u);
+
+	transport::Node node(master, verbose);
+	node.SetExecutor(&executor);
+
+	// The subscriptions are installed during the next iteration
+	for (auto &topic : topics)
+	{
+		EXPECT_EQ(node.Subscribe(topic, sequenceCb), 0);
+		EXPECT_EQ(node.Advertise(topic), 0);
+	}
+	node.SpinOnce();
+	s_sleep(100);
+
+	for (int i = 0; i < 50; ++i)
+	{
+		for (auto &topic : topics)
+			EXPECT_EQ(node.Publish(topic, std::to_string(i)), 0);
+	}
+
+	for (int i = 0; i < 10; ++i)
+		node.SpinOnce();
+	executor.Wait();
+
+	// Every topic receives its updates in order
+	for (auto &topic : topics)
+	{
+		ASSERT_EQ(callbackData[topic].size(), 50u);
+		for (int i = 0; i < 50; ++i)
+			EXPECT_EQ(callbackData[topic][i], std::to_string(i));
+	}
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, NPublishers)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	// Two publishers of the same topic
+	transport::Node nodePub1(master, verbose);
+	transport::Node nodePub2(master, verbose);
+	EXPECT_EQ(nodePub1.Advertise(topic1), 0);
+	EXPECT_EQ(nodePub2.Advertise(topic1), 0);
+
+	// The subscriber connects to both
+	transport::Node nodeSub(master, verbose);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+	s_sleep(100);
+	nodePub1.SpinOnce();
+	nodePub2.SpinOnce();
+	s_sleep(100);
+	for (int i = 0; i < 10; ++i)
+		nodeSub.SpinOnce();
+	s_sleep(100);
+
+	EXPECT_EQ(nodePub1.Publish(topic1, data), 0);
+	EXPECT_EQ(nodePub2.Publish(topic1, data), 0);
+	for (int i = 0; i < 10 && callbackCounter < 2; ++i)
+	{
+		s_sleep(20);
+		nodeSub.SpinOnce();
+	}
+
+	EXPECT_EQ(callbackCounter, 2);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, SharedEndpoint)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string topic2 = "bar";
+	std::string data = "someData";
+
+	transport::Node nodePub(master, verbose);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+	EXPECT_EQ(nodePub.Advertise(topic2), 0);
+
+	// Both topics are received through the same connection
+	transport::Node nodeSub(master, verbose);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+	EXPECT_EQ(nodeSub.Subscribe(topic2, counterCb), 0);
+	s_sleep(100);
+	nodePub.SpinOnce();
+	s_sleep(100);
+	for (int i = 0; i < 10; ++i)
+		nodeSub.SpinOnce();
+	s_sleep(100);
+
+	EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	EXPECT_EQ(nodePub.Publish(topic2, data), 0);
+	s_sleep(100);
+	for (int i = 0; i < 10; ++i)
+		nodeSub.SpinOnce();
+	EXPECT_EQ(callbackCounter, 2);
+
+	// The connection is kept while a topic uses it
+	EXPECT_EQ(nodeSub.UnSubscribe(topic1), 0);
+	s_sleep(100);
+	EXPECT_EQ(nodePub.Publish(topic2, data), 0);
+	s_sleep(100);
+	for (int i = 0; i < 10; ++i)
+		nodeSub.SpinOnce();
+	EXPECT_EQ(callbackCounter, 3);
+
+	// The connection is closed with the last topic and opened again on the
+	// next subscription
+	EXPECT_EQ(nodeSub.UnSubscribe(topic2), 0);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+	s_sleep(100);
+	nodePub.SpinOnce();
+	s_sleep(100);
+	for (int i = 0; i < 10; ++i)
+		nodeSub.SpinOnce();
+	s_sleep(100);
+
+	EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	s_sleep(100);
+	for (int i = 0; i < 10; ++i)
+		nodeSub.SpinOnce();
+	EXPECT_EQ(callbackCounter, 4);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, LeaseExpiry)
+{
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+
+	transport::Node nodeSub(master, verbose);
+	nodeSub.SetLeaseTimeout(300);
+	EXPECT_EQ(nodeSub.GetLeaseTimeout(), 300);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+
+	transport::Node *nodePub = new transport::Node(master, verbose);
+	nodePub->SetHeartbeatInterval(50);
+	EXPECT_EQ(nodePub->GetHeartbeatInterval(), 50);
+	EXPECT_EQ(nodePub->Advertise(topic1), 0);
+	for (int i = 0; i < 5; ++i)
+	{
+		nodePub->SpinOnce();
+		s_sleep(50);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+
+	// The publisher stays alive while it sends heartbeats
+	for (int i = 0; i < 10; ++i)
+	{
+		nodePub->SpinOnce();
+		s_sleep(50);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+
+	// Or while it publishes, without spinning
+	for (int i = 0; i < 10; ++i)
+	{
+		EXPECT_EQ(nodePub->Publish(topic1, "someData"), 0);
+		s_sleep(50);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+
+	// Its addresses are removed once it is gone
+	delete nodePub;
+	for (int i = 0; i < 10; ++i)
+	{
+		s_sleep(50);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_FALSE(nodeSub.HasPublishers(topic1));
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, MulticastDiscovery)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	setenv("DZMQ_DISCOVERY_PORT", "11313", 1);
+	setenv("DZMQ_MULTICAST_GROUP", "239.255.0.1", 1);
+	transport::Node nodePub(master, verbose);
+	transport::Node nodeSub(master, verbose);
+
+	// A node in another group does not see the discovery traffic
+	setenv("DZMQ_MULTICAST_GROUP", "239.255.0.2", 1);
+	transport::Node nodeOther(master, verbose);
+	unsetenv("DZMQ_MULTICAST_GROUP");
+	unsetenv("DZMQ_DISCOVERY_PORT");
+
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+	EXPECT_EQ(nodeOther.Subscribe(topic1, counterCb), 0);
+	for (int i = 0; i < 5; ++i)
+	{
+		nodePub.SpinOnce();
+		s_sleep(50);
+		nodeSub.SpinOnce();
+		nodeOther.SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+	EXPECT_FALSE(nodeOther.HasPublishers(topic1));
+
+	EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5 && callbackCounter < 1; ++i)
+	{
+		s_sleep(50);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_EQ(callbackCounter, 1);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, ReplySuppression)
+{
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+
+	setenv("DZMQ_DISCOVERY_PORT", "11314", 1);
+	transport::Node nodePub(master, verbose);
+	nodePub.SetReplyJitter(200);
+	EXPECT_EQ(nodePub.GetReplyJitter(), 200);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+	nodePub.SpinOnce();
+
+	// Count the ADVERTISE records sent from now on
+	UDPSocket listener(11314);
+	CountAdvs(listener);
+
+	// More subscribers at once than can be answered by unicast get a single
+	// broadcast reply, with the only address of the publisher
+	std::vector<transport::Node*> subs;
+	for (size_t i = 0; i < transport::MaxUnicastReplies + 1; ++i)
+	{
+		subs.push_back(new transport::Node(master, verbose));
+		EXPECT_EQ(subs.back()->Subscribe(topic1, counterCb), 0);
+	}
+	unsetenv("DZMQ_DISCOVERY_PORT");
+
+	for (int i = 0; i < 10; ++i)
+	{
+		nodePub.SpinOnce();
+		s_sleep(50);
+		for (auto sub : subs)
+			sub->SpinOnce();
+	}
+	EXPECT_EQ(CountAdvs(listener), 1);
+
+	for (auto sub : subs)
+	{
+		EXPECT_TRUE(sub->HasPublishers(topic1));
+		delete sub;
+	}
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, UnicastReplies)
+{
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+
+	setenv("DZMQ_DISCOVERY_PORT", "11315", 1);
+	transport::Node nodePub(master, verbose);
+	nodePub.SetReplyJitter(0);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+	nodePub.SpinOnce();
+
+	// Count the ADVERTISE records sent to the discovery port from now on
+	UDPSocket listener(11315);
+	CountAdvs(listener);
+
+	// A subscriber is answered by unicast
+	transport::Node nodeSub(master, verbose);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+	for (int i = 0; i < 10 && !nodeSub.HasPublishers(topic1); ++i)
+	{
+		nodePub.SpinOnce();
+		nodeSub.SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+	EXPECT_EQ(CountAdvs(listener), 0);
+
+	// A subscription sent from the discovery port is answered by broadcast
+	uuid_t guid;
+	uuid_generate(guid);
+	transport::Header header(TRNSP_VERSION, guid, topic1, SUB, 0);
+	std::vector<char> sub(header.GetHeaderLength());
+	header.Pack(&sub[0]);
+	listener.sendTo(&sub[0], sub.size(), "255.255.255.255", 11315);
+	unsetenv("DZMQ_DISCOVERY_PORT");
+
+	for (int i = 0; i < 5; ++i)
+	{
+		nodePub.SpinOnce();
+		s_sleep(10);
+	}
+	EXPECT_EQ(CountAdvs(listener), 1);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, CompactDiscovery)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	setenv("DZMQ_DISCOVERY_PORT", "11318", 1);
+	transport::Node nodePub(master, verbose);
+	transport::Node nodeSub(master, verbose);
+	unsetenv("DZMQ_DISCOVERY_PORT");
+	UDPSocket listener(11318);
+	char buffer[transport::MaxRcvStr];
+	std::string srcAddr;
+	unsigned short srcPort;
+
+	// Version of the messages of a type sent to the discovery port
+	auto msgVersion = [&](uint8_t _type)
+	{
+		int version = 0;
+		zmq::pollitem_t item = { 0, listener.sockDesc, ZMQ_POLLIN, 0 };
+		while (zmq::poll(&item, 1, 0) > 0)
+		{
+			int bytes =
+				listener.recvFrom(buffer, sizeof(buffer), srcAddr, srcPort);
+			transport::DiscoveryMsgView msg;
+			if (msg.Parse(buffer, bytes) && msg.GetType() == _type)
+				version = msg.GetVersion();
+		}
+		return version;
+	};
+
+	// The nodes switch to the compact encoding once every node alive had the
+	// time to say that it decodes it
+	for (auto node : {&nodePub, &nodeSub})
+	{
+		node->SetHeartbeatInterval(20);
+		node->SetLeaseTimeout(100);
+	}
+	for (int i = 0; i < 15; ++i)
+	{
+		nodePub.SpinOnce();
+		nodeSub.SpinOnce();
+		s_sleep(10);
+	}
+	msgVersion(0);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+	nodePub.SpinOnce();
+	EXPECT_EQ(msgVersion(ADV_BATCH), TRNSP_VERSION_COMPACT);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+	EXPECT_EQ(msgVersion(SUB), TRNSP_VERSION_COMPACT);
+
+	for (int i = 0; i < 10 && !nodeSub.HasPublishers(topic1); ++i)
+	{
+		nodePub.SpinOnce();
+		s_sleep(10);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+	for (int i = 0; i < 20 && callbackCounter == 0; ++i)
+	{
+		EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+		s_sleep(10);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_GT(callbackCounter, 0);
+
+	// A node started later is answered by unicast, with records that carry
+	// the hash of their topic only
+	setenv("DZMQ_DISCOVERY_PORT", "11318", 1);
+	transport::Node nodeLate(master, verbose);
+	unsetenv("DZMQ_DISCOVERY_PORT");
+	EXPECT_EQ(nodeLate.Subscribe(topic1, counterCb), 0);
+	for (int i = 0; i < 10 && !nodeLate.HasPublishers(topic1); ++i)
+	{
+		nodePub.SpinOnce();
+		s_sleep(10);
+		nodeLate.SpinOnce();
+	}
+	EXPECT_TRUE(nodeLate.HasPublishers(topic1));
+
+	// A heartbeat without FLAG_WIRE_V2 brings version 1 back
+	uuid_t guid;
+	uuid_generate(guid);
+	transport::Header header(TRNSP_VERSION, guid, "", HEARTBEAT, 0);
+	std::vector<char> heartbeat(header.GetHeaderLength());
+	header.Pack(&heartbeat[0]);
+	listener.sendTo(&heartbeat[0], heartbeat.size(), "255.255.255.255", 11318);
+	s_sleep(10);
+	nodeSub.SpinOnce();
+	msgVersion(0);
+	EXPECT_EQ(nodeSub.Subscribe("bar", counterCb), 0);
+	EXPECT_EQ(msgVersion(SUB), TRNSP_VERSION);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, LegacySubscription)
+{
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+
+	setenv("DZMQ_DISCOVERY_PORT", "11319", 1);
+	transport::Node nodePub(master, verbose);
+	unsetenv("DZMQ_DISCOVERY_PORT");
+	nodePub.SetHeartbeatInterval(20);
+	nodePub.SetLeaseTimeout(100);
+	nodePub.SetReplyJitter(0);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+	for (int i = 0; i < 15; ++i)
+	{
+		nodePub.SpinOnce();
+		s_sleep(10);
+	}
+
+	// A node that never sent a heartbeat subscribes in version 1 from its
+	// unicast socket
+	UDPSocket legacy("0.0.0.0", 0);
+	uuid_t guid;
+	uuid_generate(guid);
+	transport::Header header(TRNSP_VERSION, guid, topic1, SUB, 0);
+	std::vector<char> sub(header.GetHeaderLength());
+	header.Pack(&sub[0]);
+	legacy.sendTo(&sub[0], sub.size(), "255.255.255.255", 11319);
+
+	// It is answered in version 1, with single records that the nodes older
+	// than ADV_BATCH decode
+	char buffer[transport::MaxRcvStr];
+	std::string srcAddr;
+	unsigned short srcPort;
+	transport::DiscoveryMsgView msg;
+	zmq::pollitem_t item = { 0, legacy.sockDesc, ZMQ_POLLIN, 0 };
+	for (int i = 0; i < 10 && zmq::poll(&item, 1, 0) == 0; ++i)
+		nodePub.SpinOnce();
+	ASSERT_GT(zmq::poll(&item, 1, 0), 0);
+	int bytes = legacy.recvFrom(buffer, sizeof(buffer), srcAddr, srcPort);
+	ASSERT_TRUE(msg.Parse(buffer, bytes));
+	EXPECT_EQ(msg.GetType(), ADV);
+	EXPECT_EQ(msg.GetVersion(), TRNSP_VERSION);
+	EXPECT_EQ(msg.GetTopic().ToString(), topic1);
+
+	// The subscription also brings version 1 back for the broadcasts
+	UDPSocket listener(11319);
+	EXPECT_EQ(nodePub.Advertise("bar"), 0);
+	nodePub.SpinOnce();
+	int version = 0;
+	item.fd = listener.sockDesc;
+	while (zmq::poll(&item, 1, 0) > 0)
+	{
+		bytes = listener.recvFrom(buffer, sizeof(buffer), srcAddr, srcPort);
+		if (msg.Parse(buffer, bytes) && msg.GetType() == ADV_BATCH)
+			version = msg.GetVersion();
+	}
+	EXPECT_EQ(version, TRNSP_VERSION);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, AdvertiseManyTopics)
+{
+	std::string master = "";
+	bool verbose = false;
+
+	setenv("DZMQ_DISCOVERY_PORT", "11320", 1);
+	transport::Node nodePub(master, verbose);
+	unsetenv("DZMQ_DISCOVERY_PORT");
+	UDPSocket listener(11320);
+
+	// The topics advertised at startup are batched, before the version of
+	// the other nodes is known
+	const int numTopics = 500;
+	for (int i = 0; i < numTopics; ++i)
+		EXPECT_EQ(nodePub.Advertise("topic" + std::to_string(i)), 0);
+	nodePub.SpinOnce();
+
+	char buffer[transport::MaxRcvStr];
+	std::string srcAddr;
+	unsigned short srcPort;
+	transport::DiscoveryMsgView msg;
+	transport::AdvRecordView record;
+	int datagrams = 0;
+	int records = 0;
+	zmq::pollitem_t item = { 0, listener.sockDesc, ZMQ_POLLIN, 0 };
+	while (zmq::poll(&item, 1, 0) > 0)
+	{
+		int bytes = listener.recvFrom(buffer, sizeof(buffer), srcAddr, srcPort);
+		ASSERT_TRUE(msg.Parse(buffer, bytes));
+		EXPECT_NE(msg.GetType(), ADV);
+		if (msg.GetType() != ADV_BATCH)
+			continue;
+
+		++datagrams;
+		while (msg.NextRecord(record))
+			++records;
+	}
+	EXPECT_GE(records, numTopics);
+	EXPECT_LT(datagrams, numTopics / 10);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, DiscoveryCache)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+	std::string path = "/tmp/dzmq-cache-" + std::to_string(getpid());
+	unlink(path.c_str());
+
+	setenv("DZMQ_DISCOVERY_CACHE", path.c_str(), 1);
+	setenv("DZMQ_DISCOVERY_PORT", "11316", 1);
+	transport::Node nodePub(master, verbose);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+
+	// The publisher discovered is stored in the cache
+	transport::Node *nodeSub = new transport::Node(master, verbose);
+	EXPECT_EQ(nodeSub->Subscribe(topic1, counterCb), 0);
+	for (int i = 0; i < 10 && !nodeSub->HasPublishers(topic1); ++i)
+	{
+		nodePub.SpinOnce();
+		nodeSub->SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub->HasPublishers(topic1));
+	delete nodeSub;
+
+	// After a restart, the publisher is known without discovery. The node
+	// uses another discovery port, so it cannot hear the publisher.
+	setenv("DZMQ_DISCOVERY_PORT", "11317", 1);
+	nodeSub = new transport::Node(master, verbose);
+	unsetenv("DZMQ_DISCOVERY_PORT");
+	unsetenv("DZMQ_DISCOVERY_CACHE");
+	nodeSub->SetHeartbeatInterval(50);
+	nodeSub->SetLeaseTimeout(1000);
+	EXPECT_TRUE(nodeSub->HasPublishers(topic1));
+	EXPECT_EQ(nodeSub->Subscribe(topic1, counterCb), 0);
+	for (int i = 0; i < 20 && callbackCounter == 0; ++i)
+	{
+		nodePub.SpinOnce();
+		EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+		s_sleep(10);
+		nodeSub->SpinOnce();
+	}
+	EXPECT_GT(callbackCounter, 0);
+
+	// The publisher expires, and leaves the cache, when live discovery does
+	// not confirm it
+	for (int i = 0; i < 30 && nodeSub->HasPublishers(topic1); ++i)
+	{
+		s_sleep(50);
+		nodeSub->SpinOnce();
+	}
+	EXPECT_FALSE(nodeSub->HasPublishers(topic1));
+	delete nodeSub;
+
+	transport::DiscoveryCache cache;
+	std::vector<transport::CachedAdv> advs;
+	EXPECT_EQ(cache.Open(path), 0);
+	cache.Load(transport::DiscoveryCacheMaxAge, advs);
+	EXPECT_TRUE(advs.empty());
+	unlink(path.c_str());
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, RegistryDiscovery)
+{
+	callbackCounter = 0;
+	std::string master = "tcp://127.0.0.1:11331";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Registry *registry = new transport::Registry(master, verbose);
+	transport::Node *nodePub = new transport::Node(master, verbose);
+	nodePub->SetHeartbeatInterval(50);
+	EXPECT_EQ(nodePub->Advertise(topic1), 0);
+	transport::Node nodeSub(master, verbose);
+	nodeSub.SetHeartbeatInterval(50);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+
+	// A node using broadcast discovery does not see the registered nodes
+	transport::Node nodeBcast("", verbose);
+	EXPECT_EQ(nodeBcast.Subscribe(topic1, counterCb), 0);
+
+	for (int i = 0; i < 10 && !nodeSub.HasPublishers(topic1); ++i)
+	{
+		nodePub->SpinOnce();
+		registry->SpinOnce(10);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+	for (int i = 0; i < 20 && callbackCounter == 0; ++i)
+	{
+		nodePub->SpinOnce();
+		EXPECT_EQ(nodePub->Publish(topic1, data), 0);
+		s_sleep(10);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_GT(callbackCounter, 0);
+	nodeBcast.SpinOnce();
+	EXPECT_FALSE(nodeBcast.HasPublishers(topic1));
+
+	// The nodes register again with a new registry
+	delete registry;
+	registry = new transport::Registry(master, verbose);
+	for (int i = 0; i < 10; ++i)
+	{
+		nodePub->SpinOnce();
+		nodeSub.SpinOnce();
+		registry->SpinOnce(10);
+	}
+	EXPECT_EQ(registry->GetNodeCount(), 2u);
+	EXPECT_TRUE(nodeSub.HasPublishers(topic1));
+
+	// The subscribers learn at once that a publisher left
+	delete nodePub;
+	for (int i = 0; i < 10 && nodeSub.HasPublishers(topic1); ++i)
+	{
+		registry->SpinOnce(10);
+		nodeSub.SpinOnce();
+	}
+	EXPECT_FALSE(nodeSub.HasPublishers(topic1));
+	EXPECT_EQ(registry->GetNodeCount(), 1u);
+	delete registry;
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubShm)
+{
+	callbackExecuted = false;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Node nodePub(master, verbose);
+	EXPECT_EQ(nodePub.EnableShm(1024 * 1024), 0);
+	EXPECT_NE(nodePub.EnableShm(), 0);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+
+	// Subscribe from another node. The publisher answers with its shared
+	// memory address first.
+	transport::Node nodeSub(master, verbose);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, cb), 0);
+	s_sleep(100);
+	nodePub.SpinOnce();
+	s_sleep(100);
+	for (int i = 0; i < 5; ++i)
+		nodeSub.SpinOnce();
+
+	EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5 && !callbackExecuted; ++i)
+		nodeSub.SpinOnce();
+
+	// Check that the data was received
+	EXPECT_TRUE(callbackExecuted);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubShmUnSubscribeInCallback)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Node nodePub(master, verbose);
+	EXPECT_EQ(nodePub.EnableShm(4096), 0);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+
+	// The callback releases the ring it is read from
+	transport::Node nodeSub(master, verbose);
+	unSubscribeNode = &nodeSub;
+	EXPECT_EQ(nodeSub.Subscribe(topic1, unSubscribeCb), 0);
+	s_sleep(100);
+	nodePub.SpinOnce();
+	s_sleep(100);
+	for (int i = 0; i < 5; ++i)
+		nodeSub.SpinOnce();
+
+	// Later updates in the ring are not delivered
+	for (int i = 0; i < 3; ++i)
+		EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5; ++i)
+		nodeSub.SpinOnce();
+
+	EXPECT_EQ(callbackCounter, 1);
+	unSubscribeNode = nullptr;
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubLostUpdates)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	// A small ring, so the subscriber is easily left behind
+	transport::Node nodePub(master, verbose);
+	EXPECT_EQ(nodePub.EnableShm(4096), 0);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+
+	transport::Node nodeSub(master, verbose);
+	EXPECT_EQ(nodeSub.Subscribe(topic1, counterCb), 0);
+	s_sleep(100);
+	nodePub.SpinOnce();
+	s_sleep(100);
+	for (int i = 0; i < 5; ++i)
+		nodeSub.SpinOnce();
+
+	// The first update sets the reference of the sequence
+	EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5 && callbackCounter < 1; ++i)
+		nodeSub.SpinOnce();
+	EXPECT_EQ(callbackCounter, 1);
+	EXPECT_EQ(nodeSub.GetLostUpdates(topic1), 0u);
+
+	// Overrun the subscriber. The gap is detected on the next update.
+	for (int i = 0; i < 200; ++i)
+		EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5; ++i)
+		nodeSub.SpinOnce();
+	EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5 && callbackCounter < 2; ++i)
+		nodeSub.SpinOnce();
+
+	EXPECT_EQ(callbackCounter, 2);
+	EXPECT_EQ(nodeSub.GetLostUpdates(topic1), 200u);
+	EXPECT_EQ(nodePub.GetLostUpdates(topic1), 0u);
+
+	// The sequence continues when the topic is advertised again, so the
+	// gaps are still detected
+	EXPECT_EQ(nodePub.UnAdvertise(topic1), 0);
+	EXPECT_EQ(nodePub.Advertise(topic1), 0);
+	for (int i = 0; i < 200; ++i)
+		EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5; ++i)
+		nodeSub.SpinOnce();
+	EXPECT_EQ(nodePub.Publish(topic1, data), 0);
+	for (int i = 0; i < 5 && callbackCounter < 3; ++i)
+		nodeSub.SpinOnce();
+
+	EXPECT_EQ(callbackCounter, 3);
+	EXPECT_EQ(nodeSub.GetLostUpdates(topic1), 400u);
+}
+
+//////////////////////////////////////////////////
+TEST(DiscZmqTest, PubSubStats)
+{
+	callbackCounter = 0;
+	std::string master = "";
+	bool verbose = false;
+	std::string topic1 = "foo";
+	std::string data = "someData";
+
+	transport::Node node(master, verbose);
+	EXPECT_EQ(node.Subscribe(topic1, counterCb), 0);
+	node.SpinOnce();
+	EXPECT_EQ(node.Advertise(topic1), 0);
+
+	// Nothing is collected until the statistics are enabled
+	transport::TopicStats stats;
+	EXPECT_EQ(node.Publish(topic1, data), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_EQ(callbackCounter, 1);
+	EXPECT_FALSE(node.GetTopicStats(topic1, stats));
+
+	node.EnableStats(true);
+	for (int i = 0; i < 10; ++i)
+		EXPECT_EQ(node.Publish(topic1, data), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_EQ(callbackCounter, 11);
+
+	EXPECT_TRUE(node.GetTopicStats(topic1, stats));
+	EXPECT_EQ(stats.msgs, 10u);
+	EXPECT_EQ(stats.bytes, 10 * data.size());
+	EXPECT_EQ(stats.lost, 0u);
+	EXPECT_GT(stats.max, 0);
+	EXPECT_LE(stats.p50, stats.p99);
+	EXPECT_LE(stats.p99, stats.max);
+	EXPECT_GT(stats.msgRate, 0);
+
+	// The counters stop when disabled
+	node.EnableStats(false);
+	EXPECT_EQ(node.Publish(topic1, data), 0);
+	s_sleep(100);
+	node.SpinOnce();
+	EXPECT_TRUE(node.GetTopicStats(topic1, stats));
+	EXPECT_EQ(stats.msgs, 10u);
+}
+
 //////////////////////////////////////////////////
 /*TEST(DiscZmqTest, NPubSub)
 {
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "discoveryCache.hh"
+
+/// \brief Value stored in a valid cache file.
+static const uint32_t CacheMagic = 0x445a4443;
+
+/// \brief Offset of the entries in the file.
+static const size_t EntriesOffset = 64;
+
+/// \brief Advisory lock of a file, released when the object is destroyed.
+class FileLock
+{
+  /// \brief Constructor.
+  /// \param[in] _fd Descriptor of the file.
+  /// \param[in] _operation LOCK_SH or LOCK_EX.
+  public: FileLock(int _fd, int _operation)
+    : fd(_fd)
+  {
+    while (flock(this->fd, _operation) != 0 && errno == EINTR)
+      continue;
+  }
+
+  /// \brief Destructor.
+  public: ~FileLock()
+  {
+    flock(this->fd, LOCK_UN);
+  }
+
+  /// \brief Descriptor of the file.
+  private: int fd;
+};
+
+/// \brief Get the wall-clock time. It is the reference of the entries,
+/// since they outlive the processes.
+/// \return Seconds since the epoch.
+static int64_t Now()
+{
+  return std::chrono::duration_cast<std::chrono::seconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/// \brief Check that a field of an entry is null terminated.
+/// \param[in] _field Field.
+/// \param[in] _size Size of the field.
+/// \return true if the field is null terminated.
+static bool Terminated(const char *_field, size_t _size)
+{
+  return strnlen(_field, _size) < _size;
+}
+
+/// \brief Compare a field of an entry, that might not be null terminated,
+/// with a string.
+/// \param[in] _field Field.
+/// \param[in] _size Size of the field.
+/// \param[in] _value String.
+/// \return true if the field contains the string.
+static bool FieldEquals(const char *_field, size_t _size,
+                        const std::string &_value)
+{
+  return _value.size() < _size && strnlen(_field, _size) == _value.size() &&
+         memcmp(_field, _value.data(), _value.size()) == 0;
+}
+
+//////////////////////////////////////////////////
+const uint32_t transport::DiscoveryCache::Capacity;
+const size_t transport::DiscoveryCache::MaxTopicLength;
+const size_t transport::DiscoveryCache::MaxAddressLength;
+
+//////////////////////////////////////////////////
+transport::DiscoveryCache::DiscoveryCache()
+  : fd(-1),
+    segment(nullptr),
+    segmentSize(0),
+    entries(nullptr)
+{
+}
+
+//////////////////////////////////////////////////
+transport::DiscoveryCache::~DiscoveryCache()
+{
+  this->Close();
+}
+
+//////////////////////////////////////////////////
+int transport::DiscoveryCache::Open(const std::string &_path)
+{
+  if (this->segment)
+    return -1;
+
+  int fd = open(_path.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+  {
+    std::cerr << "Error opening the discovery cache [" << _path << "]: "
+              << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  FileLock lock(fd, LOCK_EX);
+
+  size_t size = EntriesOffset + Capacity * sizeof(Entry);
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  // A file of another size is not a cache of this version
+  bool valid = static_cast<size_t>(st.st_size) == size;
+  if (!valid && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0))
+  {
+    std::cerr << "Error sizing the discovery cache [" << _path << "]: "
+              << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+  }
+
+  void *segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+  if (segment == MAP_FAILED)
+  {
+    std::cerr << "Error mapping the discovery cache [" << _path << "]: "
+              << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+  }
+
+  Control *control = static_cast<Control*>(segment);
+  if (!valid || control->magic != CacheMagic ||
+      control->capacity != Capacity || control->entrySize != sizeof(Entry))
+  {
+    memset(segment, 0, size);
+    control->capacity = Capacity;
+    control->entrySize = sizeof(Entry);
+    control->magic = CacheMagic;
+  }
+
+  this->fd = fd;
+  this->segment = segment;
+  this->segmentSize = size;
+  this->entries = reinterpret_cast<Entry*>(
+    static_cast<char*>(segment) + EntriesOffset);
+  return 0;
+}
+
+//////////////////////////////////////////////////
+bool transport::DiscoveryCache::IsOpen() const
+{
+  return this->segment != nullptr;
+}
+
+//////////////////////////////////////////////////
+void transport::DiscoveryCache::Load(int _maxAge,
+                                     std::vector<CachedAdv> &_advs)
+{
+  _advs.clear();
+  if (!this->segment)
+    return;
+
+  FileLock lock(this->fd, LOCK_SH);
+  int64_t now = Now();
+  for (uint32_t i = 0; i < Capacity; ++i)
+  {
+    const Entry &entry = this->entries[i];
+    if (entry.stamp == 0 || now - entry.stamp > _maxAge)
+      continue;
+
+    // The file can be written by other processes
+    if (!Terminated(entry.guid, sizeof(entry.guid)) ||
+        !Terminated(entry.topic, sizeof(entry.topic)) ||
+        !Terminated(entry.address, sizeof(entry.address)))
+    {
+      continue;
+    }
+
+    CachedAdv adv;
+    adv.guid = entry.guid;
+    adv.type = entry.type;
+    adv.topic = entry.topic;
+    adv.address = entry.address;
+    _advs.push_back(adv);
+    this->Index(adv.guid, EntryKey(adv.type, adv.topic, adv.address), i);
+  }
+}
+
+//////////////////////////////////////////////////
+int transport::DiscoveryCache::Store(const std::string &_guid, uint8_t _type,
+                                     const std::string &_topic,
+                                     const std::string &_address)
+{
+  if (!this->segment)
+    return -1;
+
+  if (_guid.size() >= sizeof(Entry::guid) ||
+      _topic.size() > MaxTopicLength || _address.size() > MaxAddressLength)
+  {
+    return -1;
+  }
+
+  FileLock lock(this->fd, LOCK_EX);
+  int64_t now = Now();
+  EntryKey key(_type, _topic, _address);
+
+  // Usually the entry is confirmed in the slot where it was seen before
+  auto node = this->slots.find(_guid);
+  if (node != this->slots.end())
+  {
+    auto known = node->second.find(key);
+    if (known != node->second.end())
+    {
+      Entry &entry = this->entries[known->second];
+      if (entry.stamp != 0 && entry.type == _type &&
+          FieldEquals(entry.guid, sizeof(entry.guid), _guid) &&
+          FieldEquals(entry.topic, sizeof(entry.topic), _topic) &&
+          FieldEquals(entry.address, sizeof(entry.address), _address))
+      {
+        entry.stamp = now;
+        return 0;
+      }
+    }
+  }
+
+  Entry *slot = nullptr;
+  for (uint32_t i = 0; i < Capacity; ++i)
+  {
+    Entry &entry = this->entries[i];
+    if (entry.stamp != 0 && entry.type == _type &&
+        FieldEquals(entry.guid, sizeof(entry.guid), _guid) &&
+        FieldEquals(entry.topic, sizeof(entry.topic), _topic) &&
+        FieldEquals(entry.address, sizeof(entry.address), _address))
+    {
+      entry.stamp = now;
+      this->Index(_guid, key, i);
+      return 0;
+    }
+
+    // Use the first free entry, or the oldest one
+    if (!slot || (slot->stamp != 0 && entry.stamp < slot->stamp))
+      slot = &entry;
+  }
+
+  this->Index(_guid, key, slot - this->entries);
+  memset(slot, 0, sizeof(Entry));
+  slot->type = _type;
+  memcpy(slot->guid, _guid.data(), _guid.size());
+  memcpy(slot->topic, _topic.data(), _topic.size());
+  memcpy(slot->address, _address.data(), _address.size());
+  slot->stamp = now;
+  return 0;
+}
+
+//////////////////////////////////////////////////
+void transport::DiscoveryCache::Touch(const std::string &_guid)
+{
+  if (!this->segment)
+    return;
+
+  // Only the slots seen by this object are confirmed, the rest of the
+  // processes confirm their own
+  auto node = this->slots.find(_guid);
+  if (node == this->slots.end())
+    return;
+
+  FileLock lock(this->fd, LOCK_EX);
+  int64_t now = Now();
+  for (auto it = node->second.begin(); it != node->second.end();)
+  {
+    Entry &entry = this->entries[it->second];
+    if (entry.stamp != 0 && FieldEquals(entry.guid, sizeof(entry.guid), _guid))
+    {
+      entry.stamp = now;
+      ++it;
+    }
+    else
+      it = node->second.erase(it);
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::DiscoveryCache::Remove(const std::string &_guid)
+{
+  if (!this->segment)
+    return;
+
+  this->slots.erase(_guid);
+
+  FileLock lock(this->fd, LOCK_EX);
+  for (uint32_t i = 0; i < Capacity; ++i)
+  {
+    Entry &entry = this->entries[i];
+    if (entry.stamp != 0 && FieldEquals(entry.guid, sizeof(entry.guid), _guid))
+      memset(&entry, 0, sizeof(Entry));
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::DiscoveryCache::Index(const std::string &_guid,
+                                      const EntryKey &_key, uint32_t _slot)
+{
+  this->slots[_guid][_key] = _slot;
+}
+
+//////////////////////////////////////////////////
+void transport::DiscoveryCache::Close()
+{
+  if (!this->segment)
+    return;
+
+  munmap(this->segment, this->segmentSize);
+  close(this->fd);
+
+  this->fd = -1;
+  this->segment = nullptr;
+  this->entries = nullptr;
+  this->slots.clear();
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#ifndef __DISCOVERY_CACHE_HH_INCLUDED__
+#define __DISCOVERY_CACHE_HH_INCLUDED__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace transport
+{
+  /// \brief Address advertised by a remote node, as stored in the cache.
+  class CachedAdv
+  {
+    /// brief GUID of the node.
+    public: std::string guid;
+
+    /// brief ADV or ADV_SVC.
+    public: uint8_t type;
+
+    /// brief Topic or service advertised.
+    public: std::string topic;
+
+    /// brief Address advertised with the topic.
+    public: std::string address;
+  };
+
+  /// \brief Discovery knowledge kept in a memory-mapped file, so a node that
+  /// restarts knows the addresses advertised before. The file can be shared
+  /// by the nodes of a user in a host; every access takes an advisory lock on
+  /// it. Every entry has the wall-clock time when it was last confirmed.
+  class DiscoveryCache
+  {
+    /// \brief Number of entries of the file.
+    public: static const uint32_t Capacity = 1024;
+
+    /// \brief Longest topic that can be stored (bytes).
+    public: static const size_t MaxTopicLength = 191;
+
+    /// \brief Longest address that can be stored (bytes).
+    public: static const size_t MaxAddressLength = 127;
+
+    /// \brief Constructor.
+    public: DiscoveryCache();
+
+    /// \brief Destructor.
+    public: virtual ~DiscoveryCache();
+
+    /// \brief Map a cache file. It is created, or emptied if it does not
+    /// contain a valid cache.
+    /// \param[in] _path Path of the file.
+    /// \return 0 when success.
+    public: int Open(const std::string &_path);
+
+    /// \brief Return true if a file is mapped.
+    /// \return true if a file is mapped.
+    public: bool IsOpen() const;
+
+    /// \brief Get the entries confirmed recently. The entries with fields
+    /// that are not null terminated are skipped.
+    /// \param[in] _maxAge Maximum age of the entries (secs).
+    /// \param[out] _advs Entries found.
+    public: void Load(int _maxAge, std::vector<CachedAdv> &_advs);
+
+    /// \brief Add an entry, or confirm it if it is already stored. The
+    /// oldest entry is replaced when the cache is full.
+    /// \param[in] _guid GUID of the node.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _topic Topic advertised.
+    /// \param[in] _address Address advertised with the topic.
+    /// \return 0 when success or -1 if the entry is too long to be stored.
+    public: int Store(const std::string &_guid, uint8_t _type,
+                      const std::string &_topic, const std::string &_address);
+
+    /// \brief Confirm all the entries of a node.
+    /// \param[in] _guid GUID of the node.
+    public: void Touch(const std::string &_guid);
+
+    /// \brief Remove all the entries of a node.
+    /// \param[in] _guid GUID of the node.
+    public: void Remove(const std::string &_guid);
+
+    /// \brief Unmap the file.
+    private: void Close();
+
+    /// \brief Type, topic and address of an entry.
+    private: typedef std::tuple<uint8_t, std::string, std::string> EntryKey;
+
+    /// \brief Remember the slot of an entry.
+    /// \param[in] _guid GUID of the node.
+    /// \param[in] _key Type, topic and address of the entry.
+    /// \param[in] _slot Index of the entry in the file.
+    private: void Index(const std::string &_guid, const EntryKey &_key,
+                        uint32_t _slot);
+
+    /// \brief Header at the beginning of the file.
+    private: struct Control
+    {
+      /// \brief Identifies a valid cache.
+      uint32_t magic;
+
+      /// \brief Number of entries.
+      uint32_t capacity;
+
+      /// \brief Size of every entry (bytes).
+      uint32_t entrySize;
+    };
+
+    /// \brief Entry of the file. An entry is free if its time is zero.
+    private: struct Entry
+    {
+      /// \brief Last time the entry was confirmed (secs since the epoch).
+      int64_t stamp;
+
+      /// \brief ADV or ADV_SVC.
+      uint8_t type;
+
+      /// \brief GUID of the node, null terminated.
+      char guid[37];
+
+      /// \brief Topic, null terminated.
+      char topic[MaxTopicLength + 1];
+
+      /// \brief Address, null terminated.
+      char address[MaxAddressLength + 1];
+    };
+
+    /// \brief Descriptor of the file, used for locking.
+    private: int fd;
+
+    /// \brief Mapped file.
+    private: void *segment;
+
+    /// \brief Size of the mapped file.
+    private: size_t segmentSize;
+
+    /// \brief Entries in the file.
+    private: Entry *entries;
+
+    /// \brief Slots of the entries loaded or stored by this object, by GUID
+    /// and key, so they are confirmed without scanning the file. Other
+    /// processes may reuse the slots, so they are checked before being used.
+    private: std::map<std::string, std::map<EntryKey, uint32_t>> slots;
+  };
+}
+
+#endif
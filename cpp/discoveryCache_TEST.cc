@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "discoveryCache.hh"
+#include "packet.hh"
+#include "gtest/gtest.h"
+
+//////////////////////////////////////////////////
+/// \brief Get a cache path not used by other tests running at once.
+std::string CachePath()
+{
+  return "/tmp/dzmq-cache-test-" + std::to_string(getpid());
+}
+
+//////////////////////////////////////////////////
+TEST(DiscoveryCacheTest, StoreLoad)
+{
+  std::string guid1 = "00000000-0000-0000-0000-000000000001";
+  std::string guid2 = "00000000-0000-0000-0000-000000000002";
+  std::vector<transport::CachedAdv> advs;
+  unlink(CachePath().c_str());
+
+  {
+    transport::DiscoveryCache cache;
+    EXPECT_FALSE(cache.IsOpen());
+    EXPECT_NE(cache.Store(guid1, ADV, "foo", "tcp://1.2.3.4:5"), 0);
+    EXPECT_EQ(cache.Open(CachePath()), 0);
+    EXPECT_TRUE(cache.IsOpen());
+    EXPECT_NE(cache.Open(CachePath()), 0);
+
+    EXPECT_EQ(cache.Store(guid1, ADV, "foo", "tcp://1.2.3.4:5"), 0);
+    EXPECT_EQ(cache.Store(guid1, ADV, "foo", "tcp://1.2.3.4:5"), 0);
+    EXPECT_EQ(cache.Store(guid1, ADV_SVC, "bar", "tcp://1.2.3.4:6"), 0);
+    EXPECT_EQ(cache.Store(guid2, ADV, "foo", "tcp://1.2.3.5:5"), 0);
+    EXPECT_NE(cache.Store(guid2, ADV, std::string(200, 'x'), "tcp://"), 0);
+
+    cache.Load(60, advs);
+    EXPECT_EQ(advs.size(), 3u);
+  }
+
+  // The entries are kept by the file
+  transport::DiscoveryCache cache;
+  EXPECT_EQ(cache.Open(CachePath()), 0);
+  cache.Load(60, advs);
+  ASSERT_EQ(advs.size(), 3u);
+  EXPECT_EQ(advs[1].guid, guid1);
+  EXPECT_EQ(advs[1].type, ADV_SVC);
+  EXPECT_EQ(advs[1].topic, "bar");
+  EXPECT_EQ(advs[1].address, "tcp://1.2.3.4:6");
+
+  // Only the entries of the node removed are gone
+  cache.Remove(guid1);
+  cache.Load(60, advs);
+  ASSERT_EQ(advs.size(), 1u);
+  EXPECT_EQ(advs[0].guid, guid2);
+
+  unlink(CachePath().c_str());
+}
+
+//////////////////////////////////////////////////
+TEST(DiscoveryCacheTest, Aging)
+{
+  std::string guid1 = "00000000-0000-0000-0000-000000000001";
+  std::vector<transport::CachedAdv> advs;
+  unlink(CachePath().c_str());
+
+  transport::DiscoveryCache cache;
+  EXPECT_EQ(cache.Open(CachePath()), 0);
+  EXPECT_EQ(cache.Store(guid1, ADV, "foo", "tcp://1.2.3.4:5"), 0);
+  sleep(2);
+  cache.Load(1, advs);
+  EXPECT_TRUE(advs.empty());
+
+  // A confirmed entry is fresh again
+  cache.Touch(guid1);
+  cache.Load(1, advs);
+  EXPECT_EQ(advs.size(), 1u);
+
+  // The oldest entry is replaced when the cache is full
+  sleep(1);
+  for (uint32_t i = 0; i < transport::DiscoveryCache::Capacity; ++i)
+  {
+    EXPECT_EQ(cache.Store(guid1, ADV, "topic" + std::to_string(i),
+                          "tcp://1.2.3.4:5"), 0);
+  }
+  cache.Load(60, advs);
+  EXPECT_EQ(advs.size(), transport::DiscoveryCache::Capacity);
+  for (auto &adv : advs)
+    EXPECT_NE(adv.topic, "foo");
+
+  unlink(CachePath().c_str());
+}
+
+//////////////////////////////////////////////////
+TEST(DiscoveryCacheTest, InvalidFile)
+{
+  std::vector<transport::CachedAdv> advs;
+  std::string path = CachePath();
+  FILE *file = fopen(path.c_str(), "w");
+  ASSERT_TRUE(file != nullptr);
+  fputs("garbage", file);
+  fclose(file);
+
+  // The file is emptied
+  transport::DiscoveryCache cache;
+  EXPECT_EQ(cache.Open(path), 0);
+  cache.Load(60, advs);
+  EXPECT_TRUE(advs.empty());
+
+  unlink(path.c_str());
+}
+
+//////////////////////////////////////////////////
+TEST(DiscoveryCacheTest, UnterminatedEntry)
+{
+  std::string guid1 = "00000000-0000-0000-0000-000000000001";
+  std::vector<transport::CachedAdv> advs;
+  std::string path = CachePath();
+  unlink(path.c_str());
+
+  transport::DiscoveryCache cache;
+  EXPECT_EQ(cache.Open(path), 0);
+  EXPECT_EQ(cache.Store(guid1, ADV, "foo", "tcp://1.2.3.4:5"), 0);
+
+  // Only the owner can access the file
+  struct stat st;
+  ASSERT_EQ(stat(path.c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 0777, 0600u);
+
+  // Overwrite the GUID of the first entry, after the header of the file
+  // and the time and type of the entry, without a terminator
+  FILE *file = fopen(path.c_str(), "r+");
+  ASSERT_TRUE(file != nullptr);
+  ASSERT_EQ(fseek(file, 64 + 8 + 1, SEEK_SET), 0);
+  fputs(std::string(37, 'x').c_str(), file);
+  fclose(file);
+
+  cache.Load(60, advs);
+  EXPECT_TRUE(advs.empty());
+
+  unlink(path.c_str());
+}
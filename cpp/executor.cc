@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include "executor.hh"
+
+/// \brief Maximum number of tasks of a strand executed by a job before it is
+/// queued again, so a busy strand cannot monopolize a worker.
+static const int StrandBatch = 64;
+
+/// \brief Number of shards of the strands.
+static const size_t StrandShards = 16;
+
+/// \brief Pool that owns the current thread (if any).
+static thread_local const transport::ThreadPoolExecutor *currentPool = nullptr;
+
+/// \brief Index of the current thread in its pool.
+static thread_local unsigned int currentWorker = 0;
+
+//////////////////////////////////////////////////
+transport::ThreadPoolExecutor::ThreadPoolExecutor(unsigned int _numThreads)
+  : queuedJobs(0),
+    pendingTasks(0),
+    nextWorker(0),
+    stop(false)
+{
+  if (_numThreads == 0)
+    _numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  for (unsigned int i = 0; i < _numThreads; ++i)
+    this->workers.push_back(new Worker());
+
+  for (size_t i = 0; i < StrandShards; ++i)
+    this->shards.push_back(new Shard());
+
+  for (unsigned int i = 0; i < _numThreads; ++i)
+    this->threads.push_back(std::thread(&ThreadPoolExecutor::Run, this, i));
+}
+
+//////////////////////////////////////////////////
+transport::ThreadPoolExecutor::~ThreadPoolExecutor()
+{
+  this->Wait();
+
+  {
+    std::lock_guard<std::mutex> lock(this->stateMutex);
+    this->stop = true;
+  }
+  this->jobsCv.notify_all();
+
+  for (auto &thread : this->threads)
+    thread.join();
+
+  for (auto worker : this->workers)
+    delete worker;
+
+  for (auto shard : this->shards)
+  {
+    for (auto strand : shard->strands)
+      delete strand.second;
+    delete shard;
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::ThreadPoolExecutor::Post(const std::string &_key,
+                                         Task &&_task)
+{
+  this->pendingTasks.fetch_add(1, std::memory_order_relaxed);
+
+  Shard *shard =
+    this->shards[std::hash<std::string>()(_key) % this->shards.size()];
+  Strand *strand;
+  bool schedule = false;
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    Strand *&slot = shard->strands[_key];
+    if (!slot)
+    {
+      slot = new Strand();
+      slot->key = _key;
+      slot->shard = shard;
+    }
+    strand = slot;
+
+    strand->tasks.push_back(std::move(_task));
+
+    // Only one job per strand, so its tasks never run concurrently
+    if (!strand->scheduled)
+    {
+      strand->scheduled = true;
+      schedule = true;
+    }
+  }
+
+  if (schedule)
+    this->Schedule(strand);
+}
+
+//////////////////////////////////////////////////
+void transport::ThreadPoolExecutor::Wait()
+{
+  std::unique_lock<std::mutex> lock(this->stateMutex);
+  this->idleCv.wait(lock, [this]() {return this->pendingTasks.load() == 0;});
+}
+
+//////////////////////////////////////////////////
+unsigned int transport::ThreadPoolExecutor::GetNumThreads() const
+{
+  return this->threads.size();
+}
+
+//////////////////////////////////////////////////
+void transport::ThreadPoolExecutor::Run(unsigned int _index)
+{
+  currentPool = this;
+  currentWorker = _index;
+
+  while (true)
+  {
+    Strand *strand = this->NextJob(_index);
+    if (strand)
+    {
+      this->RunStrand(strand);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(this->stateMutex);
+    this->jobsCv.wait(lock, [this]()
+      {return this->stop || this->queuedJobs > 0;});
+
+    if (this->stop && this->queuedJobs == 0)
+      return;
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::ThreadPoolExecutor::Schedule(Strand *_strand)
+{
+  // Jobs created by a worker stay in its queue. The rest are distributed in
+  // round robin.
+  unsigned int index;
+  if (currentPool == this)
+    index = currentWorker;
+  else
+    index = this->nextWorker++ % this->workers.size();
+
+  {
+    std::lock_guard<std::mutex> lock(this->workers[index]->mutex);
+    this->workers[index]->jobs.push_back(_strand);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(this->stateMutex);
+    ++this->queuedJobs;
+  }
+  this->jobsCv.notify_one();
+}
+
+//////////////////////////////////////////////////
+transport::ThreadPoolExecutor::Strand *
+  transport::ThreadPoolExecutor::NextJob(unsigned int _index)
+{
+  Strand *strand = nullptr;
+  size_t numWorkers = this->workers.size();
+
+  // Own queue first, then steal from the other workers
+  for (size_t i = 0; i < numWorkers && !strand; ++i)
+  {
+    Worker *worker = this->workers[(_index + i) % numWorkers];
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (worker->jobs.empty())
+      continue;
+
+    if (i == 0)
+    {
+      strand = worker->jobs.front();
+      worker->jobs.pop_front();
+    }
+    else
+    {
+      strand = worker->jobs.back();
+      worker->jobs.pop_back();
+    }
+  }
+
+  if (strand)
+  {
+    std::lock_guard<std::mutex> lock(this->stateMutex);
+    --this->queuedJobs;
+  }
+
+  return strand;
+}
+
+//////////////////////////////////////////////////
+void transport::ThreadPoolExecutor::RunStrand(Strand *_strand)
+{
+  std::mutex &mutex = _strand->shard->mutex;
+  for (int i = 0; i < StrandBatch; ++i)
+  {
+    Task task;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (this->ReleaseStrand(_strand))
+        return;
+
+      task = std::move(_strand->tasks.front());
+      _strand->tasks.pop_front();
+    }
+
+    this->RunTask(task);
+
+    if (this->pendingTasks.fetch_sub(1) == 1)
+    {
+      std::lock_guard<std::mutex> lock(this->stateMutex);
+      this->idleCv.notify_all();
+    }
+  }
+
+  // Let the other strands progress before running more tasks of this one
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (this->ReleaseStrand(_strand))
+      return;
+  }
+
+  this->Schedule(_strand);
+}
+
+//////////////////////////////////////////////////
+void transport::ThreadPoolExecutor::RunTask(Task &_task)
+{
+  try
+  {
+    _task();
+  }
+  catch(const std::exception &e)
+  {
+    std::cerr << "Executor task failed: " << e.what() << std::endl;
+  }
+  catch(...)
+  {
+    std::cerr << "Executor task failed with an unknown exception\n";
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::ThreadPoolExecutor::ReleaseStrand(Strand *_strand)
+{
+  if (!_strand->tasks.empty())
+    return false;
+
+  _strand->shard->strands.erase(_strand->key);
+  delete _strand;
+  return true;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#ifndef __EXECUTOR_HH_INCLUDED__
+#define __EXECUTOR_HH_INCLUDED__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace transport
+{
+  /// \brief Interface used by a Node to execute the user callbacks.
+  class Executor
+  {
+    /// \brief Task executed by the executor.
+    public: typedef std::function<void()> Task;
+
+    /// \brief Destructor.
+    public: virtual ~Executor() {}
+
+    /// \brief Schedule a task. Tasks posted with the same key are executed
+    /// one at a time and in the order they were posted (strand semantics).
+    /// Tasks with different keys can run in parallel.
+    /// \param[in] _key Ordering key (e.g., the topic name).
+    /// \param[in] _task Task to execute.
+    public: virtual void Post(const std::string &_key, Task &&_task) = 0;
+
+    /// \brief Block until every task posted has been executed.
+    public: virtual void Wait() = 0;
+  };
+
+  /// \brief Executor with a fixed pool of worker threads. Every worker owns a
+  /// queue of jobs and steals from the other workers when its queue is empty.
+  /// A job executes the pending tasks of one strand.
+  class ThreadPoolExecutor : public Executor
+  {
+    /// \brief Constructor.
+    /// \param[in] _numThreads Number of worker threads. 0 creates one worker
+    /// per hardware thread.
+    public: explicit ThreadPoolExecutor(unsigned int _numThreads = 0);
+
+    /// \brief Destructor. Executes the pending tasks and joins the workers.
+    public: virtual ~ThreadPoolExecutor();
+
+    // Documentation inherited.
+    public: virtual void Post(const std::string &_key, Task &&_task);
+
+    // Documentation inherited.
+    public: virtual void Wait();
+
+    /// \brief Get the number of worker threads.
+    /// \return Number of workers.
+    public: unsigned int GetNumThreads() const;
+
+    /// \brief Strands whose keys have the same hash, protected by their own
+    /// mutex so the posts of unrelated keys do not contend.
+    private: struct Shard;
+
+    /// \brief Tasks sharing an ordering key.
+    private: struct Strand
+    {
+      /// \brief Ordering key.
+      std::string key;
+
+      /// \brief Shard that owns the strand.
+      Shard *shard = nullptr;
+
+      /// \brief Tasks waiting to be executed.
+      std::deque<Task> tasks;
+
+      /// \brief true while a job of the strand is queued or running.
+      bool scheduled = false;
+    };
+
+    // Documented above.
+    private: struct Shard
+    {
+      /// \brief Protects the strands and their tasks.
+      std::mutex mutex;
+
+      /// \brief Strands indexed by key. A strand is removed when it runs
+      /// out of tasks, so no job references it.
+      std::unordered_map<std::string, Strand*> strands;
+    };
+
+    /// \brief Queue of jobs owned by a worker.
+    private: struct Worker
+    {
+      /// \brief Protects the jobs.
+      std::mutex mutex;
+
+      /// \brief Strands waiting for a worker. The owner pops from the front
+      /// and the thieves steal from the back.
+      std::deque<Strand*> jobs;
+    };
+
+    /// \brief Main loop of a worker thread.
+    /// \param[in] _index Index of the worker.
+    private: void Run(unsigned int _index);
+
+    /// \brief Queue a strand that has pending tasks.
+    /// \param[in] _strand Strand to schedule.
+    private: void Schedule(Strand *_strand);
+
+    /// \brief Get the next job, from the worker's queue or stolen from
+    /// another worker.
+    /// \param[in] _index Index of the worker.
+    /// \return The strand to run or nullptr if there are no jobs.
+    private: Strand *NextJob(unsigned int _index);
+
+    /// \brief Execute a batch of tasks of a strand.
+    /// \param[in] _strand Strand to run.
+    private: void RunStrand(Strand *_strand);
+
+    /// \brief Execute a task. The exceptions are reported and do not stop
+    /// the worker.
+    /// \param[in] _task Task to execute.
+    private: void RunTask(Task &_task);
+
+    /// \brief Remove a strand if it has no tasks left. The caller must hold
+    /// the mutex of its shard.
+    /// \param[in] _strand Strand to check.
+    /// \return true if the strand was removed.
+    private: bool ReleaseStrand(Strand *_strand);
+
+    /// \brief Worker queues.
+    private: std::vector<Worker*> workers;
+
+    /// \brief Worker threads.
+    private: std::vector<std::thread> threads;
+
+    /// \brief Strands, distributed by the hash of their keys.
+    private: std::vector<Shard*> shards;
+
+    /// \brief Protects the sleeping and idle state.
+    private: std::mutex stateMutex;
+
+    /// \brief Wakes up the sleeping workers.
+    private: std::condition_variable jobsCv;
+
+    /// \brief Notifies that all the tasks were executed.
+    private: std::condition_variable idleCv;
+
+    /// \brief Number of jobs queued and not yet taken by a worker.
+    private: size_t queuedJobs;
+
+    /// \brief Number of tasks posted and not yet executed. The stateMutex is
+    /// only taken when it drops to 0, to notify Wait().
+    private: std::atomic<size_t> pendingTasks;
+
+    /// \brief Worker that receives the next job posted from outside the pool.
+    private: std::atomic<unsigned int> nextWorker;
+
+    /// \brief Tells the workers to exit.
+    private: bool stop;
+  };
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "executor.hh"
+#include "gtest/gtest.h"
+
+//////////////////////////////////////////////////
+TEST(ExecutorTest, StrandOrder)
+{
+  const int numKeys = 8;
+  const int numTasks = 1000;
+  std::vector<std::vector<int>> results(numKeys);
+
+  transport::ThreadPoolExecutor executor(4);
+  EXPECT_EQ(executor.GetNumThreads(), 4u);
+
+  for (int i = 0; i < numTasks; ++i)
+  {
+    for (int k = 0; k < numKeys; ++k)
+    {
+      executor.Post(std::to_string(k), [&results, k, i]()
+      {
+        results[k].push_back(i);
+      });
+    }
+  }
+  executor.Wait();
+
+  // The tasks of every key are executed in order
+  for (int k = 0; k < numKeys; ++k)
+  {
+    ASSERT_EQ(results[k].size(), static_cast<size_t>(numTasks));
+    for (int i = 0; i < numTasks; ++i)
+      EXPECT_EQ(results[k][i], i);
+  }
+}
+
+//////////////////////////////////////////////////
+TEST(ExecutorTest, StrandExclusive)
+{
+  std::atomic<int> running(0);
+  std::atomic<int> maxRunning(0);
+
+  transport::ThreadPoolExecutor executor(4);
+
+  // Tasks with the same key never run at the same time
+  for (int i = 0; i < 100; ++i)
+  {
+    executor.Post("key", [&running, &maxRunning]()
+    {
+      int now = ++running;
+      if (now > maxRunning)
+        maxRunning = now;
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      --running;
+    });
+  }
+  executor.Wait();
+
+  EXPECT_EQ(maxRunning, 1);
+}
+
+//////////////////////////////////////////////////
+TEST(ExecutorTest, Parallel)
+{
+  std::atomic<int> running(0);
+  std::atomic<int> maxRunning(0);
+
+  transport::ThreadPoolExecutor executor(2);
+
+  // Tasks with different keys can run at the same time
+  for (int k = 0; k < 2; ++k)
+  {
+    executor.Post(std::to_string(k), [&running, &maxRunning]()
+    {
+      int now = ++running;
+      if (now > maxRunning)
+        maxRunning = now;
+      // Wait for the other task to start
+      for (int i = 0; i < 1000 && running < 2; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      --running;
+    });
+  }
+  executor.Wait();
+
+  EXPECT_EQ(maxRunning, 2);
+}
+
+//////////////////////////////////////////////////
+TEST(ExecutorTest, NestedPost)
+{
+  std::atomic<int> counter(0);
+
+  // Tasks posted from a worker are executed before Wait() returns
+  {
+    transport::ThreadPoolExecutor executor(3);
+    for (int i = 0; i < 10; ++i)
+    {
+      executor.Post(std::to_string(i), [&executor, &counter, i]()
+      {
+        for (int j = 0; j < 10; ++j)
+          executor.Post(std::to_string(i * 10 + j), [&counter]() {++counter;});
+      });
+    }
+    executor.Wait();
+    EXPECT_EQ(counter, 100);
+  }
+}
+
+//////////////////////////////////////////////////
+TEST(ExecutorTest, ThrowingTask)
+{
+  transport::ThreadPoolExecutor executor(2);
+  std::atomic<int> counter(0);
+
+  // A task that throws does not stop its strand nor block Wait()
+  executor.Post("key", []() {throw std::runtime_error("failure");});
+  executor.Post("key", [&counter]() {++counter;});
+  executor.Post("other", []() {throw 1;});
+  executor.Wait();
+  EXPECT_EQ(counter, 1);
+
+  executor.Post("key", [&counter]() {++counter;});
+  executor.Wait();
+  EXPECT_EQ(counter, 2);
+}
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <uuid/uuid.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "discZmq.hh"
+#include "hostAgent.hh"
+#include "packet.hh"
+#include "sockets/socket.hh"
+#include "zmq/zmq.hpp"
+
+//////////////////////////////////////////////////
+transport::HostAgent::HostAgent(const std::string &_endpoint,
+                                unsigned short _port,
+                                const std::string &_group, bool _verbose,
+                                int _ttl, const std::string &_iface)
+  : Registry(_endpoint, _verbose),
+    bcastSock(nullptr),
+    ucastSock(nullptr),
+    bcastAddr("255.255.255.255"),
+    multicastIface(_iface),
+    bcastPort(_port),
+    heartbeatInterval(DefaultHeartbeatInterval)
+{
+  try
+  {
+    // The subscriptions are answered by unicast to an ephemeral port
+    this->ucastSock = new UDPSocket("0.0.0.0", 0);
+    if (!_group.empty())
+    {
+      this->bcastSock = new UDPSocket(_group, this->bcastPort);
+      this->bcastSock->setMulticastTTL(_ttl);
+      this->ucastSock->setMulticastTTL(_ttl);
+      if (!_iface.empty())
+      {
+        this->bcastSock->setMulticastInterface(_iface);
+        this->ucastSock->setMulticastInterface(_iface);
+      }
+      this->bcastSock->joinGroup(_group, _iface);
+      this->bcastAddr = _group;
+    }
+    else
+      this->bcastSock = new UDPSocket(this->bcastPort);
+  }
+  catch(const SocketException &e)
+  {
+    std::cerr << "Error creating the discovery sockets: " << e.what()
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (this->verbose)
+  {
+    std::cout << "Discovery at: [" << this->bcastAddr << ":"
+              << this->bcastPort << "], replies at port "
+              << this->ucastSock->getLocalPort() << "\n";
+  }
+}
+
+//////////////////////////////////////////////////
+transport::HostAgent::~HostAgent()
+{
+  // The local nodes are gone for the network too
+  for (auto &node : this->nodes)
+  {
+    if (!node.second.remote)
+      this->SendDiscoveryHeader(node.second.guid, BYE, "", this->bcastSock);
+  }
+
+  if (this->bcastAddr != "255.255.255.255")
+  {
+    try
+    {
+      this->bcastSock->leaveGroup(this->bcastAddr, this->multicastIface);
+    }
+    catch(const SocketException &e)
+    {
+      std::cerr << "Error leaving the multicast group [" << this->bcastAddr
+                << "]: " << e.what() << "\n";
+    }
+  }
+  delete this->bcastSock;
+  delete this->ucastSock;
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::SpinOnce(int _timeout)
+{
+  zmq::pollitem_t items[] = {
+    { this->socket, 0, ZMQ_POLLIN, 0 },
+    { 0, this->bcastSock->sockDesc, ZMQ_POLLIN, 0 },
+    { 0, this->ucastSock->sockDesc, ZMQ_POLLIN, 0 }
+  };
+  zmq::poll(items, 3, _timeout);
+
+  this->RecvMessages();
+  while (this->RecvDiscoveryMsg(this->bcastSock))
+    continue;
+  while (this->RecvDiscoveryMsg(this->ucastSock))
+    continue;
+
+  this->FlushAdvs();
+  this->SendHeartbeats();
+  this->CheckLeases();
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::SetHeartbeatInterval(int _interval)
+{
+  this->heartbeatInterval = _interval;
+  this->nextHeartbeat = std::chrono::steady_clock::time_point();
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::OnAdv(const std::string &_id, uint8_t _type,
+                                 const std::string &_topic,
+                                 const std::string &_address)
+{
+  // The remote records came from the network
+  if (this->nodes[_id].remote)
+    return;
+
+  // The records registered in the same spin share a batch
+  this->pendingAdvs[_id].insert(std::make_tuple(_type, _topic, _address));
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::OnInterest(const std::string &_id, uint8_t _type,
+                                      const std::string &_topic)
+{
+  if (this->nodes[_id].remote)
+    return;
+
+  this->interestHashes.insert(
+    std::make_pair(std::make_pair(_type, HashTopic(_topic)), _topic));
+
+  // The remote nodes answer to the ephemeral port
+  this->SendDiscoveryHeader(this->guid, _type == ADV ? SUB : SUB_SVC, _topic,
+                            this->ucastSock);
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::OnRemove(const std::string &_id,
+                                    const RegisteredNode &_node)
+{
+  if (_node.remote)
+    return;
+
+  this->pendingAdvs.erase(_id);
+
+  // Forget the interests that no other local node has. The remote nodes
+  // have no interests.
+  for (auto &interest : _node.interests)
+  {
+    if (!this->interestedNodes.count(interest))
+    {
+      this->interestHashes.erase(
+        std::make_pair(interest.first, HashTopic(interest.second)));
+    }
+  }
+
+  if (!_node.advs.empty())
+    this->SendDiscoveryHeader(_node.guid, BYE, "", this->bcastSock);
+}
+
+//////////////////////////////////////////////////
+bool transport::HostAgent::RecvDiscoveryMsg(UDPSocket *_sock)
+{
+  char rcvStr[MaxRcvStr];
+  std::string srcAddr;
+  unsigned short srcPort;
+  int bytes;
+
+  // Check if a datagram is available without blocking
+  zmq::pollitem_t item = { 0, _sock->sockDesc, ZMQ_POLLIN, 0 };
+  if (zmq::poll(&item, 1, 0) == 0)
+    return false;
+
+  try
+  {
+    bytes = _sock->recvFrom(rcvStr, MaxRcvStr, srcAddr, srcPort);
+  }
+  catch(const SocketException &e)
+  {
+    std::cerr << "Exception receiving from the UDP socket: " << e.what()
+              << std::endl;
+    return false;
+  }
+
+  this->DispatchDiscoveryMsg(rcvStr, bytes, srcAddr, srcPort);
+  return true;
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::DispatchDiscoveryMsg(const char *_msg,
+                                                size_t _size,
+                                                const std::string &_srcAddr,
+                                                unsigned short _srcPort)
+{
+  DiscoveryMsgView header;
+  if (!header.Parse(_msg, _size))
+  {
+    std::cerr << "Truncated discovery message\n";
+    return;
+  }
+
+  if (this->IsLocal(header.GetGuid()))
+    return;
+
+  if (this->verbose)
+  {
+    std::cout << "\nReceived discovery update from " << _srcAddr << ": "
+              << _srcPort << " (" << _size << " bytes)" << std::endl;
+    header.Print();
+  }
+
+  // The remote nodes are registered under a name no connection uses
+  std::string id = "udp/" + transport::GetGuidStr(header.GetGuid());
+  auto node = this->nodes.find(id);
+  if (node != this->nodes.end())
+  {
+    node->second.lastSeen = std::chrono::steady_clock::now();
+    if (header.GetType() == HEARTBEAT)
+      node->second.heartbeats = true;
+  }
+
+  std::vector<AdvRecord> records;
+  AdvRecordView record;
+  switch (header.GetType())
+  {
+    case ADV:
+    case ADV_SVC:
+      records.push_back(AdvRecord());
+      records.back().type = header.GetType();
+      records.back().topic = header.GetTopic().ToString();
+      records.back().address = header.GetAddress().ToString();
+      break;
+
+    case ADV_BATCH:
+      while (header.NextRecord(record))
+      {
+        records.push_back(AdvRecord());
+        records.back().type = record.type;
+        records.back().topic = record.topic.ToString();
+        records.back().address = record.address.ToString();
+
+        // The records with the hash only answer our own subscriptions
+        if (records.back().topic.empty() &&
+            !this->ResolveTopicHash(record.type, record.topicHash,
+                                    records.back().topic))
+        {
+          records.pop_back();
+        }
+      }
+      break;
+
+    case SUB:
+      this->AnswerSubscription(ADV, header.GetTopic().ToString(), _srcAddr,
+                               _srcPort);
+      break;
+
+    case SUB_SVC:
+      this->AnswerSubscription(ADV_SVC, header.GetTopic().ToString(),
+                               _srcAddr, _srcPort);
+      break;
+
+    case HEARTBEAT:
+      break;
+
+    case BYE:
+      this->RemoveNode(id);
+      break;
+
+    default:
+      std::cerr << "Unknown message type [" << header.GetType() << "]\n";
+      break;
+  }
+
+  if (records.empty())
+    return;
+
+  RegisteredNode &remote = this->nodes[id];
+  if (!remote.remote)
+  {
+    remote.remote = true;
+    uuid_copy(remote.guid, header.GetGuid());
+  }
+  for (auto &record : records)
+  {
+    if (record.type == ADV || record.type == ADV_SVC)
+      this->AddAdv(id, record.type, record.topic, record.address);
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::HostAgent::IsLocal(const uuid_t &_guid) const
+{
+  if (uuid_compare(_guid, this->guid) == 0)
+    return true;
+
+  for (auto &node : this->nodes)
+  {
+    if (!node.second.remote && uuid_compare(_guid, node.second.guid) == 0)
+      return true;
+  }
+  return false;
+}
+
+//////////////////////////////////////////////////
+bool transport::HostAgent::ResolveTopicHash(uint8_t _type, uint64_t _hash,
+                                            std::string &_topic) const
+{
+  auto it = this->interestHashes.find(std::make_pair(_type, _hash));
+  if (it == this->interestHashes.end())
+    return false;
+
+  _topic = it->second;
+  return true;
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::AnswerSubscription(uint8_t _type,
+                                              const std::string &_topic,
+                                              const std::string &_addr,
+                                              unsigned short _port)
+{
+  // A subscription sent from the discovery port is answered by broadcast,
+  // as the nodes do
+  std::string addr = _addr;
+  if (_port == this->bcastPort)
+    addr = this->bcastAddr;
+
+  for (auto &node : this->nodes)
+  {
+    if (node.second.remote)
+      continue;
+
+    std::set<std::tuple<uint8_t, std::string, std::string>> advs;
+    for (auto &adv : node.second.advs)
+    {
+      if (std::get<0>(adv) == _type && std::get<1>(adv) == _topic)
+        advs.insert(adv);
+    }
+    this->SendAdvBatches(node.second, advs, FLAG_WIRE_V2,
+      [this, &addr, _port](const char *_msg, size_t _size)
+      {
+        this->SendTo(_msg, _size, this->bcastSock, addr, _port);
+      });
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::FlushAdvs()
+{
+  for (auto &pending : this->pendingAdvs)
+  {
+    this->SendAdvBatches(this->nodes[pending.first], pending.second,
+      FLAG_WIRE_V2, [this](const char *_msg, size_t _size)
+      {
+        this->SendTo(_msg, _size, this->bcastSock, this->bcastAddr,
+                     this->bcastPort);
+      });
+  }
+  this->pendingAdvs.clear();
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::SendHeartbeats()
+{
+  auto now = std::chrono::steady_clock::now();
+  if (now < this->nextHeartbeat)
+    return;
+
+  this->nextHeartbeat = now +
+    std::chrono::milliseconds(this->heartbeatInterval);
+
+  // Only the nodes with records are known by the network
+  for (auto &node : this->nodes)
+  {
+    if (!node.second.remote && !node.second.advs.empty())
+    {
+      this->SendDiscoveryHeader(node.second.guid, HEARTBEAT, "",
+                                this->bcastSock);
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::SendDiscoveryHeader(const uuid_t &_guid,
+                                               uint8_t _type,
+                                               const std::string &_topic,
+                                               UDPSocket *_sock)
+{
+  // The agent decodes the compact encoding
+  Header header(TRNSP_VERSION, _guid, _topic, _type, FLAG_WIRE_V2);
+  std::vector<char> buffer(header.GetHeaderLength());
+  header.Pack(&buffer[0]);
+  this->SendTo(&buffer[0], buffer.size(), _sock, this->bcastAddr,
+               this->bcastPort);
+}
+
+//////////////////////////////////////////////////
+void transport::HostAgent::SendTo(const char *_msg, size_t _size,
+                                  UDPSocket *_sock, const std::string &_addr,
+                                  unsigned short _port)
+{
+  try
+  {
+    _sock->sendTo(_msg, _size, _addr, _port);
+  }
+  catch(const SocketException &e)
+  {
+    std::cerr << "Exception sending a discovery message: " << e.what()
+              << std::endl;
+  }
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#ifndef __HOST_AGENT_HH_INCLUDED__
+#define __HOST_AGENT_HH_INCLUDED__
+
+#include <uuid/uuid.h>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include "registry.hh"
+#include "sockets/socket.hh"
+
+namespace transport
+{
+  /// \brief Default endpoint where the local nodes reach the host agent.
+  const std::string HostAgentDefaultEndpoint = "ipc:///tmp/dzmq-agent";
+
+  /// \brief Discovery agent shared by the nodes of a host. The nodes talk to
+  /// the agent as if it were a registry (DZMQ_HOST_AGENT), usually over an
+  /// ipc socket. The agent owns the UDP discovery sockets and keeps the
+  /// merged table of local and remote records: the local records are
+  /// advertised on the network with the GUID of their node, and the remote
+  /// records are only forwarded to the local nodes interested in them.
+  class HostAgent : public Registry
+  {
+    /// \brief Constructor.
+    /// \param[in] _endpoint ZMQ endpoint where the local nodes connect.
+    /// \param[in] _port UDP port of the network discovery.
+    /// \param[in] _group Multicast group used instead of broadcast, or empty.
+    /// \param[in] _verbose true for enabling verbose mode.
+    /// \param[in] _ttl TTL of the multicast discovery messages.
+    /// \param[in] _iface IPv4 address of the interface used for multicast,
+    /// or empty to let the system choose.
+    public: HostAgent(const std::string &_endpoint, unsigned short _port,
+                      const std::string &_group, bool _verbose,
+                      int _ttl, const std::string &_iface);
+
+    /// \brief Destructor.
+    public: virtual ~HostAgent();
+
+    // Documentation inherited.
+    public: virtual void SpinOnce(int _timeout = 250);
+
+    /// \brief Set the interval between the heartbeats sent on behalf of the
+    /// local nodes.
+    /// \param[in] _interval Interval (msecs).
+    public: void SetHeartbeatInterval(int _interval);
+
+    // Documentation inherited.
+    protected: virtual void OnAdv(const std::string &_id, uint8_t _type,
+                                  const std::string &_topic,
+                                  const std::string &_address);
+
+    // Documentation inherited.
+    protected: virtual void OnInterest(const std::string &_id, uint8_t _type,
+                                       const std::string &_topic);
+
+    // Documentation inherited.
+    protected: virtual void OnRemove(const std::string &_id,
+                                     const RegisteredNode &_node);
+
+    /// \brief Process a datagram waiting in a UDP socket, if any.
+    /// \param[in] _sock Socket to read.
+    /// \return true if a datagram was received.
+    private: bool RecvDiscoveryMsg(UDPSocket *_sock);
+
+    /// \brief Process a discovery message of the network.
+    /// \param[in] _msg Message.
+    /// \param[in] _size Size of the message.
+    /// \param[in] _srcAddr Address of the sender.
+    /// \param[in] _srcPort Port of the sender.
+    private: void DispatchDiscoveryMsg(const char *_msg, size_t _size,
+                                       const std::string &_srcAddr,
+                                       unsigned short _srcPort);
+
+    /// \brief Is a GUID of a local node or of the agent? The agent receives
+    /// its own broadcasts back.
+    /// \param[in] _guid GUID.
+    /// \return true if the GUID is local.
+    private: bool IsLocal(const uuid_t &_guid) const;
+
+    /// \brief Find the topic of a record that only carries its hash, among
+    /// the interests of the local nodes.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _hash Hash of the topic.
+    /// \param[out] _topic Topic found.
+    /// \return true if the topic was found.
+    private: bool ResolveTopicHash(uint8_t _type, uint64_t _hash,
+                                   std::string &_topic) const;
+
+    /// \brief Answer a subscription of the network with the local records.
+    /// \param[in] _type Type of the records requested (ADV or ADV_SVC).
+    /// \param[in] _topic Topic requested.
+    /// \param[in] _addr Destination address.
+    /// \param[in] _port Destination port.
+    private: void AnswerSubscription(uint8_t _type, const std::string &_topic,
+                                     const std::string &_addr,
+                                     unsigned short _port);
+
+    /// \brief Advertise the records queued of the local nodes.
+    private: void FlushAdvs();
+
+    /// \brief Send the heartbeats of the local nodes when they are due.
+    private: void SendHeartbeats();
+
+    /// \brief Send a message without body.
+    /// \param[in] _guid GUID of the sender.
+    /// \param[in] _type Type of the message.
+    /// \param[in] _topic Topic of the message.
+    /// \param[in] _sock Socket used.
+    private: void SendDiscoveryHeader(const uuid_t &_guid, uint8_t _type,
+                                      const std::string &_topic,
+                                      UDPSocket *_sock);
+
+    /// \brief Send a datagram.
+    /// \param[in] _msg Message.
+    /// \param[in] _size Size of the message.
+    /// \param[in] _sock Socket used.
+    /// \param[in] _addr Destination address.
+    /// \param[in] _port Destination port.
+    private: void SendTo(const char *_msg, size_t _size, UDPSocket *_sock,
+                         const std::string &_addr, unsigned short _port);
+
+    /// \brief UDP socket of the discovery port.
+    private: UDPSocket *bcastSock;
+
+    /// \brief UDP socket with an ephemeral port, where the subscriptions are
+    /// sent and answered.
+    private: UDPSocket *ucastSock;
+
+    /// \brief Broadcast or multicast address of the discovery.
+    private: std::string bcastAddr;
+
+    /// \brief Interface that joined the multicast group, or empty if the
+    /// system chose it.
+    private: std::string multicastIface;
+
+    /// \brief UDP port of the discovery.
+    private: unsigned short bcastPort;
+
+    /// \brief Records of the local nodes waiting to be advertised, by
+    /// routing identity of the node.
+    private: std::map<std::string,
+      std::set<std::tuple<uint8_t, std::string, std::string>>> pendingAdvs;
+
+    /// \brief Topics of the interests of the local nodes, by type and hash,
+    /// to resolve the records that only carry the hash.
+    private: std::map<std::pair<uint8_t, uint64_t>, std::string>
+      interestHashes;
+
+    /// \brief Interval between heartbeats (msecs).
+    private: int heartbeatInterval;
+
+    /// \brief Time of the next heartbeats.
+    private: std::chrono::steady_clock::time_point nextHeartbeat;
+  };
+}
+
+#endif
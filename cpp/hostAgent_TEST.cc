@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <cstdlib>
+#include <map>
+#include <string>
+#include "discZmq.hh"
+#include "hostAgent.hh"
+#include "gtest/gtest.h"
+
+/// \brief Endpoint of the agent used by the tests.
+static const std::string Endpoint = "ipc:///tmp/dzmq-agent-test";
+
+/// \brief Discovery port used by the tests.
+static const unsigned short Port = 11340;
+
+/// \brief Updates received by topic.
+static std::map<std::string, int> counters;
+
+//////////////////////////////////////////////////
+/// \brief Count the updates received.
+void counterCb(const std::string &_topic, const std::string &/*_data*/)
+{
+  ++counters[_topic];
+}
+
+//////////////////////////////////////////////////
+TEST(HostAgentTest, LocalAndRemoteNodes)
+{
+  std::string data = "someData";
+  transport::HostAgent agent(Endpoint, Port, "", false,
+    transport::DefaultMulticastTTL, "");
+  agent.SetHeartbeatInterval(50);
+
+  // The local node finds the agent in the environment
+  setenv("DZMQ_HOST_AGENT", Endpoint.c_str(), 1);
+  transport::Node *local = new transport::Node("", false);
+  unsetenv("DZMQ_HOST_AGENT");
+  local->SetHeartbeatInterval(50);
+
+  // The remote node uses the network discovery
+  setenv("DZMQ_DISCOVERY_PORT", std::to_string(Port).c_str(), 1);
+  transport::Node remote("", false);
+  unsetenv("DZMQ_DISCOVERY_PORT");
+
+  EXPECT_EQ(local->Advertise("foo"), 0);
+  EXPECT_EQ(local->Subscribe("bar", counterCb), 0);
+  EXPECT_EQ(remote.Advertise("bar"), 0);
+  EXPECT_EQ(remote.Subscribe("foo", counterCb), 0);
+
+  for (int i = 0; i < 50 &&
+       (!local->HasPublishers("bar") || !remote.HasPublishers("foo")); ++i)
+  {
+    local->SpinOnce();
+    agent.SpinOnce(10);
+    remote.SpinOnce();
+  }
+  EXPECT_TRUE(local->HasPublishers("bar"));
+  EXPECT_TRUE(remote.HasPublishers("foo"));
+
+  // The data goes straight between the nodes
+  for (int i = 0; i < 20 && (counters["foo"] == 0 || counters["bar"] == 0);
+       ++i)
+  {
+    EXPECT_EQ(local->Publish("foo", data), 0);
+    EXPECT_EQ(remote.Publish("bar", data), 0);
+    s_sleep(10);
+    local->SpinOnce();
+    remote.SpinOnce();
+  }
+  EXPECT_GT(counters["foo"], 0);
+  EXPECT_GT(counters["bar"], 0);
+  EXPECT_EQ(agent.GetNodeCount(), 2u);
+
+  // The agent tells the network that the local node left
+  delete local;
+  for (int i = 0; i < 20 && remote.HasPublishers("foo"); ++i)
+  {
+    agent.SpinOnce(10);
+    remote.SpinOnce();
+  }
+  EXPECT_FALSE(remote.HasPublishers("foo"));
+  EXPECT_EQ(agent.GetNodeCount(), 1u);
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#ifndef __LOCK_FREE_QUEUES_HH_INCLUDED__
+#define __LOCK_FREE_QUEUES_HH_INCLUDED__
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace transport
+{
+  /// \brief Bounded lock-free queue for one producer thread and one consumer
+  /// thread. The elements are stored in a preallocated ring, so pushing and
+  /// popping never allocate.
+  template <typename T>
+  class SpscQueue
+  {
+    /// \brief Constructor.
+    /// \param[in] _capacity Maximum number of elements. It is rounded up to
+    /// the next power of two.
+    public: explicit SpscQueue(size_t _capacity)
+      : head(0), tail(0)
+    {
+      size_t capacity = 1;
+      while (capacity < _capacity)
+        capacity <<= 1;
+
+      this->slots.resize(capacity);
+      this->mask = capacity - 1;
+    }
+
+    /// \brief Insert an element. Only the producer thread can call it.
+    /// \param[in] _item Element to be moved into the queue.
+    /// \return true when success or false if the queue is full.
+    public: bool Push(T &&_item)
+    {
+      size_t t = this->tail.load(std::memory_order_relaxed);
+      if (t - this->head.load(std::memory_order_acquire) == this->slots.size())
+        return false;
+
+      this->slots[t & this->mask] = std::move(_item);
+      this->tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    /// \brief Remove the oldest element. Only the consumer thread can call it.
+    /// \param[out] _item Element removed.
+    /// \return true when success or false if the queue is empty.
+    public: bool Pop(T &_item)
+    {
+      size_t h = this->head.load(std::memory_order_relaxed);
+      if (h == this->tail.load(std::memory_order_acquire))
+        return false;
+
+      _item = std::move(this->slots[h & this->mask]);
+      this->head.store(h + 1, std::memory_order_release);
+      return true;
+    }
+
+    /// \brief Return true if there are no elements in the queue.
+    /// \return true if the queue is empty.
+    public: bool Empty() const
+    {
+      return this->head.load(std::memory_order_acquire) ==
+             this->tail.load(std::memory_order_acquire);
+    }
+
+    /// \brief Return true if no more elements can be inserted.
+    /// \return true if the queue is full.
+    public: bool Full() const
+    {
+      return this->tail.load(std::memory_order_acquire) -
+             this->head.load(std::memory_order_acquire) == this->slots.size();
+    }
+
+    /// \brief Storage of the elements.
+    private: std::vector<T> slots;
+
+    /// \brief Used to map a position to a slot (capacity - 1).
+    private: size_t mask;
+
+    /// \brief Position of the next element to pop. Written by the consumer.
+    private: alignas(64) std::atomic<size_t> head;
+
+    /// \brief Position of the next element to push. Written by the producer.
+    private: alignas(64) std::atomic<size_t> tail;
+  };
+
+  /// \brief Unbounded lock-free queue for many producer threads and one
+  /// consumer thread (Vyukov's intrusive MPSC design). Every push allocates a
+  /// node, so it is meant for control messages, not for the data path.
+  template <typename T>
+  class MpscQueue
+  {
+    /// \brief Constructor.
+    public: MpscQueue()
+    {
+      Node *stub = new Node();
+      this->head.store(stub, std::memory_order_relaxed);
+      this->tail = stub;
+    }
+
+    /// \brief Destructor.
+    public: virtual ~MpscQueue()
+    {
+      T item;
+      while (this->Pop(item))
+        ;
+
+      delete this->tail;
+    }
+
+    /// \brief Insert an element. Any thread can call it.
+    /// \param[in] _item Element to be moved into the queue.
+    public: void Push(T &&_item)
+    {
+      Node *node = new Node();
+      node->value = std::move(_item);
+
+      Node *prev = this->head.exchange(node, std::memory_order_acq_rel);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+    /// \brief Remove the oldest element. Only the consumer thread can call it.
+    /// \param[out] _item Element removed.
+    /// \return true when success or false if the queue is empty.
+    public: bool Pop(T &_item)
+    {
+      Node *next = this->tail->next.load(std::memory_order_acquire);
+      if (!next)
+        return false;
+
+      _item = std::move(next->value);
+      delete this->tail;
+      this->tail = next;
+      return true;
+    }
+
+    /// \brief Element of the linked list.
+    private: struct Node
+    {
+      Node() : next(nullptr) {}
+      std::atomic<Node*> next;
+      T value;
+    };
+
+    /// \brief Last element inserted. Shared by the producers.
+    private: std::atomic<Node*> head;
+
+    /// \brief Node before the oldest element. Owned by the consumer.
+    private: Node *tail;
+  };
+}
+
+#endif
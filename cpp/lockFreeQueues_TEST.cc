@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <string>
+#include <thread>
+#include <vector>
+#include "lockFreeQueues.hh"
+#include "gtest/gtest.h"
+
+//////////////////////////////////////////////////
+TEST(LockFreeQueuesTest, SpscBasicAPI)
+{
+  // The capacity is rounded up to a power of two
+  transport::SpscQueue<std::string> queue(3);
+  std::string item;
+
+  EXPECT_TRUE(queue.Empty());
+  EXPECT_FALSE(queue.Full());
+  EXPECT_FALSE(queue.Pop(item));
+
+  for (int i = 0; i < 4; ++i)
+    EXPECT_TRUE(queue.Push(std::to_string(i)));
+
+  EXPECT_TRUE(queue.Full());
+  EXPECT_FALSE(queue.Push("overflow"));
+
+  // The elements are returned in order
+  for (int i = 0; i < 4; ++i)
+  {
+    EXPECT_TRUE(queue.Pop(item));
+    EXPECT_EQ(item, std::to_string(i));
+  }
+  EXPECT_TRUE(queue.Empty());
+}
+
+//////////////////////////////////////////////////
+TEST(LockFreeQueuesTest, SpscThreads)
+{
+  const int numItems = 100000;
+  transport::SpscQueue<int> queue(64);
+
+  std::thread producer([&queue]()
+  {
+    for (int i = 0; i < numItems; ++i)
+    {
+      while (!queue.Push(int(i)))
+        std::this_thread::yield();
+    }
+  });
+
+  // Every element is received once and in order
+  int expected = 0;
+  int item;
+  while (expected < numItems)
+  {
+    if (queue.Pop(item))
+    {
+      EXPECT_EQ(item, expected);
+      ++expected;
+    }
+  }
+
+  producer.join();
+  EXPECT_TRUE(queue.Empty());
+}
+
+//////////////////////////////////////////////////
+TEST(LockFreeQueuesTest, MpscThreads)
+{
+  const int numProducers = 4;
+  const int numItems = 10000;
+  transport::MpscQueue<int> queue;
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < numProducers; ++p)
+  {
+    producers.push_back(std::thread([&queue, p]()
+    {
+      for (int i = 0; i < numItems; ++i)
+        queue.Push(p * numItems + i);
+    }));
+  }
+
+  // The elements of every producer are received in order
+  std::vector<int> next(numProducers, 0);
+  int received = 0;
+  int item;
+  while (received < numProducers * numItems)
+  {
+    if (queue.Pop(item))
+    {
+      int p = item / numItems;
+      EXPECT_EQ(item % numItems, next[p]);
+      ++next[p];
+      ++received;
+    }
+  }
+
+  for (auto &producer : producers)
+    producer.join();
+
+  EXPECT_FALSE(queue.Pop(item));
+}
+
+//////////////////////////////////////////////////
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
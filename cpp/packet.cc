@@ -15,26 +15,209 @@
  *
 */
 
+#include <arpa/inet.h>
+#include <endian.h>
 #include <string.h>
 #include <uuid/uuid.h>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include "packet.hh"
 
+// Compact encoding (TRNSP_VERSION_COMPACT), in network byte order.
+//
+// Header (24 bytes + topic): version (2), type (1), reserved (1),
+// flags (2), topic length (2), GUID (16) and topic.
+//
+// Address (20 bytes): kind (1), family (1), port (2) and IP (16, IPv4 in
+// the first 4 bytes).
+//
+// ADV and ADV_SVC body: address.
+//
+// ADV_BATCH body: number of records (2) and records (32 bytes + topic):
+// type (1), record flags (1), topic length (2), topic hash (8), address
+// and topic. The topic length is 0 in the records with the hash only.
+
+/// \brief Length of the fixed part of a compact header.
+static const size_t CompactHeaderLength = 24;
+
+/// \brief Length of a compact address.
+static const size_t CompactAddressLength = 20;
+
+/// \brief Length of the fixed part of a compact record.
+static const size_t CompactRecordLength = 32;
+
+/// \brief Record flag: the record carries the hash of its topic only.
+static const uint8_t CompactHashOnly = 0x01;
+
+/// \brief Address kind of the tcp:// addresses.
+static const uint8_t AddressKindTcp = 1;
+
+//////////////////////////////////////////////////
+/// \brief Serialize a tcp:// address with a numeric IP in the compact
+/// encoding.
+/// \param[in] _address Address (e.g., "tcp://10.0.0.1:6000").
+/// \param[out] _buffer Buffer of CompactAddressLength bytes.
+/// \return false if the address has no binary form.
+static bool PackAddress(const std::string &_address, char *_buffer)
+{
+  const std::string scheme = "tcp://";
+  if (_address.compare(0, scheme.size(), scheme) != 0)
+    return false;
+
+  // IPv6 addresses are enclosed in brackets
+  size_t colon = _address.rfind(':');
+  if (colon == std::string::npos || colon < scheme.size())
+    return false;
+  std::string host = _address.substr(scheme.size(), colon - scheme.size());
+  uint8_t family = 4;
+  if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+  {
+    host = host.substr(1, host.size() - 2);
+    family = 6;
+  }
+
+  char *end;
+  long port = strtol(_address.c_str() + colon + 1, &end, 10);
+  if (*end != '\0' || port <= 0 || port > 0xFFFF)
+    return false;
+
+  memset(_buffer, 0, CompactAddressLength);
+  if (inet_pton(family == 4 ? AF_INET : AF_INET6, host.c_str(),
+                _buffer + 4) != 1)
+  {
+    return false;
+  }
+
+  uint16_t netPort = htons(static_cast<uint16_t>(port));
+  _buffer[0] = AddressKindTcp;
+  _buffer[1] = family;
+  memcpy(_buffer + 2, &netPort, sizeof(netPort));
+  return true;
+}
+
+//////////////////////////////////////////////////
+/// \brief Format an address of the compact encoding.
+/// \param[in] _buffer Address, CompactAddressLength bytes.
+/// \param[out] _str Text buffer of 64 bytes.
+/// \param[out] _address View of the text.
+/// \return false if the kind or the family are unknown.
+static bool FormatAddress(const char *_buffer, char *_str,
+                          transport::StringView &_address)
+{
+  if (_buffer[0] != AddressKindTcp || (_buffer[1] != 4 && _buffer[1] != 6))
+    return false;
+
+  uint16_t port;
+  memcpy(&port, _buffer + 2, sizeof(port));
+  char ip[INET6_ADDRSTRLEN];
+  bool v4 = _buffer[1] == 4;
+  if (!inet_ntop(v4 ? AF_INET : AF_INET6, _buffer + 4, ip, sizeof(ip)))
+    return false;
+
+  int length = snprintf(_str, 64, v4 ? "tcp://%s:%u" : "tcp://[%s]:%u", ip,
+                        ntohs(port));
+  _address = transport::StringView(_str, length);
+  return true;
+}
+
+//////////////////////////////////////////////////
+/// \brief Write a 16 bit integer in network byte order.
+/// \param[out] _buffer Destination.
+/// \param[in] _value Integer.
+static void WriteNet16(char *_buffer, uint16_t _value)
+{
+  _value = htons(_value);
+  memcpy(_buffer, &_value, sizeof(_value));
+}
+
+//////////////////////////////////////////////////
+/// \brief Read a 16 bit integer in network byte order.
+/// \param[in] _buffer Source.
+/// \return Integer.
+static uint16_t ReadNet16(const char *_buffer)
+{
+  uint16_t value;
+  memcpy(&value, _buffer, sizeof(value));
+  return ntohs(value);
+}
+
 //////////////////////////////////////////////////
 std::string transport::GetGuidStr(const uuid_t &_uuid)
 {
-  char *guid_str = new char[GUID_STR_LEN];
-  for (size_t i = 0; i < sizeof(uuid_t) && i != GUID_STR_LEN; ++i)
+  std::string str;
+  transport::GetGuidStr(_uuid, str);
+  return str;
+}
+
+//////////////////////////////////////////////////
+void transport::GetGuidStr(const uuid_t &_uuid, std::string &_str)
+{
+  char guid_str[GUID_STR_LEN];
+  snprintf(guid_str, GUID_STR_LEN,
+    "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+    _uuid[0], _uuid[1], _uuid[2], _uuid[3],
+    _uuid[4], _uuid[5], _uuid[6], _uuid[7],
+    _uuid[8], _uuid[9], _uuid[10], _uuid[11],
+    _uuid[12], _uuid[13], _uuid[14], _uuid[15]);
+  _str.assign(guid_str);
+}
+
+//////////////////////////////////////////////////
+/// \brief Read an integer of a message, checking the bounds.
+/// \param[in,out] _buffer Position in the message, moved past the integer.
+/// \param[in] _end End of the message.
+/// \param[out] _value Integer read.
+/// \return false if the message is too short.
+template<typename T>
+static bool ReadValue(const char *&_buffer, const char *_end, T &_value)
+{
+  if (static_cast<size_t>(_end - _buffer) < sizeof(T))
+    return false;
+
+  memcpy(&_value, _buffer, sizeof(T));
+  _buffer += sizeof(T);
+  return true;
+}
+
+//////////////////////////////////////////////////
+/// \brief Read a string preceded by its length, checking the bounds.
+/// \param[in,out] _buffer Position in the message, moved past the string.
+/// \param[in] _end End of the message.
+/// \param[out] _str View of the string read.
+/// \return false if the message is too short.
+static bool ReadString(const char *&_buffer, const char *_end,
+                       transport::StringView &_str)
+{
+  uint16_t length;
+  if (!ReadValue(_buffer, _end, length) ||
+      static_cast<size_t>(_end - _buffer) < length)
   {
-    snprintf(guid_str, GUID_STR_LEN,
-      "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-      _uuid[0], _uuid[1], _uuid[2], _uuid[3],
-      _uuid[4], _uuid[5], _uuid[6], _uuid[7],
-      _uuid[8], _uuid[9], _uuid[10], _uuid[11],
-      _uuid[12], _uuid[13], _uuid[14], _uuid[15]);
+    return false;
   }
-  return std::string(guid_str);
+
+  _str = transport::StringView(_buffer, length);
+  _buffer += length;
+  return true;
+}
+
+//////////////////////////////////////////////////
+uint64_t transport::HashTopic(const char *_topic, size_t _size)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < _size; ++i)
+  {
+    hash ^= static_cast<uint8_t>(_topic[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+//////////////////////////////////////////////////
+uint64_t transport::HashTopic(const std::string &_topic)
+{
+  return transport::HashTopic(_topic.data(), _topic.size());
 }
 
 //////////////////////////////////////////////////
@@ -182,12 +365,8 @@ size_t transport::Header::Unpack(const char *_buffer)
   _buffer += sizeof(this->topicLength);
 
   // Read the topic
-  char *topic = new char[this->topicLength + 1];
-  memcpy(topic, _buffer, this->topicLength);
-  topic[this->topicLength] = '\0';
-  this->topic = topic;
+  this->topic.assign(_buffer, this->topicLength);
   _buffer += this->topicLength;
-  delete[] topic;
 
   // Read the message type
   memcpy(&this->type, _buffer, sizeof(this->type));
@@ -201,6 +380,27 @@ size_t transport::Header::Unpack(const char *_buffer)
   return this->GetHeaderLength();
 }
 
+//////////////////////////////////////////////////
+size_t transport::Header::GetCompactLength() const
+{
+  return CompactHeaderLength + this->topic.size();
+}
+
+//////////////////////////////////////////////////
+size_t transport::Header::PackCompact(char *_buffer) const
+{
+  WriteNet16(_buffer, TRNSP_VERSION_COMPACT);
+  _buffer[2] = this->type;
+  _buffer[3] = 0;
+  WriteNet16(_buffer + 4, this->flags);
+  WriteNet16(_buffer + 6, this->topic.size());
+  memcpy(_buffer + 8, this->guid, sizeof(this->guid));
+  memcpy(_buffer + CompactHeaderLength, this->topic.data(),
+         this->topic.size());
+
+  return this->GetCompactLength();
+}
+
 //////////////////////////////////////////////////
 void transport::Header::UpdateHeaderLength()
 {
@@ -299,10 +499,7 @@ size_t transport::AdvMsg::UnpackBody(char *_buffer)
   _buffer += sizeof(this->addressLength);
 
   // Read the address
-  char *address = new char[this->addressLength + 1];
-  memcpy(address, _buffer, this->addressLength);
-  address[this->addressLength] = '\0';
-  this->address = address;
+  this->address.assign(_buffer, this->addressLength);
 
   this->UpdateMsgLength();
 
@@ -315,3 +512,610 @@ void transport::AdvMsg::UpdateMsgLength()
   this->msgLength = this->GetHeader().GetHeaderLength() +
     sizeof(this->addressLength) + this->address.size();
 }
+
+//////////////////////////////////////////////////
+const size_t transport::AdvBatchMsg::DefaultMaxLength;
+
+//////////////////////////////////////////////////
+transport::AdvBatchMsg::AdvBatchMsg()
+  : bodyLength(sizeof(uint16_t)),
+    compactBodyLength(sizeof(uint16_t)),
+    maxLength(DefaultMaxLength)
+{
+}
+
+//////////////////////////////////////////////////
+transport::AdvBatchMsg::AdvBatchMsg(const Header &_header, size_t _maxLength)
+  : header(_header),
+    bodyLength(sizeof(uint16_t)),
+    compactBodyLength(sizeof(uint16_t)),
+    maxLength(_maxLength)
+{
+}
+
+//////////////////////////////////////////////////
+transport::Header& transport::AdvBatchMsg::GetHeader()
+{
+  return this->header;
+}
+
+//////////////////////////////////////////////////
+bool transport::AdvBatchMsg::AddRecord(uint8_t _type,
+                                       const std::string &_topic,
+                                       const std::string &_address)
+{
+  // The message fits in both encodings
+  size_t length = GetRecordLength(_topic, _address);
+  size_t compactLength = CompactRecordLength + _topic.size();
+  if (!this->records.empty() &&
+      (this->GetMsgLength() + length > this->maxLength ||
+       this->GetCompactLength(false) + compactLength > this->maxLength))
+  {
+    return false;
+  }
+
+  AdvRecord record;
+  record.type = _type;
+  record.topic = _topic;
+  record.address = _address;
+  this->records.push_back(record);
+  this->bodyLength += length;
+  this->compactBodyLength += compactLength;
+
+  return true;
+}
+
+//////////////////////////////////////////////////
+const std::vector<transport::AdvRecord> &
+  transport::AdvBatchMsg::GetRecords() const
+{
+  return this->records;
+}
+
+//////////////////////////////////////////////////
+void transport::AdvBatchMsg::Clear()
+{
+  this->records.clear();
+  this->bodyLength = sizeof(uint16_t);
+  this->compactBodyLength = sizeof(uint16_t);
+}
+
+//////////////////////////////////////////////////
+size_t transport::AdvBatchMsg::GetMsgLength()
+{
+  return this->header.GetHeaderLength() + this->bodyLength;
+}
+
+//////////////////////////////////////////////////
+void transport::AdvBatchMsg::PrintBody()
+{
+  std::cout << "\tBody:" << std::endl;
+  std::cout << "\t\tRecords: " << this->records.size() << std::endl;
+  for (auto &record : this->records)
+  {
+    std::cout << "\t\t" << msgTypesStr[record.type] << " [" << record.topic
+              << "][" << record.address << "]" << std::endl;
+  }
+}
+
+//////////////////////////////////////////////////
+size_t transport::AdvBatchMsg::Pack(char *_buffer)
+{
+  if (this->records.empty())
+    return 0;
+
+  this->GetHeader().Pack(_buffer);
+  _buffer += this->GetHeader().GetHeaderLength();
+
+  // Number of records followed by the records: type, topic length, topic,
+  // address length and address.
+  uint16_t numRecords = this->records.size();
+  memcpy(_buffer, &numRecords, sizeof(numRecords));
+  _buffer += sizeof(numRecords);
+
+  for (auto &record : this->records)
+  {
+    uint16_t topicLength = record.topic.size();
+    uint16_t addressLength = record.address.size();
+    memcpy(_buffer, &record.type, sizeof(record.type));
+    _buffer += sizeof(record.type);
+    memcpy(_buffer, &topicLength, sizeof(topicLength));
+    _buffer += sizeof(topicLength);
+    memcpy(_buffer, record.topic.data(), topicLength);
+    _buffer += topicLength;
+    memcpy(_buffer, &addressLength, sizeof(addressLength));
+    _buffer += sizeof(addressLength);
+    memcpy(_buffer, record.address.data(), addressLength);
+    _buffer += addressLength;
+  }
+
+  return this->GetMsgLength();
+}
+
+//////////////////////////////////////////////////
+size_t transport::AdvBatchMsg::UnpackBody(char *_buffer)
+{
+  this->Clear();
+
+  uint16_t numRecords;
+  memcpy(&numRecords, _buffer, sizeof(numRecords));
+  _buffer += sizeof(numRecords);
+
+  for (uint16_t i = 0; i < numRecords; ++i)
+  {
+    AdvRecord record;
+    uint16_t topicLength;
+    uint16_t addressLength;
+    memcpy(&record.type, _buffer, sizeof(record.type));
+    _buffer += sizeof(record.type);
+    memcpy(&topicLength, _buffer, sizeof(topicLength));
+    _buffer += sizeof(topicLength);
+    record.topic.assign(_buffer, topicLength);
+    _buffer += topicLength;
+    memcpy(&addressLength, _buffer, sizeof(addressLength));
+    _buffer += sizeof(addressLength);
+    record.address.assign(_buffer, addressLength);
+    _buffer += addressLength;
+
+    this->bodyLength += GetRecordLength(record.topic, record.address);
+    this->compactBodyLength += CompactRecordLength + record.topic.size();
+    this->records.push_back(record);
+  }
+
+  return this->bodyLength;
+}
+
+//////////////////////////////////////////////////
+size_t transport::AdvBatchMsg::GetCompactLength(bool _hashOnly)
+{
+  size_t length = this->header.GetCompactLength() + this->compactBodyLength;
+  if (_hashOnly)
+  {
+    for (auto &record : this->records)
+      length -= record.topic.size();
+  }
+  return length;
+}
+
+//////////////////////////////////////////////////
+size_t transport::AdvBatchMsg::PackCompact(char *_buffer, bool _hashOnly)
+{
+  if (this->records.empty())
+    return 0;
+
+  char *start = _buffer;
+  _buffer += this->header.PackCompact(_buffer);
+  WriteNet16(_buffer, this->records.size());
+  _buffer += sizeof(uint16_t);
+
+  for (auto &record : this->records)
+  {
+    if (!PackAddress(record.address, _buffer + 12))
+      return 0;
+
+    uint16_t topicLength = _hashOnly ? 0 : record.topic.size();
+    uint64_t hash = htobe64(HashTopic(record.topic));
+    _buffer[0] = record.type;
+    _buffer[1] = _hashOnly ? CompactHashOnly : 0;
+    WriteNet16(_buffer + 2, topicLength);
+    memcpy(_buffer + 4, &hash, sizeof(hash));
+    memcpy(_buffer + CompactRecordLength, record.topic.data(), topicLength);
+    _buffer += CompactRecordLength + topicLength;
+  }
+
+  return _buffer - start;
+}
+
+//////////////////////////////////////////////////
+size_t transport::AdvBatchMsg::GetRecordLength(const std::string &_topic,
+                                               const std::string &_address)
+{
+  return sizeof(uint8_t) + sizeof(uint16_t) + _topic.size() +
+         sizeof(uint16_t) + _address.size();
+}
+
+//////////////////////////////////////////////////
+transport::StringView::StringView()
+  : data(nullptr),
+    size(0)
+{
+}
+
+//////////////////////////////////////////////////
+transport::StringView::StringView(const char *_data, size_t _size)
+  : data(_data),
+    size(_size)
+{
+}
+
+//////////////////////////////////////////////////
+const char *transport::StringView::GetData() const
+{
+  return this->data;
+}
+
+//////////////////////////////////////////////////
+size_t transport::StringView::GetSize() const
+{
+  return this->size;
+}
+
+//////////////////////////////////////////////////
+std::string transport::StringView::ToString() const
+{
+  return std::string(this->data, this->size);
+}
+
+//////////////////////////////////////////////////
+void transport::StringView::AssignTo(std::string &_str) const
+{
+  _str.assign(this->data, this->size);
+}
+
+//////////////////////////////////////////////////
+bool transport::StringView::operator==(const std::string &_str) const
+{
+  return _str.size() == this->size &&
+         _str.compare(0, this->size, this->data, this->size) == 0;
+}
+
+//////////////////////////////////////////////////
+transport::DiscoveryMsgView::DiscoveryMsgView()
+  : version(0),
+    type(0),
+    flags(0),
+    numRecords(0),
+    pendingRecords(0),
+    nextRecord(nullptr),
+    end(nullptr),
+    compact(false)
+{
+  uuid_clear(this->guid);
+  this->addressStr[0] = '\0';
+}
+
+//////////////////////////////////////////////////
+bool transport::DiscoveryMsgView::Parse(const char *_buffer, size_t _size)
+{
+  this->end = _buffer + _size;
+  this->address = StringView();
+  this->numRecords = 0;
+  this->pendingRecords = 0;
+  this->nextRecord = nullptr;
+
+  // The compact encoding starts with its version in network byte order,
+  // bytes 0 and 2. A version 1 message starts with 0 and 1 or 1 and 0,
+  // depending on the byte order of its sender.
+  this->compact = _size >= sizeof(uint16_t) &&
+    ReadNet16(_buffer) == TRNSP_VERSION_COMPACT;
+  if (this->compact)
+    return this->ParseCompact(_buffer, _size);
+
+  // Header: version, GUID, topic, type and flags
+  if (!ReadValue(_buffer, this->end, this->version) ||
+      static_cast<size_t>(this->end - _buffer) < sizeof(this->guid))
+  {
+    return false;
+  }
+  memcpy(this->guid, _buffer, sizeof(this->guid));
+  _buffer += sizeof(this->guid);
+  if (!ReadString(_buffer, this->end, this->topic) ||
+      !ReadValue(_buffer, this->end, this->type) ||
+      !ReadValue(_buffer, this->end, this->flags))
+  {
+    return false;
+  }
+
+  AdvRecordView record;
+  switch (this->type)
+  {
+    case ADV:
+    case ADV_SVC:
+      return ReadString(_buffer, this->end, this->address);
+
+    case ADV_BATCH:
+      if (!ReadValue(_buffer, this->end, this->numRecords))
+        return false;
+
+      // Every record is checked before the first one is read
+      this->nextRecord = _buffer;
+      for (uint16_t i = 0; i < this->numRecords; ++i)
+      {
+        if (!this->ReadRecord(_buffer, record))
+          return false;
+      }
+      this->pendingRecords = this->numRecords;
+      return true;
+
+    default:
+      return true;
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::DiscoveryMsgView::ParseCompact(const char *_buffer,
+                                               size_t _size)
+{
+  if (_size < CompactHeaderLength)
+    return false;
+
+  uint16_t topicLength = ReadNet16(_buffer + 6);
+  if (_size - CompactHeaderLength < topicLength)
+    return false;
+
+  this->version = TRNSP_VERSION_COMPACT;
+  this->type = _buffer[2];
+  this->flags = ReadNet16(_buffer + 4);
+  memcpy(this->guid, _buffer + 8, sizeof(this->guid));
+  this->topic = StringView(_buffer + CompactHeaderLength, topicLength);
+  _buffer += CompactHeaderLength + topicLength;
+
+  AdvRecordView record;
+  switch (this->type)
+  {
+    case ADV:
+    case ADV_SVC:
+      return static_cast<size_t>(this->end - _buffer) >=
+               CompactAddressLength &&
+             FormatAddress(_buffer, this->addressStr, this->address);
+
+    case ADV_BATCH:
+      if (static_cast<size_t>(this->end - _buffer) < sizeof(uint16_t))
+        return false;
+      this->numRecords = ReadNet16(_buffer);
+      _buffer += sizeof(uint16_t);
+
+      // Every record is checked before the first one is read
+      this->nextRecord = _buffer;
+      for (uint16_t i = 0; i < this->numRecords; ++i)
+      {
+        if (!this->ReadRecord(_buffer, record))
+          return false;
+      }
+      this->pendingRecords = this->numRecords;
+      return true;
+
+    default:
+      return true;
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::DiscoveryMsgView::ReadRecord(const char *&_buffer,
+                                             AdvRecordView &_record)
+{
+  if (!this->compact)
+  {
+    if (!ReadValue(_buffer, this->end, _record.type) ||
+        !ReadString(_buffer, this->end, _record.topic) ||
+        !ReadString(_buffer, this->end, _record.address))
+    {
+      return false;
+    }
+    _record.topicHash = HashTopic(_record.topic.GetData(),
+                                  _record.topic.GetSize());
+    return true;
+  }
+
+  if (static_cast<size_t>(this->end - _buffer) < CompactRecordLength)
+    return false;
+
+  uint16_t topicLength = ReadNet16(_buffer + 2);
+  if (static_cast<size_t>(this->end - _buffer) - CompactRecordLength <
+        topicLength)
+  {
+    return false;
+  }
+
+  uint64_t hash;
+  memcpy(&hash, _buffer + 4, sizeof(hash));
+  _record.type = _buffer[0];
+  _record.topicHash = be64toh(hash);
+  _record.topic = StringView(_buffer + CompactRecordLength, topicLength);
+  if (!FormatAddress(_buffer + 12, this->addressStr, _record.address))
+    return false;
+
+  _buffer += CompactRecordLength + topicLength;
+  return true;
+}
+
+//////////////////////////////////////////////////
+uint16_t transport::DiscoveryMsgView::GetVersion() const
+{
+  return this->version;
+}
+
+//////////////////////////////////////////////////
+const uuid_t &transport::DiscoveryMsgView::GetGuid() const
+{
+  return this->guid;
+}
+
+//////////////////////////////////////////////////
+const transport::StringView &transport::DiscoveryMsgView::GetTopic() const
+{
+  return this->topic;
+}
+
+//////////////////////////////////////////////////
+uint8_t transport::DiscoveryMsgView::GetType() const
+{
+  return this->type;
+}
+
+//////////////////////////////////////////////////
+uint16_t transport::DiscoveryMsgView::GetFlags() const
+{
+  return this->flags;
+}
+
+//////////////////////////////////////////////////
+const transport::StringView &transport::DiscoveryMsgView::GetAddress() const
+{
+  return this->address;
+}
+
+//////////////////////////////////////////////////
+uint16_t transport::DiscoveryMsgView::GetRecordCount() const
+{
+  return this->numRecords;
+}
+
+//////////////////////////////////////////////////
+bool transport::DiscoveryMsgView::NextRecord(AdvRecordView &_record)
+{
+  if (this->pendingRecords == 0)
+    return false;
+
+  --this->pendingRecords;
+  return this->ReadRecord(this->nextRecord, _record);
+}
+
+//////////////////////////////////////////////////
+void transport::DiscoveryMsgView::Print() const
+{
+  const char *typeStr = this->type <= BYE ? msgTypesStr[this->type] : NULL;
+  std::cout << "\t--------------------------------------\n";
+  std::cout << "\tHeader:" << std::endl;
+  std::cout << "\t\tVersion: " << this->version << "\n";
+  std::cout << "\t\tGUID: " << transport::GetGuidStr(this->guid) << "\n";
+  std::cout << "\t\tTopic: [" << this->topic.ToString() << "]\n";
+  std::cout << "\t\tType: " << (typeStr ? typeStr : "UNKNOWN") << "\n";
+  std::cout << "\t\tFlags: " << this->flags << "\n";
+
+  if (this->type == ADV || this->type == ADV_SVC)
+  {
+    std::cout << "\tBody:" << std::endl;
+    std::cout << "\t\tAddress: " << this->address.ToString() << std::endl;
+  }
+  else if (this->type == ADV_BATCH)
+  {
+    std::cout << "\tBody:" << std::endl;
+    std::cout << "\t\tRecords: " << this->numRecords << std::endl;
+  }
+}
+
+//////////////////////////////////////////////////
+const size_t transport::DataHeader::Length;
+
+//////////////////////////////////////////////////
+transport::DataHeader::DataHeader()
+  : version(TRNSP_VERSION),
+    flags(0),
+    publisherId(0),
+    sequence(0),
+    timestamp(0)
+{
+}
+
+//////////////////////////////////////////////////
+transport::DataHeader::DataHeader(const uint64_t _publisherId,
+                                  const uint64_t _sequence,
+                                  const int64_t _timestamp,
+                                  const uint16_t _flags)
+  : version(TRNSP_VERSION),
+    flags(_flags),
+    publisherId(_publisherId),
+    sequence(_sequence),
+    timestamp(_timestamp)
+{
+}
+
+//////////////////////////////////////////////////
+uint16_t transport::DataHeader::GetVersion() const
+{
+  return this->version;
+}
+
+//////////////////////////////////////////////////
+uint64_t transport::DataHeader::GetPublisherId() const
+{
+  return this->publisherId;
+}
+
+//////////////////////////////////////////////////
+uint64_t transport::DataHeader::GetSequence() const
+{
+  return this->sequence;
+}
+
+//////////////////////////////////////////////////
+int64_t transport::DataHeader::GetTimestamp() const
+{
+  return this->timestamp;
+}
+
+//////////////////////////////////////////////////
+uint16_t transport::DataHeader::GetFlags() const
+{
+  return this->flags;
+}
+
+//////////////////////////////////////////////////
+void transport::DataHeader::SetPublisherId(const uint64_t _publisherId)
+{
+  this->publisherId = _publisherId;
+}
+
+//////////////////////////////////////////////////
+void transport::DataHeader::SetSequence(const uint64_t _sequence)
+{
+  this->sequence = _sequence;
+}
+
+//////////////////////////////////////////////////
+void transport::DataHeader::SetTimestamp(const int64_t _timestamp)
+{
+  this->timestamp = _timestamp;
+}
+
+//////////////////////////////////////////////////
+void transport::DataHeader::SetFlags(const uint16_t _flags)
+{
+  this->flags = _flags;
+}
+
+//////////////////////////////////////////////////
+size_t transport::DataHeader::Pack(char *_buffer) const
+{
+  // version (2), flags (2), reserved (4), publisher (8), sequence (8) and
+  // timestamp (8). The 64 bit fields are aligned.
+  uint32_t reserved = 0;
+  memcpy(_buffer, &this->version, sizeof(this->version));
+  _buffer += sizeof(this->version);
+  memcpy(_buffer, &this->flags, sizeof(this->flags));
+  _buffer += sizeof(this->flags);
+  memcpy(_buffer, &reserved, sizeof(reserved));
+  _buffer += sizeof(reserved);
+  memcpy(_buffer, &this->publisherId, sizeof(this->publisherId));
+  _buffer += sizeof(this->publisherId);
+  memcpy(_buffer, &this->sequence, sizeof(this->sequence));
+  _buffer += sizeof(this->sequence);
+  memcpy(_buffer, &this->timestamp, sizeof(this->timestamp));
+
+  return Length;
+}
+
+//////////////////////////////////////////////////
+size_t transport::DataHeader::Unpack(const char *_buffer, size_t _size)
+{
+  if (_size < Length)
+    return 0;
+
+  uint16_t version;
+  memcpy(&version, _buffer, sizeof(version));
+  if (version != TRNSP_VERSION)
+    return 0;
+
+  this->version = version;
+  _buffer += sizeof(this->version);
+  memcpy(&this->flags, _buffer, sizeof(this->flags));
+  _buffer += sizeof(this->flags) + sizeof(uint32_t);
+  memcpy(&this->publisherId, _buffer, sizeof(this->publisherId));
+  _buffer += sizeof(this->publisherId);
+  memcpy(&this->sequence, _buffer, sizeof(this->sequence));
+  _buffer += sizeof(this->sequence);
+  memcpy(&this->timestamp, _buffer, sizeof(this->timestamp));
+
+  return Length;
+}
@@ -19,11 +19,19 @@
 #define __PACKET_HH_INCLUDED__
 
 #include <uuid/uuid.h>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 //  This is the version of Gazebo transport we implement
 #define TRNSP_VERSION       1
 
+// Version of the compact encoding of the discovery messages: fixed layout,
+// network byte order, binary addresses and optional records carrying only
+// the hash of their topic. The nodes decode both versions, and announce it
+// with FLAG_WIRE_V2 in the messages they send in version 1.
+#define TRNSP_VERSION_COMPACT 2
+
 // Message types
 #define ADV                 1
 #define SUB                 2
@@ -33,13 +41,23 @@
 #define REQ                 6
 #define REP_OK              7
 #define REP_ERROR           8
+#define ADV_BATCH           9
+#define HEARTBEAT           10
+#define BYE                 11
+
+// Header flags
+// HEARTBEAT acknowledgement of a registry that asks the node to register
+#define FLAG_REGISTER       0x0001
+// Version 1 message of a node that decodes TRNSP_VERSION_COMPACT messages
+#define FLAG_WIRE_V2        0x0002
 
 #define GUID_STR_LEN (sizeof(uuid_t) * 2) + 4 + 1
 
 static char *msgTypesStr[] = {
     NULL, (char*)"ADVERTISE", (char*)"SUBSCRIBE", (char*)"ADV_SRV",
     (char*)"SUB_SVC", (char*)"PUB", (char*)"REQ", (char*)"SRV_REP_OK",
-    (char*)"SRV_REP_ERROR"
+    (char*)"SRV_REP_ERROR", (char*)"ADV_BATCH",
+    (char*)"HEARTBEAT", (char*)"BYE"
 };
 
 namespace transport
@@ -49,6 +67,24 @@ namespace transport
   /// \return A string representation of the GUID.
   std::string GetGuidStr(const uuid_t &_uuid);
 
+  /// \brief Get the string representation of the GUID into a string, which
+  /// keeps its capacity when it is reused.
+  /// \param[in] _uuid UUID to be converted to string.
+  /// \param[out] _str String representation of the GUID.
+  void GetGuidStr(const uuid_t &_uuid, std::string &_str);
+
+  /// \brief Get the hash of a topic sent in the compact records (64 bit
+  /// FNV-1a).
+  /// \param[in] _topic Topic.
+  /// \param[in] _size Length of the topic.
+  /// \return Hash of the topic.
+  uint64_t HashTopic(const char *_topic, size_t _size);
+
+  /// \brief Get the hash of a topic sent in the compact records.
+  /// \param[in] _topic Topic.
+  /// \return Hash of the topic.
+  uint64_t HashTopic(const std::string &_topic);
+
   class Header
   {
     /// \brief Constructor.
@@ -128,6 +164,16 @@ namespace transport
     /// \param[in] _buffer Input buffer containing the data to be unserialized.
     public: size_t Unpack(const char *_buffer);
 
+    /// \brief Get the length of the header in the compact encoding.
+    /// \return The header length in bytes.
+    public: size_t GetCompactLength() const;
+
+    /// \brief Serialize the header in the compact encoding
+    /// (TRNSP_VERSION_COMPACT), whatever its version.
+    /// \param[out] _buffer Destination buffer of GetCompactLength() bytes.
+    /// \return Number of bytes serialized.
+    public: size_t PackCompact(char *_buffer) const;
+
 
     /// \brief Calculate the header length.
     private: void UpdateHeaderLength();
@@ -217,6 +263,363 @@ namespace transport
     /// \brief Length of the message in bytes.
     private: int msgLength;
   };
+
+  /// \brief Topic and address advertised inside an AdvBatchMsg.
+  class AdvRecord
+  {
+    /// \brief ADV or ADV_SVC.
+    public: uint8_t type;
+
+    /// \brief Topic advertised.
+    public: std::string topic;
+
+    /// \brief ZMQ valid address (e.g., "tcp://10.0.0.1:6000").
+    public: std::string address;
+  };
+
+  /// \brief Message advertising many topics at once, so a node sends one
+  /// datagram instead of one per topic and address. The records are added
+  /// while they fit in the maximum length of the message.
+  class AdvBatchMsg
+  {
+    /// \brief Default maximum length of a message (bytes): an Ethernet MTU
+    /// minus the IP and UDP headers.
+    public: static const size_t DefaultMaxLength = 1472;
+
+    /// \brief Constructor.
+    public: AdvBatchMsg();
+
+    /// \brief Constructor.
+    /// \param[in] _header Message header. Its type is ADV_BATCH.
+    /// \param[in] _maxLength Maximum length of the message (bytes).
+    public: AdvBatchMsg(const Header &_header,
+                        size_t _maxLength = DefaultMaxLength);
+
+    /// \brief Get the message header.
+    /// \return Reference to the message header.
+    public: Header& GetHeader();
+
+    /// \brief Add a record to the message.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _topic Topic advertised.
+    /// \param[in] _address Address advertised with the topic.
+    /// \return false if the record does not fit in the maximum length. The
+    /// first record is always added, even if it is too long.
+    public: bool AddRecord(uint8_t _type, const std::string &_topic,
+                           const std::string &_address);
+
+    /// \brief Get the records of the message.
+    /// \return Records.
+    public: const std::vector<AdvRecord> &GetRecords() const;
+
+    /// \brief Remove all the records.
+    public: void Clear();
+
+    /// \brief Get the total length of the message.
+    /// \return Return the length of the message in bytes.
+    public: size_t GetMsgLength();
+
+    /// \brief Print the message.
+    public: void PrintBody();
+
+    /// \brief Serialize the message.
+    /// \param[out] _buffer Buffer where the message will be serialized.
+    /// \return The length of the serialized message in bytes.
+    public: size_t Pack(char *_buffer);
+
+    /// \brief Unserialize the body of a message.
+    /// \param[in] _buffer Unpack the body from the buffer.
+    /// \return The number of bytes from the body.
+    public: size_t UnpackBody(char *_buffer);
+
+    /// \brief Get the length of the message in the compact encoding.
+    /// \param[in] _hashOnly true if the records carry the hash of their
+    /// topic only.
+    /// \return Length of the message in bytes.
+    public: size_t GetCompactLength(bool _hashOnly);
+
+    /// \brief Serialize the message in the compact encoding. Only the
+    /// tcp:// addresses with a numeric IP have a binary form.
+    /// \param[out] _buffer Buffer of GetCompactLength() bytes.
+    /// \param[in] _hashOnly true if the records carry the hash of their
+    /// topic only, for receivers that know their topics.
+    /// \return The length of the serialized message in bytes, or 0 if there
+    /// are no records or an address has no binary form.
+    public: size_t PackCompact(char *_buffer, bool _hashOnly);
+
+    /// \brief Get the serialized length of a record.
+    /// \param[in] _topic Topic of the record.
+    /// \param[in] _address Address of the record.
+    /// \return Length of the record in bytes.
+    private: static size_t GetRecordLength(const std::string &_topic,
+                                           const std::string &_address);
+
+    /// \brief Message header.
+    private: Header header;
+
+    /// \brief Records of the message.
+    private: std::vector<AdvRecord> records;
+
+    /// \brief Length of the body in bytes.
+    private: size_t bodyLength;
+
+    /// \brief Length of the body in the compact encoding, with topics.
+    private: size_t compactBodyLength;
+
+    /// \brief Maximum length of the message in bytes.
+    private: size_t maxLength;
+  };
+
+  /// \brief Non owning reference to a string inside a buffer, which must
+  /// outlive the view.
+  class StringView
+  {
+    /// \brief Constructor of an empty view.
+    public: StringView();
+
+    /// \brief Constructor.
+    /// \param[in] _data First character.
+    /// \param[in] _size Number of characters.
+    public: StringView(const char *_data, size_t _size);
+
+    /// \brief Get the first character.
+    /// \return Pointer to the characters, not null terminated.
+    public: const char *GetData() const;
+
+    /// \brief Get the number of characters.
+    /// \return Size in bytes.
+    public: size_t GetSize() const;
+
+    /// \brief Copy the characters into a string.
+    /// \return New string.
+    public: std::string ToString() const;
+
+    /// \brief Copy the characters into an existing string, which does not
+    /// allocate if its capacity is enough.
+    /// \param[out] _str Destination string.
+    public: void AssignTo(std::string &_str) const;
+
+    /// \brief Compare the characters with a string.
+    /// \param[in] _str String.
+    /// \return true if both have the same characters.
+    public: bool operator==(const std::string &_str) const;
+
+    /// \brief First character.
+    private: const char *data;
+
+    /// \brief Number of characters.
+    private: size_t size;
+  };
+
+  /// \brief Record of an ADV_BATCH read by a DiscoveryMsgView.
+  class AdvRecordView
+  {
+    /// \brief ADV or ADV_SVC.
+    public: uint8_t type;
+
+    /// \brief Topic advertised.
+    public: StringView topic;
+
+    /// \brief Address advertised with the topic.
+    public: StringView address;
+
+    /// \brief Hash of the topic. The topic is empty in the compact records
+    /// that only carry its hash.
+    public: uint64_t topicHash;
+  };
+
+  /// \brief Parser of the discovery messages received, in both encodings.
+  /// Unlike Header and AdvMsg, it checks every length against the size of
+  /// the message and allocates nothing: the topics are views into the
+  /// buffer parsed, which must outlive the parser. The binary addresses of
+  /// the compact encoding are formatted into the parser, and their views
+  /// are valid until the next record is read.
+  class DiscoveryMsgView
+  {
+    /// \brief Constructor.
+    public: DiscoveryMsgView();
+
+    /// \brief Parse a message. The body is checked too: the address of an
+    /// ADV or ADV_SVC and every record of an ADV_BATCH.
+    /// \param[in] _buffer Message.
+    /// \param[in] _size Size of the message.
+    /// \return false if the message is truncated or malformed.
+    public: bool Parse(const char *_buffer, size_t _size);
+
+    /// \brief Get the transport library version.
+    /// \return Transport library version.
+    public: uint16_t GetVersion() const;
+
+    /// \brief Get the guid.
+    /// \return A unique global identifier for every process.
+    public: const uuid_t &GetGuid() const;
+
+    /// \brief Get the topic.
+    /// \return Topic name.
+    public: const StringView &GetTopic() const;
+
+    /// \brief Get the message type.
+    /// \return Message type (ADVERTISE, SUBSCRIPTION, ...)
+    public: uint8_t GetType() const;
+
+    /// \brief Get the message flags.
+    /// \return Message flags.
+    public: uint16_t GetFlags() const;
+
+    /// \brief Get the address of an ADV or ADV_SVC.
+    /// \return Address, empty for other messages.
+    public: const StringView &GetAddress() const;
+
+    /// \brief Get the number of records of an ADV_BATCH.
+    /// \return Number of records, 0 for other messages.
+    public: uint16_t GetRecordCount() const;
+
+    /// \brief Read the next record of an ADV_BATCH.
+    /// \param[out] _record Record read.
+    /// \return false when there are no more records.
+    public: bool NextRecord(AdvRecordView &_record);
+
+    /// \brief Print the message.
+    public: void Print() const;
+
+    /// \brief Version of the transport library.
+    private: uint16_t version;
+
+    /// \brief Global identifier of the sender.
+    private: uuid_t guid;
+
+    /// \brief Topic.
+    private: StringView topic;
+
+    /// \brief Message type (ADVERTISE, SUBSCRIPTION, ...).
+    private: uint8_t type;
+
+    /// \brief Optional flags.
+    private: uint16_t flags;
+
+    /// \brief Address of an ADV or ADV_SVC.
+    private: StringView address;
+
+    /// \brief Number of records of an ADV_BATCH.
+    private: uint16_t numRecords;
+
+    /// \brief Records not read yet.
+    private: uint16_t pendingRecords;
+
+    /// \brief Next record to read.
+    private: const char *nextRecord;
+
+    /// \brief Parse a message in the compact encoding.
+    /// \param[in] _buffer Message.
+    /// \param[in] _size Size of the message.
+    /// \return false if the message is truncated or malformed.
+    private: bool ParseCompact(const char *_buffer, size_t _size);
+
+    /// \brief Read a record of an ADV_BATCH, checking the bounds.
+    /// \param[in,out] _buffer Position in the message, moved past the
+    /// record.
+    /// \param[out] _record Record read.
+    /// \return false if the record is truncated or malformed.
+    private: bool ReadRecord(const char *&_buffer, AdvRecordView &_record);
+
+    /// \brief End of the message parsed.
+    private: const char *end;
+
+    /// \brief Is the message in the compact encoding?
+    private: bool compact;
+
+    /// \brief Text of the last binary address read.
+    private: char addressStr[64];
+  };
+
+  /// \brief Fixed size header sent with every topic update, in its own frame
+  /// between the topic and the data. It replaces the sender endpoint sent in
+  /// that frame by the previous versions, which is a wire break: the updates
+  /// of the nodes that send the endpoint are dropped as invalid, and those
+  /// nodes cannot read the publisher from the header.
+  class DataHeader
+  {
+    /// \brief Length of a serialized header (bytes).
+    public: static const size_t Length = 32;
+
+    /// \brief Constructor.
+    public: DataHeader();
+
+    /// \brief Constructor.
+    /// \param[in] _publisherId Identifier of the publishing node.
+    /// \param[in] _sequence Sequence number of the update in its topic.
+    /// \param[in] _timestamp Monotonic send time (nsecs).
+    /// \param[in] _flags Optional flags.
+    public: DataHeader(const uint64_t _publisherId,
+                       const uint64_t _sequence,
+                       const int64_t _timestamp,
+                       const uint16_t _flags);
+
+    /// \brief Get the transport library version.
+    /// \return Transport library version.
+    public: uint16_t GetVersion() const;
+
+    /// \brief Get the identifier of the publishing node.
+    /// \return Publisher identifier.
+    public: uint64_t GetPublisherId() const;
+
+    /// \brief Get the sequence number. The first update of a topic has
+    /// sequence number 1.
+    /// \return Sequence number.
+    public: uint64_t GetSequence() const;
+
+    /// \brief Get the send time, from a monotonic clock. The values of
+    /// different hosts are not comparable.
+    /// \return Send time (nsecs).
+    public: int64_t GetTimestamp() const;
+
+    /// \brief Get the flags.
+    /// \return Flags.
+    public: uint16_t GetFlags() const;
+
+    /// \brief Set the identifier of the publishing node.
+    /// \param[in] _publisherId Publisher identifier.
+    public: void SetPublisherId(const uint64_t _publisherId);
+
+    /// \brief Set the sequence number.
+    /// \param[in] _sequence Sequence number.
+    public: void SetSequence(const uint64_t _sequence);
+
+    /// \brief Set the send time.
+    /// \param[in] _timestamp Send time (nsecs).
+    public: void SetTimestamp(const int64_t _timestamp);
+
+    /// \brief Set the flags.
+    /// \param[in] _flags Flags.
+    public: void SetFlags(const uint16_t _flags);
+
+    /// \brief Serialize the header.
+    /// \param[out] _buffer Destination buffer of at least Length bytes.
+    /// \return Number of bytes serialized.
+    public: size_t Pack(char *_buffer) const;
+
+    /// \brief Unserialize the header.
+    /// \param[in] _buffer Input buffer.
+    /// \param[in] _size Size of the input buffer.
+    /// \return Number of bytes read or 0 if the buffer does not contain a
+    /// valid header.
+    public: size_t Unpack(const char *_buffer, size_t _size);
+
+    /// \brief Version of the transport library.
+    private: uint16_t version;
+
+    /// \brief Optional flags.
+    private: uint16_t flags;
+
+    /// \brief Identifier of the publishing node.
+    private: uint64_t publisherId;
+
+    /// \brief Sequence number of the update in its topic.
+    private: uint64_t sequence;
+
+    /// \brief Monotonic send time (nsecs).
+    private: int64_t timestamp;
+  };
 }
 
 #endif
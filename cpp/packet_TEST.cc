@@ -16,8 +16,10 @@
 */
 
 #include <limits.h>
+#include <string.h>
 #include <uuid/uuid.h>
 #include <string>
+#include <vector>
 #include "packet.hh"
 #include "gtest/gtest.h"
 
@@ -189,6 +191,224 @@ TEST(PacketTest, AdvMsgIO)
             otherAdvMsg.GetHeader().GetHeaderLength());
 }
 
+//////////////////////////////////////////////////
+TEST(PacketTest, AdvBatchMsgIO)
+{
+  uuid_t guid;
+  uuid_generate(guid);
+  transport::Header header(TRNSP_VERSION, guid, "", ADV_BATCH, 0);
+
+  // Records are added while they fit
+  transport::AdvBatchMsg batchMsg(header, 200);
+  EXPECT_EQ(batchMsg.Pack(nullptr), 0u);
+  std::string address = "tcp://10.0.0.1:6000";
+  EXPECT_TRUE(batchMsg.AddRecord(ADV, "topic_test", address));
+  EXPECT_TRUE(batchMsg.AddRecord(ADV_SVC, "srv_test", address));
+  size_t numRecords = 2;
+  while (batchMsg.AddRecord(ADV, "topic_" + std::to_string(numRecords),
+                            address))
+  {
+    ++numRecords;
+  }
+  EXPECT_EQ(batchMsg.GetRecords().size(), numRecords);
+  EXPECT_LE(batchMsg.GetMsgLength(), 200u);
+
+  // Pack and unpack
+  char *buffer = new char[batchMsg.GetMsgLength()];
+  size_t bytes = batchMsg.Pack(buffer);
+  EXPECT_EQ(bytes, batchMsg.GetMsgLength());
+
+  transport::Header otherHeader;
+  size_t headerBytes = otherHeader.Unpack(buffer);
+  EXPECT_EQ(otherHeader.GetType(), ADV_BATCH);
+  transport::AdvBatchMsg otherBatchMsg(otherHeader);
+  size_t bodyBytes = otherBatchMsg.UnpackBody(buffer + headerBytes);
+  delete[] buffer;
+
+  EXPECT_EQ(headerBytes + bodyBytes, bytes);
+  EXPECT_EQ(otherBatchMsg.GetMsgLength(), bytes);
+  ASSERT_EQ(otherBatchMsg.GetRecords().size(), numRecords);
+  for (size_t i = 0; i < numRecords; ++i)
+  {
+    const transport::AdvRecord &record = batchMsg.GetRecords()[i];
+    const transport::AdvRecord &otherRecord = otherBatchMsg.GetRecords()[i];
+    EXPECT_EQ(otherRecord.type, record.type);
+    EXPECT_EQ(otherRecord.topic, record.topic);
+    EXPECT_EQ(otherRecord.address, record.address);
+  }
+
+  // A record longer than the maximum is sent alone
+  batchMsg.Clear();
+  EXPECT_TRUE(batchMsg.AddRecord(ADV, std::string(300, 'x'), address));
+  EXPECT_FALSE(batchMsg.AddRecord(ADV, "topic_test", address));
+}
+
+//////////////////////////////////////////////////
+TEST(PacketTest, DiscoveryMsgView)
+{
+  uuid_t guid;
+  uuid_generate(guid);
+  std::string topic = "topic_test";
+  std::string address = "tcp://10.0.0.1:6000";
+
+  // An ADV is parsed in place
+  transport::AdvMsg advMsg(
+    transport::Header(TRNSP_VERSION, guid, topic, ADV, 3), address);
+  std::vector<char> buffer(advMsg.GetMsgLength());
+  advMsg.Pack(&buffer[0]);
+  transport::DiscoveryMsgView msg;
+  ASSERT_TRUE(msg.Parse(&buffer[0], buffer.size()));
+  EXPECT_EQ(msg.GetVersion(), TRNSP_VERSION);
+  EXPECT_EQ(uuid_compare(msg.GetGuid(), guid), 0);
+  EXPECT_TRUE(msg.GetTopic() == topic);
+  EXPECT_EQ(msg.GetTopic().GetData(), &buffer[20]);
+  EXPECT_EQ(msg.GetType(), ADV);
+  EXPECT_EQ(msg.GetFlags(), 3);
+  EXPECT_EQ(msg.GetAddress().ToString(), address);
+  EXPECT_EQ(msg.GetRecordCount(), 0);
+
+  // A truncated message is rejected at any length
+  for (size_t size = 0; size < buffer.size(); ++size)
+    EXPECT_FALSE(msg.Parse(&buffer[0], size));
+
+  // The records of a batch are read in order
+  transport::AdvBatchMsg batchMsg(
+    transport::Header(TRNSP_VERSION, guid, "", ADV_BATCH, 0));
+  batchMsg.AddRecord(ADV, topic, address);
+  batchMsg.AddRecord(ADV_SVC, "srv_test", address);
+  buffer.resize(batchMsg.GetMsgLength());
+  batchMsg.Pack(&buffer[0]);
+  ASSERT_TRUE(msg.Parse(&buffer[0], buffer.size()));
+  EXPECT_EQ(msg.GetType(), ADV_BATCH);
+  EXPECT_EQ(msg.GetRecordCount(), 2);
+  transport::AdvRecordView record;
+  ASSERT_TRUE(msg.NextRecord(record));
+  EXPECT_EQ(record.type, ADV);
+  EXPECT_TRUE(record.topic == topic);
+  EXPECT_TRUE(record.address == address);
+  ASSERT_TRUE(msg.NextRecord(record));
+  EXPECT_EQ(record.type, ADV_SVC);
+  EXPECT_EQ(record.topic.ToString(), "srv_test");
+  EXPECT_FALSE(msg.NextRecord(record));
+  for (size_t size = 0; size < buffer.size(); ++size)
+    EXPECT_FALSE(msg.Parse(&buffer[0], size));
+
+  // A count of records past the end is rejected. It follows the header
+  // without topic.
+  uint16_t numRecords = 3;
+  memcpy(&buffer[23], &numRecords, sizeof(numRecords));
+  EXPECT_FALSE(msg.Parse(&buffer[0], buffer.size()));
+
+  // The messages without body only need the header
+  transport::Header header(TRNSP_VERSION, guid, topic, SUB, 0);
+  buffer.resize(header.GetHeaderLength());
+  header.Pack(&buffer[0]);
+  ASSERT_TRUE(msg.Parse(&buffer[0], buffer.size()));
+  EXPECT_EQ(msg.GetType(), SUB);
+  EXPECT_TRUE(msg.GetTopic() == topic);
+  EXPECT_TRUE(msg.GetAddress() == "");
+  EXPECT_FALSE(msg.Parse(&buffer[0], buffer.size() - 1));
+}
+
+//////////////////////////////////////////////////
+TEST(PacketTest, CompactIO)
+{
+  uuid_t guid;
+  uuid_generate(guid);
+  std::string topic = "topic_test";
+
+  // The header starts with its version in network byte order
+  transport::Header header(TRNSP_VERSION, guid, topic, SUB, 3);
+  std::vector<char> buffer(header.GetCompactLength());
+  EXPECT_EQ(header.PackCompact(&buffer[0]), buffer.size());
+  EXPECT_EQ(buffer[0], 0);
+  EXPECT_EQ(buffer[1], TRNSP_VERSION_COMPACT);
+  transport::DiscoveryMsgView msg;
+  ASSERT_TRUE(msg.Parse(&buffer[0], buffer.size()));
+  EXPECT_EQ(msg.GetVersion(), TRNSP_VERSION_COMPACT);
+  EXPECT_EQ(uuid_compare(msg.GetGuid(), guid), 0);
+  EXPECT_TRUE(msg.GetTopic() == topic);
+  EXPECT_EQ(msg.GetType(), SUB);
+  EXPECT_EQ(msg.GetFlags(), 3);
+  for (size_t size = 0; size < buffer.size(); ++size)
+    EXPECT_FALSE(msg.Parse(&buffer[0], size));
+
+  // The addresses are binary
+  transport::AdvBatchMsg batchMsg(
+    transport::Header(TRNSP_VERSION, guid, "", ADV_BATCH, 0));
+  batchMsg.AddRecord(ADV, topic, "tcp://10.0.0.1:6000");
+  batchMsg.AddRecord(ADV_SVC, "srv_test", "tcp://[fe80::1]:6001");
+  buffer.resize(batchMsg.GetCompactLength(false));
+  EXPECT_EQ(batchMsg.PackCompact(&buffer[0], false), buffer.size());
+  ASSERT_TRUE(msg.Parse(&buffer[0], buffer.size()));
+  EXPECT_EQ(msg.GetRecordCount(), 2);
+  transport::AdvRecordView record;
+  ASSERT_TRUE(msg.NextRecord(record));
+  EXPECT_EQ(record.type, ADV);
+  EXPECT_TRUE(record.topic == topic);
+  EXPECT_EQ(record.topicHash, transport::HashTopic(topic));
+  EXPECT_EQ(record.address.ToString(), "tcp://10.0.0.1:6000");
+  ASSERT_TRUE(msg.NextRecord(record));
+  EXPECT_EQ(record.type, ADV_SVC);
+  EXPECT_EQ(record.address.ToString(), "tcp://[fe80::1]:6001");
+  EXPECT_FALSE(msg.NextRecord(record));
+  for (size_t size = 0; size < buffer.size(); ++size)
+    EXPECT_FALSE(msg.Parse(&buffer[0], size));
+
+  // The records may carry the hash of their topic only
+  buffer.resize(batchMsg.GetCompactLength(true));
+  EXPECT_EQ(batchMsg.PackCompact(&buffer[0], true), buffer.size());
+  ASSERT_TRUE(msg.Parse(&buffer[0], buffer.size()));
+  ASSERT_TRUE(msg.NextRecord(record));
+  EXPECT_EQ(record.topic.GetSize(), 0u);
+  EXPECT_EQ(record.topicHash, transport::HashTopic(topic));
+
+  // The other addresses have no binary form
+  batchMsg.AddRecord(ADV, topic, "shm://10.0.0.1/segment");
+  buffer.resize(batchMsg.GetCompactLength(false));
+  EXPECT_EQ(batchMsg.PackCompact(&buffer[0], false), 0u);
+
+  // Both encodings fit in the maximum length
+  transport::AdvBatchMsg smallMsg(
+    transport::Header(TRNSP_VERSION, guid, "", ADV_BATCH, 0), 200);
+  while (smallMsg.AddRecord(ADV, topic, "tcp://10.0.0.1:6000"))
+    continue;
+  EXPECT_LE(smallMsg.GetMsgLength(), 200u);
+  EXPECT_LE(smallMsg.GetCompactLength(false), 200u);
+}
+
+//////////////////////////////////////////////////
+TEST(PacketTest, DataHeaderIO)
+{
+  transport::DataHeader header(0x0102030405060708, 42, -7, 3);
+  EXPECT_EQ(header.GetVersion(), TRNSP_VERSION);
+  EXPECT_EQ(header.GetPublisherId(), 0x0102030405060708u);
+  EXPECT_EQ(header.GetSequence(), 42u);
+  EXPECT_EQ(header.GetTimestamp(), -7);
+  EXPECT_EQ(header.GetFlags(), 3);
+
+  char buffer[transport::DataHeader::Length];
+  EXPECT_EQ(header.Pack(buffer), transport::DataHeader::Length);
+
+  // Truncated input must be rejected.
+  transport::DataHeader otherHeader;
+  EXPECT_EQ(otherHeader.Unpack(buffer, sizeof(buffer) - 1), 0u);
+  EXPECT_EQ(otherHeader.GetSequence(), 0u);
+
+  // Check that after Pack() and Unpack() the data does not change
+  EXPECT_EQ(otherHeader.Unpack(buffer, sizeof(buffer)),
+            transport::DataHeader::Length);
+  EXPECT_EQ(otherHeader.GetPublisherId(), header.GetPublisherId());
+  EXPECT_EQ(otherHeader.GetSequence(), header.GetSequence());
+  EXPECT_EQ(otherHeader.GetTimestamp(), header.GetTimestamp());
+  EXPECT_EQ(otherHeader.GetFlags(), header.GetFlags());
+
+  // Unknown versions are rejected.
+  uint16_t version = TRNSP_VERSION + 1;
+  memcpy(buffer, &version, sizeof(version));
+  EXPECT_EQ(otherHeader.Unpack(buffer, sizeof(buffer)), 0u);
+}
+
 //////////////////////////////////////////////////
 int main(int argc, char **argv)
 {
@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <uuid/uuid.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "packet.hh"
+#include "registry.hh"
+#include "zmq/zmq.hpp"
+
+//////////////////////////////////////////////////
+transport::RegisteredNode::RegisteredNode()
+  : heartbeats(false),
+    remote(false),
+    lastSeen(std::chrono::steady_clock::now())
+{
+  uuid_clear(this->guid);
+}
+
+//////////////////////////////////////////////////
+transport::Registry::Registry(const std::string &_endpoint, bool _verbose)
+  : verbose(_verbose),
+    context(1),
+    socket(context, ZMQ_ROUTER),
+    leaseTimeout(RegistryDefaultLeaseTimeout)
+{
+  uuid_generate(this->guid);
+
+  try
+  {
+    int linger = 0;
+    this->socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    this->socket.bind(_endpoint.c_str());
+  }
+  catch(const zmq::error_t& ze)
+  {
+    std::cerr << "Error binding the registry at [" << _endpoint << "]: "
+              << ze.what() << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (this->verbose)
+  {
+    std::cout << "Registry bound at: [" << _endpoint << "]\n";
+    std::cout << "GUID: " << transport::GetGuidStr(this->guid) << std::endl;
+  }
+}
+
+//////////////////////////////////////////////////
+transport::Registry::~Registry()
+{
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::SpinOnce(int _timeout)
+{
+  zmq::pollitem_t items[] = { { this->socket, 0, ZMQ_POLLIN, 0 } };
+  zmq::poll(items, 1, _timeout);
+
+  this->RecvMessages();
+  this->CheckLeases();
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::RecvMessages()
+{
+  // Frames: routing identity and message
+  zmq::message_t frames[2];
+  while (true)
+  {
+    try
+    {
+      if (!this->socket.recv(&frames[0], ZMQ_DONTWAIT))
+        break;
+      if (!frames[0].more() || !this->socket.recv(&frames[1], 0))
+        continue;
+      while (frames[1].more())
+        this->socket.recv(&frames[1], 0);
+    }
+    catch(const zmq::error_t& ze)
+    {
+      std::cerr << "Error receiving a registry message: " << ze.what()
+                << std::endl;
+      break;
+    }
+
+    std::string id(static_cast<char*>(frames[0].data()), frames[0].size());
+    this->Dispatch(id, static_cast<char*>(frames[1].data()),
+                   frames[1].size());
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::CheckLeases()
+{
+  // Remove the nodes that are gone without saying goodbye
+  auto now = std::chrono::steady_clock::now();
+  auto lease = std::chrono::milliseconds(this->leaseTimeout);
+  std::vector<std::string> expired;
+  for (auto &node : this->nodes)
+  {
+    if (node.second.remote && !node.second.heartbeats)
+      continue;
+    if (now - node.second.lastSeen > lease)
+      expired.push_back(node.first);
+  }
+  for (auto &id : expired)
+  {
+    if (this->verbose)
+    {
+      std::cout << "\nNode ["
+                << transport::GetGuidStr(this->nodes[id].guid)
+                << "] expired\n";
+    }
+    this->RemoveNode(id);
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::Spin()
+{
+  while (true)
+  {
+    this->SpinOnce();
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::SetLeaseTimeout(int _timeout)
+{
+  this->leaseTimeout = _timeout;
+}
+
+//////////////////////////////////////////////////
+size_t transport::Registry::GetNodeCount() const
+{
+  return this->nodes.size();
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::OnAdv(const std::string &/*_id*/, uint8_t /*_type*/,
+                                const std::string &/*_topic*/,
+                                const std::string &/*_address*/)
+{
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::OnInterest(const std::string &/*_id*/,
+                                     uint8_t /*_type*/,
+                                     const std::string &/*_topic*/)
+{
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::OnRemove(const std::string &/*_id*/,
+                                   const RegisteredNode &/*_node*/)
+{
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::Dispatch(const std::string &_id, const char *_msg,
+                                   size_t _size)
+{
+  DiscoveryMsgView header;
+  if (!header.Parse(_msg, _size))
+  {
+    std::cerr << "Truncated registry message\n";
+    return;
+  }
+
+  if (this->verbose)
+    header.Print();
+
+  // A node leaving is not registered again
+  if (header.GetType() == BYE)
+  {
+    this->RemoveNode(_id);
+    return;
+  }
+
+  // Any message renews the lease of its node
+  RegisteredNode &node = this->nodes[_id];
+  uuid_copy(node.guid, header.GetGuid());
+  node.lastSeen = std::chrono::steady_clock::now();
+
+  AdvRecordView record;
+  std::string topic = header.GetTopic().ToString();
+  switch (header.GetType())
+  {
+    case ADV:
+    case ADV_SVC:
+      this->AddAdv(_id, header.GetType(), topic,
+                   header.GetAddress().ToString());
+      break;
+
+    case ADV_BATCH:
+      while (header.NextRecord(record))
+      {
+        if (record.type == ADV || record.type == ADV_SVC)
+        {
+          this->AddAdv(_id, record.type, record.topic.ToString(),
+                       record.address.ToString());
+        }
+      }
+      break;
+
+    case SUB:
+      this->AddInterest(_id, ADV, topic);
+      break;
+
+    case SUB_SVC:
+      this->AddInterest(_id, ADV_SVC, topic);
+      break;
+
+    case HEARTBEAT:
+      // The acknowledgement tells the node which registry it talks to
+      this->SendHeader(_id, this->guid, HEARTBEAT,
+                       node.heartbeats ? 0 : FLAG_REGISTER);
+      node.heartbeats = true;
+      break;
+
+    default:
+      std::cerr << "Unknown message type [" << header.GetType() << "]\n";
+      break;
+  }
+}
+
+//////////////////////////////////////////////////
+/// \brief Remove a node from an index entry, and the entry if it is left
+/// empty.
+/// \param[in,out] _index Index of the nodes by type and topic.
+/// \param[in] _key Type and topic.
+/// \param[in] _id Routing identity of the node.
+static void Unindex(transport::Registry::NodeIndex &_index,
+                    const std::pair<uint8_t, std::string> &_key,
+                    const std::string &_id)
+{
+  auto entry = _index.find(_key);
+  if (entry == _index.end())
+    return;
+
+  entry->second.erase(_id);
+  if (entry->second.empty())
+    _index.erase(entry);
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::AddAdv(const std::string &_id, uint8_t _type,
+                                 const std::string &_topic,
+                                 const std::string &_address)
+{
+  RegisteredNode &node = this->nodes[_id];
+  auto adv = std::make_tuple(_type, _topic, _address);
+  if (!node.advs.insert(adv).second)
+    return;
+
+  this->OnAdv(_id, _type, _topic, _address);
+
+  auto interest = std::make_pair(_type, _topic);
+  this->advertisers[interest].insert(_id);
+
+  auto interested = this->interestedNodes.find(interest);
+  if (interested == this->interestedNodes.end())
+    return;
+
+  std::set<std::tuple<uint8_t, std::string, std::string>> advs;
+  advs.insert(adv);
+  for (auto &other : interested->second)
+  {
+    if (other != _id)
+      this->SendAdvs(other, node, advs);
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::AddInterest(const std::string &_id, uint8_t _type,
+                                      const std::string &_topic)
+{
+  auto interest = std::make_pair(_type, _topic);
+  this->nodes[_id].interests.insert(interest);
+  this->interestedNodes[interest].insert(_id);
+  this->OnInterest(_id, _type, _topic);
+
+  // The subscription is answered even if the interest was known, the node
+  // may have lost the previous answers
+  auto advertisers = this->advertisers.find(interest);
+  if (advertisers == this->advertisers.end())
+    return;
+
+  for (auto &other : advertisers->second)
+  {
+    if (other == _id)
+      continue;
+
+    // The records of a topic are contiguous in the set
+    const RegisteredNode &node = this->nodes[other];
+    std::set<std::tuple<uint8_t, std::string, std::string>> advs;
+    for (auto adv = node.advs.lower_bound(std::make_tuple(_type, _topic,
+                                                          std::string()));
+         adv != node.advs.end() && std::get<0>(*adv) == _type &&
+         std::get<1>(*adv) == _topic; ++adv)
+    {
+      advs.insert(*adv);
+    }
+    this->SendAdvs(_id, node, advs);
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::RemoveNode(const std::string &_id)
+{
+  auto node = this->nodes.find(_id);
+  if (node == this->nodes.end())
+    return;
+
+  // Notify the nodes that use any of its records, once each
+  std::set<std::string> notified;
+  for (auto &adv : node->second.advs)
+  {
+    auto interest = std::make_pair(std::get<0>(adv), std::get<1>(adv));
+    auto interested = this->interestedNodes.find(interest);
+    if (interested != this->interestedNodes.end())
+      notified.insert(interested->second.begin(), interested->second.end());
+    Unindex(this->advertisers, interest, _id);
+  }
+  notified.erase(_id);
+  for (auto &other : notified)
+    this->SendHeader(other, node->second.guid, BYE);
+
+  for (auto &interest : node->second.interests)
+    Unindex(this->interestedNodes, interest, _id);
+
+  this->OnRemove(_id, node->second);
+  this->nodes.erase(node);
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::SendAdvs(const std::string &_id,
+  const RegisteredNode &_from,
+  const std::set<std::tuple<uint8_t, std::string, std::string>> &_advs)
+{
+  this->SendAdvBatches(_from, _advs, 0,
+    [this, &_id](const char *_msg, size_t _size)
+    {
+      this->Send(_id, _msg, _size);
+    });
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::SendAdvBatches(const RegisteredNode &_from,
+  const std::set<std::tuple<uint8_t, std::string, std::string>> &_advs,
+  uint16_t _flags, const std::function<void(const char *, size_t)> &_send)
+{
+  AdvBatchMsg batchMsg(Header(TRNSP_VERSION, _from.guid, "", ADV_BATCH,
+                              _flags));
+  std::vector<char> buffer;
+  for (auto it = _advs.begin(); it != _advs.end();)
+  {
+    // Send the records when the batch is full
+    if (batchMsg.AddRecord(std::get<0>(*it), std::get<1>(*it),
+                           std::get<2>(*it)))
+    {
+      ++it;
+      if (it != _advs.end())
+        continue;
+    }
+
+    buffer.resize(batchMsg.GetMsgLength());
+    batchMsg.Pack(&buffer[0]);
+    batchMsg.Clear();
+    _send(&buffer[0], buffer.size());
+  }
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::SendHeader(const std::string &_id,
+                                     const uuid_t &_guid, uint8_t _type,
+                                     uint16_t _flags)
+{
+  Header header(TRNSP_VERSION, _guid, "", _type, _flags);
+  std::vector<char> buffer(header.GetHeaderLength());
+  header.Pack(&buffer[0]);
+  this->Send(_id, &buffer[0], buffer.size());
+}
+
+//////////////////////////////////////////////////
+void transport::Registry::Send(const std::string &_id, const char *_msg,
+                               size_t _size)
+{
+  try
+  {
+    this->socket.send(_id.data(), _id.size(), ZMQ_SNDMORE);
+    this->socket.send(_msg, _size, 0);
+  }
+  catch(const zmq::error_t& ze)
+  {
+    std::cerr << "Error sending a registry message: " << ze.what() << "\n";
+  }
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#ifndef __REGISTRY_HH_INCLUDED__
+#define __REGISTRY_HH_INCLUDED__
+
+#include <uuid/uuid.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include "zmq/zmq.hpp"
+
+namespace transport
+{
+  /// \brief Default time without news from a registered node before it is
+  /// removed (msecs).
+  const int RegistryDefaultLeaseTimeout = 3000;
+
+  /// \brief Node registered in the registry.
+  class RegisteredNode
+  {
+    /// \brief Constructor.
+    public: RegisteredNode();
+
+    /// brief GUID of the node.
+    public: uuid_t guid;
+
+    /// brief Has the node sent heartbeats? The first one is acknowledged
+    /// with FLAG_REGISTER, since its registration may predate the registry.
+    public: bool heartbeats;
+
+    /// brief Is the node on another host? Remote nodes are known through
+    /// the network discovery of a HostAgent and have no connection. They
+    /// only expire if they send heartbeats.
+    public: bool remote;
+
+    /// brief Last time a message was received from the node.
+    public: std::chrono::steady_clock::time_point lastSeen;
+
+    /// brief Records advertised by the node: type (ADV or ADV_SVC), topic
+    /// and address.
+    public: std::set<std::tuple<uint8_t, std::string, std::string>> advs;
+
+    /// brief Topics the node is interested in, by type of the records
+    /// expected (ADV or ADV_SVC).
+    public: std::set<std::pair<uint8_t, std::string>> interests;
+  };
+
+  /// \brief Central registry of the discovery. The nodes created with a
+  /// master endpoint send their discovery messages to the registry instead
+  /// of broadcasting them. The registry answers the subscriptions with the
+  /// records known and pushes the new records to the nodes interested. When
+  /// a node leaves or its lease expires, the nodes interested in its topics
+  /// receive a BYE message.
+  class Registry
+  {
+    /// \brief Routing identities of the nodes, by type (ADV or ADV_SVC) and
+    /// topic.
+    public: typedef std::map<std::pair<uint8_t, std::string>,
+                             std::set<std::string>> NodeIndex;
+
+    /// \brief Constructor.
+    /// \param[in] _endpoint ZMQ endpoint where the registry is bound.
+    /// \param[in] _verbose true for enabling verbose mode.
+    public: Registry(const std::string &_endpoint, bool _verbose);
+
+    /// \brief Destructor.
+    public: virtual ~Registry();
+
+    /// \brief Process the messages received until a timeout, and remove the
+    /// nodes whose lease expired.
+    /// \param[in] _timeout Poll timeout (msecs).
+    public: virtual void SpinOnce(int _timeout = 250);
+
+    /// \brief Process messages forever.
+    public: void Spin();
+
+    /// \brief Set the time without news from a node before it is removed.
+    /// \param[in] _timeout Lease (msecs).
+    public: void SetLeaseTimeout(int _timeout);
+
+    /// \brief Get the number of registered nodes.
+    /// \return Number of nodes.
+    public: size_t GetNodeCount() const;
+
+    /// \brief Hook called when a node registers a new record.
+    /// \param[in] _id Routing identity of the node.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _topic Topic advertised.
+    /// \param[in] _address Address advertised with the topic.
+    protected: virtual void OnAdv(const std::string &_id, uint8_t _type,
+                                  const std::string &_topic,
+                                  const std::string &_address);
+
+    /// \brief Hook called for every subscription of a node.
+    /// \param[in] _id Routing identity of the node.
+    /// \param[in] _type Type of the records expected (ADV or ADV_SVC).
+    /// \param[in] _topic Topic requested.
+    protected: virtual void OnInterest(const std::string &_id, uint8_t _type,
+                                       const std::string &_topic);
+
+    /// \brief Hook called when a node is removed. The node is already out
+    /// of the indexes.
+    /// \param[in] _id Routing identity of the node.
+    /// \param[in] _node Node removed.
+    protected: virtual void OnRemove(const std::string &_id,
+                                     const RegisteredNode &_node);
+
+    /// \brief Process the messages waiting in the socket.
+    protected: void RecvMessages();
+
+    /// \brief Remove the nodes whose lease expired.
+    protected: void CheckLeases();
+
+    /// \brief Process a message of a node.
+    /// \param[in] _id Routing identity of the node.
+    /// \param[in] _msg Message.
+    /// \param[in] _size Size of the message.
+    private: void Dispatch(const std::string &_id, const char *_msg,
+                           size_t _size);
+
+    /// \brief Register a record advertised by a node and push it to the
+    /// nodes interested.
+    /// \param[in] _id Routing identity of the node.
+    /// \param[in] _type ADV or ADV_SVC.
+    /// \param[in] _topic Topic advertised.
+    /// \param[in] _address Address advertised with the topic.
+    protected: void AddAdv(const std::string &_id, uint8_t _type,
+                         const std::string &_topic,
+                         const std::string &_address);
+
+    /// \brief Register the interest of a node and send it the records of
+    /// the other nodes.
+    /// \param[in] _id Routing identity of the node.
+    /// \param[in] _type Type of the records expected (ADV or ADV_SVC).
+    /// \param[in] _topic Topic requested.
+    protected: void AddInterest(const std::string &_id, uint8_t _type,
+                              const std::string &_topic);
+
+    /// \brief Remove a node and notify the nodes interested in its topics.
+    /// \param[in] _id Routing identity of the node.
+    protected: void RemoveNode(const std::string &_id);
+
+    /// \brief Send records of a node to another node.
+    /// \param[in] _id Routing identity of the destination.
+    /// \param[in] _from Node that advertised the records.
+    /// \param[in] _advs Records.
+    private: void SendAdvs(const std::string &_id, const RegisteredNode &_from,
+      const std::set<std::tuple<uint8_t, std::string, std::string>> &_advs);
+
+    /// \brief Pack records of a node in as few ADV_BATCH messages as
+    /// possible and pass every message to a send function.
+    /// \param[in] _from Node that advertised the records.
+    /// \param[in] _advs Records: type, topic and address.
+    /// \param[in] _flags Flags of the headers.
+    /// \param[in] _send Function that sends a message and its size.
+    protected: void SendAdvBatches(const RegisteredNode &_from,
+      const std::set<std::tuple<uint8_t, std::string, std::string>> &_advs,
+      uint16_t _flags, const std::function<void(const char *, size_t)> &_send);
+
+    /// \brief Send a message without body.
+    /// \param[in] _id Routing identity of the destination.
+    /// \param[in] _guid GUID set in the header.
+    /// \param[in] _type Type of the message.
+    /// \param[in] _flags Flags of the header.
+    private: void SendHeader(const std::string &_id, const uuid_t &_guid,
+                             uint8_t _type, uint16_t _flags = 0);
+
+    /// \brief Send a message to a node.
+    /// \param[in] _id Routing identity of the destination.
+    /// \param[in] _msg Message.
+    /// \param[in] _size Size of the message.
+    private: void Send(const std::string &_id, const char *_msg,
+                       size_t _size);
+
+    /// \brief Print activity to stdout.
+    protected: bool verbose;
+
+    /// \brief GUID of this registry. The nodes register again when it
+    /// changes.
+    protected: uuid_t guid;
+
+    /// \brief 0MQ context.
+    private: zmq::context_t context;
+
+    /// \brief Socket where the nodes connect.
+    protected: zmq::socket_t socket;
+
+    /// \brief Registered nodes, by routing identity.
+    protected: std::map<std::string, RegisteredNode> nodes;
+
+    /// \brief Nodes interested in each topic.
+    protected: NodeIndex interestedNodes;
+
+    /// \brief Nodes advertising each topic.
+    protected: NodeIndex advertisers;
+
+    /// \brief Lease of the nodes (msecs).
+    private: int leaseTimeout;
+  };
+}
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <uuid/uuid.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "packet.hh"
+#include "registry.hh"
+#include "zmq/zmq.hpp"
+#include "gtest/gtest.h"
+
+/// \brief Endpoint of the registry used by the tests.
+static const std::string Endpoint = "tcp://127.0.0.1:11330";
+
+//////////////////////////////////////////////////
+/// \brief Node simulated with a DEALER socket.
+class FakeNode
+{
+  public: FakeNode(zmq::context_t &_context)
+    : socket(_context, ZMQ_DEALER)
+  {
+    uuid_generate(this->guid);
+    int linger = 0;
+    this->socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    this->socket.connect(Endpoint.c_str());
+  }
+
+  /// \brief Send a message without body.
+  public: void Send(uint8_t _type, const std::string &_topic)
+  {
+    transport::Header header(TRNSP_VERSION, this->guid, _topic, _type, 0);
+    std::vector<char> buffer(header.GetHeaderLength());
+    header.Pack(&buffer[0]);
+    this->socket.send(&buffer[0], buffer.size(), 0);
+  }
+
+  /// \brief Advertise a topic.
+  public: void Advertise(const std::string &_topic,
+                         const std::string &_address)
+  {
+    transport::AdvBatchMsg batchMsg(
+      transport::Header(TRNSP_VERSION, this->guid, "", ADV_BATCH, 0));
+    batchMsg.AddRecord(ADV, _topic, _address);
+    std::vector<char> buffer(batchMsg.GetMsgLength());
+    batchMsg.Pack(&buffer[0]);
+    this->socket.send(&buffer[0], buffer.size(), 0);
+  }
+
+  /// \brief Receive a message, if any.
+  public: bool Recv(transport::Header &_header,
+                    std::vector<transport::AdvRecord> &_records)
+  {
+    zmq::message_t msg;
+    zmq::pollitem_t items[] = { { this->socket, 0, ZMQ_POLLIN, 0 } };
+    if (zmq::poll(items, 1, 100) == 0 || !this->socket.recv(&msg, 0))
+      return false;
+
+    char *data = static_cast<char*>(msg.data());
+    size_t bytes = _header.Unpack(data);
+    _records.clear();
+    if (_header.GetType() == ADV_BATCH)
+    {
+      transport::AdvBatchMsg batchMsg(_header);
+      batchMsg.UnpackBody(data + bytes);
+      _records = batchMsg.GetRecords();
+    }
+    return true;
+  }
+
+  public: zmq::socket_t socket;
+
+  public: uuid_t guid;
+};
+
+//////////////////////////////////////////////////
+TEST(RegistryTest, AdvSub)
+{
+  transport::Registry registry(Endpoint, false);
+  zmq::context_t context(1);
+  FakeNode nodeA(context);
+  FakeNode nodeB(context);
+  transport::Header header;
+  std::vector<transport::AdvRecord> records;
+
+  // A subscription is answered with the records of the other nodes
+  nodeA.Advertise("foo", "tcp://a");
+  nodeA.Send(SUB, "foo");
+  registry.SpinOnce(100);
+  EXPECT_FALSE(nodeA.Recv(header, records));
+  nodeB.Send(SUB, "foo");
+  registry.SpinOnce(100);
+  ASSERT_TRUE(nodeB.Recv(header, records));
+  EXPECT_EQ(header.GetType(), ADV_BATCH);
+  EXPECT_EQ(uuid_compare(header.GetGuid(), nodeA.guid), 0);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].topic, "foo");
+  EXPECT_EQ(records[0].address, "tcp://a");
+  EXPECT_EQ(registry.GetNodeCount(), 2u);
+
+  // New records are pushed to the nodes interested only
+  nodeB.Send(SUB, "bar");
+  nodeA.Advertise("bar", "tcp://a");
+  nodeA.Advertise("baz", "tcp://a");
+  registry.SpinOnce(100);
+  registry.SpinOnce(100);
+  ASSERT_TRUE(nodeB.Recv(header, records));
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].topic, "bar");
+  EXPECT_FALSE(nodeB.Recv(header, records));
+
+  // The heartbeats are acknowledged. The first one asks the node to
+  // register again.
+  nodeB.Send(HEARTBEAT, "");
+  registry.SpinOnce(100);
+  ASSERT_TRUE(nodeB.Recv(header, records));
+  EXPECT_EQ(header.GetType(), HEARTBEAT);
+  EXPECT_EQ(header.GetFlags(), FLAG_REGISTER);
+  nodeB.Send(HEARTBEAT, "");
+  registry.SpinOnce(100);
+  ASSERT_TRUE(nodeB.Recv(header, records));
+  EXPECT_EQ(header.GetFlags(), 0);
+
+  // The nodes interested are told when a node leaves
+  nodeA.Send(BYE, "");
+  registry.SpinOnce(100);
+  ASSERT_TRUE(nodeB.Recv(header, records));
+  EXPECT_EQ(header.GetType(), BYE);
+  EXPECT_EQ(uuid_compare(header.GetGuid(), nodeA.guid), 0);
+  EXPECT_EQ(registry.GetNodeCount(), 1u);
+}
+
+//////////////////////////////////////////////////
+TEST(RegistryTest, LeaseExpiry)
+{
+  transport::Registry registry(Endpoint, false);
+  registry.SetLeaseTimeout(200);
+  zmq::context_t context(1);
+  FakeNode nodeA(context);
+  FakeNode nodeB(context);
+  transport::Header header;
+  std::vector<transport::AdvRecord> records;
+
+  nodeA.Advertise("foo", "tcp://a");
+  nodeB.Send(SUB, "foo");
+  registry.SpinOnce(100);
+  registry.SpinOnce(100);
+  ASSERT_TRUE(nodeB.Recv(header, records));
+
+  // Only the node that keeps sending heartbeats stays registered
+  for (int i = 0; i < 10; ++i)
+  {
+    nodeB.Send(HEARTBEAT, "");
+    registry.SpinOnce(100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  EXPECT_EQ(registry.GetNodeCount(), 1u);
+
+  bool bye = false;
+  while (nodeB.Recv(header, records))
+    bye = bye || header.GetType() == BYE;
+  EXPECT_TRUE(bye);
+}
@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include "shmRing.hh"
+
+/// \brief Value stored in an initialized segment.
+static const uint32_t ShmMagic = 0x445a4d51;
+
+/// \brief Alignment of the records in the ring.
+static const uint64_t RecordAlign = 16;
+
+/// \brief Topic size that marks the space skipped at the end of the ring.
+static const uint32_t PaddingRecord = 0xFFFFFFFF;
+
+/// \brief Header of every record in the ring.
+struct RecordHeader
+{
+  /// \brief Size of the record, including the header and the alignment.
+  uint32_t size;
+
+  /// \brief Size of the topic or PaddingRecord.
+  uint32_t topicSize;
+
+  /// \brief Size of the data.
+  uint64_t dataSize;
+};
+
+/// \brief Round a size up to a multiple of an alignment.
+/// \param[in] _size Size.
+/// \param[in] _align Alignment (power of two).
+/// \return The aligned size.
+static uint64_t Align(uint64_t _size, uint64_t _align)
+{
+  return (_size + _align - 1) & ~(_align - 1);
+}
+
+//////////////////////////////////////////////////
+transport::ShmRing::ShmRing()
+  : owner(false),
+    segment(nullptr),
+    segmentSize(0),
+    control(nullptr),
+    data(nullptr),
+    capacity(0),
+    position(0),
+    lastRead(0),
+    overruns(0)
+{
+}
+
+//////////////////////////////////////////////////
+transport::ShmRing::~ShmRing()
+{
+  this->Close();
+}
+
+//////////////////////////////////////////////////
+int transport::ShmRing::Create(const std::string &_name, size_t _capacity)
+{
+  if (this->segment)
+    return -1;
+
+  uint64_t capacity = Align(_capacity, RecordAlign);
+  size_t dataOffset = Align(sizeof(Control), 64);
+  size_t size = dataOffset + capacity;
+
+  int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+  {
+    std::cerr << "Error creating shared memory [" << _name << "]: "
+              << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  if (ftruncate(fd, size) != 0)
+  {
+    std::cerr << "Error sizing shared memory [" << _name << "]: "
+              << strerror(errno) << std::endl;
+    close(fd);
+    shm_unlink(_name.c_str());
+    return -1;
+  }
+
+  void *segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED)
+  {
+    std::cerr << "Error mapping shared memory [" << _name << "]: "
+              << strerror(errno) << std::endl;
+    shm_unlink(_name.c_str());
+    return -1;
+  }
+
+  this->name = _name;
+  this->owner = true;
+  this->segment = segment;
+  this->segmentSize = size;
+  this->control = new (segment) Control();
+  this->data = static_cast<char*>(segment) + dataOffset;
+  this->capacity = capacity;
+  this->position = 0;
+
+  this->control->capacity = capacity;
+  this->control->readers = 0;
+  this->control->reserved = 0;
+  this->control->committed = 0;
+
+  // The readers ignore the segment until it is initialized
+  this->control->magic.store(ShmMagic, std::memory_order_release);
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+int transport::ShmRing::Open(const std::string &_name)
+{
+  if (this->segment)
+    return -1;
+
+  int fd = shm_open(_name.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  size_t dataOffset = Align(sizeof(Control), 64);
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) <= dataOffset)
+  {
+    close(fd);
+    return -1;
+  }
+
+  size_t size = st.st_size;
+  void *segment = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED)
+  {
+    std::cerr << "Error mapping shared memory [" << _name << "]: "
+              << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  Control *control = static_cast<Control*>(segment);
+  if (control->magic.load(std::memory_order_acquire) != ShmMagic ||
+      control->capacity == 0 ||
+      control->capacity % RecordAlign != 0 ||
+      dataOffset + control->capacity > size)
+  {
+    munmap(segment, size);
+    return -1;
+  }
+
+  this->name = _name;
+  this->owner = false;
+  this->segment = segment;
+  this->segmentSize = size;
+  this->control = control;
+  this->data = static_cast<char*>(segment) + dataOffset;
+  this->capacity = control->capacity;
+  this->position = control->committed.load(std::memory_order_acquire);
+  this->lastRead = this->position;
+  ++this->control->readers;
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+int transport::ShmRing::Write(const std::string &_topic, const char *_data,
+                              size_t _size)
+{
+  return this->Write(_topic, nullptr, 0, _data, _size);
+}
+
+//////////////////////////////////////////////////
+int transport::ShmRing::Write(const std::string &_topic, const char *_prefix,
+                              size_t _prefixSize, const char *_data,
+                              size_t _size)
+{
+  if (!this->owner)
+    return -1;
+
+  // Leave room for the readers that are behind
+  uint64_t dataSize = _prefixSize + _size;
+  uint64_t size = Align(sizeof(RecordHeader) + _topic.size() + dataSize,
+                        RecordAlign);
+  if (size > this->capacity / 2)
+    return -1;
+
+  // A record never wraps around, the space left at the end is skipped
+  uint64_t offset = this->position % this->capacity;
+  uint64_t padding = 0;
+  if (offset + size > this->capacity)
+    padding = this->capacity - offset;
+  uint64_t end = this->position + padding + size;
+
+  // Tell the readers which data is about to be overwritten
+  this->control->reserved.store(end, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  RecordHeader header;
+  if (padding > 0)
+  {
+    header.size = padding;
+    header.topicSize = PaddingRecord;
+    header.dataSize = 0;
+    memcpy(this->data + offset, &header, sizeof(header));
+    offset = 0;
+  }
+
+  header.size = size;
+  header.topicSize = _topic.size();
+  header.dataSize = dataSize;
+  char *record = this->data + offset;
+  memcpy(record, &header, sizeof(header));
+  record += sizeof(header);
+  memcpy(record, _topic.data(), _topic.size());
+  record += _topic.size();
+  if (_prefixSize > 0)
+    memcpy(record, _prefix, _prefixSize);
+  memcpy(record + _prefixSize, _data, _size);
+
+  this->control->committed.store(end, std::memory_order_release);
+  this->position = end;
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+bool transport::ShmRing::Read(std::string &_topic, const char *&_data,
+                              size_t &_size)
+{
+  if (!this->segment || this->owner)
+    return false;
+
+  while (true)
+  {
+    uint64_t committed =
+      this->control->committed.load(std::memory_order_acquire);
+    if (this->position == committed)
+      return false;
+
+    // The writer lapped this reader
+    if (committed - this->position > this->capacity)
+    {
+      ++this->overruns;
+      this->position = committed;
+      continue;
+    }
+
+    uint64_t offset = this->position % this->capacity;
+    RecordHeader header;
+    memcpy(&header, this->data + offset, sizeof(header));
+    this->lastRead = this->position;
+
+    // Discard the header if it was overwritten while reading it or it is not
+    // consistent
+    if (!this->Intact() ||
+        header.size < sizeof(header) ||
+        header.size % RecordAlign != 0 ||
+        header.size > this->capacity - offset ||
+        (header.topicSize != PaddingRecord &&
+         sizeof(header) + header.topicSize + header.dataSize > header.size))
+    {
+      ++this->overruns;
+      this->position = committed;
+      continue;
+    }
+
+    this->position += header.size;
+    if (header.topicSize == PaddingRecord)
+      continue;
+
+    const char *record = this->data + offset + sizeof(header);
+    _topic.assign(record, header.topicSize);
+    _data = record + header.topicSize;
+    _size = header.dataSize;
+
+    return true;
+  }
+}
+
+//////////////////////////////////////////////////
+bool transport::ShmRing::Intact() const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t reserved = this->control->reserved.load(std::memory_order_relaxed);
+  return reserved - this->lastRead <= this->capacity;
+}
+
+//////////////////////////////////////////////////
+void transport::ShmRing::RemoveStale(const std::string &_prefix)
+{
+  // The POSIX shared memory objects are listed in /dev/shm
+  DIR *dir = opendir("/dev/shm");
+  if (!dir)
+    return;
+
+  std::string prefix = _prefix.substr(_prefix.find_first_not_of('/'));
+  while (struct dirent *entry = readdir(dir))
+  {
+    std::string name = entry->d_name;
+    if (name.compare(0, prefix.size(), prefix) != 0)
+      continue;
+
+    char *end;
+    long pid = strtol(name.c_str() + prefix.size(), &end, 10);
+    if (pid <= 0 || *end != '-')
+      continue;
+
+    if (kill(pid, 0) != 0 && errno == ESRCH)
+      shm_unlink(("/" + name).c_str());
+  }
+
+  closedir(dir);
+}
+
+//////////////////////////////////////////////////
+std::string transport::ShmRing::GetName() const
+{
+  return this->name;
+}
+
+//////////////////////////////////////////////////
+size_t transport::ShmRing::GetCapacity() const
+{
+  return this->capacity;
+}
+
+//////////////////////////////////////////////////
+uint32_t transport::ShmRing::GetReaders() const
+{
+  return this->control ? this->control->readers.load() : 0;
+}
+
+//////////////////////////////////////////////////
+uint64_t transport::ShmRing::GetOverruns() const
+{
+  return this->overruns;
+}
+
+//////////////////////////////////////////////////
+void transport::ShmRing::Close()
+{
+  if (!this->segment)
+    return;
+
+  if (this->owner)
+    shm_unlink(this->name.c_str());
+  else
+    --this->control->readers;
+  munmap(this->segment, this->segmentSize);
+
+  this->segment = nullptr;
+  this->control = nullptr;
+  this->data = nullptr;
+}
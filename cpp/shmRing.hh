@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#ifndef __SHM_RING_HH_INCLUDED__
+#define __SHM_RING_HH_INCLUDED__
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace transport
+{
+  /// \brief Ring buffer in POSIX shared memory used to deliver topic updates
+  /// to the subscribers running on the same host. There is one writer and
+  /// any number of readers. The writer never waits: every reader keeps its
+  /// own position and detects when the writer overwrote the data it had not
+  /// read yet. An update is written once and the reader copies it out once:
+  /// since the writer can overwrite a record while it is read, the reader
+  /// checks the copy with Intact() and only then hands it to the callbacks.
+  /// Reading in place would expose the callbacks to torn data.
+  class ShmRing
+  {
+    /// \brief Constructor.
+    public: ShmRing();
+
+    /// \brief Destructor. The segment is removed if it was created by this
+    /// object.
+    public: virtual ~ShmRing();
+
+    /// \brief Create a new shared memory segment and become its writer.
+    /// \param[in] _name Name of the segment (e.g. "/dzmq-<pid>-<guid>"). It
+    /// is only accessible by the user that creates it.
+    /// \param[in] _capacity Size of the ring (bytes). It is rounded up to a
+    /// multiple of the record alignment.
+    /// \return 0 when success.
+    public: int Create(const std::string &_name, size_t _capacity);
+
+    /// \brief Attach to an existing segment as a reader. Only the updates
+    /// written after this call will be read.
+    /// \param[in] _name Name of the segment.
+    /// \return 0 when success.
+    public: int Open(const std::string &_name);
+
+    /// \brief Write a topic update. Only the writer can call this method.
+    /// \param[in] _topic Topic name.
+    /// \param[in] _data Pointer to the data.
+    /// \param[in] _size Size of the data.
+    /// \return 0 when success or -1 if the update does not fit in the ring.
+    public: int Write(const std::string &_topic, const char *_data,
+                      size_t _size);
+
+    /// \brief Write a topic update made of two consecutive blocks, the
+    /// readers see them as a single block of data.
+    /// \param[in] _topic Topic name.
+    /// \param[in] _prefix Pointer to the first block.
+    /// \param[in] _prefixSize Size of the first block.
+    /// \param[in] _data Pointer to the second block.
+    /// \param[in] _size Size of the second block.
+    /// \return 0 when success or -1 if the update does not fit in the ring.
+    public: int Write(const std::string &_topic, const char *_prefix,
+                      size_t _prefixSize, const char *_data, size_t _size);
+
+    /// \brief Read the next topic update. The data is not copied, so the
+    /// pointer references the shared memory. Copy the data and call Intact()
+    /// afterwards to check that the writer did not overwrite it in the
+    /// meantime, before using the copy.
+    /// \param[out] _topic Topic name.
+    /// \param[out] _data Pointer to the data.
+    /// \param[out] _size Size of the data.
+    /// \return true if an update was read or false if there are no updates.
+    public: bool Read(std::string &_topic, const char *&_data, size_t &_size);
+
+    /// \brief Check that the update returned by the last Read() call has not
+    /// been overwritten by the writer.
+    /// \return true if the update is still intact.
+    public: bool Intact() const;
+
+    /// \brief Remove the segments left by the writers that crashed. The
+    /// segments are named "<_prefix><pid>-...", and the ones whose process
+    /// does not exist anymore are unlinked.
+    /// \param[in] _prefix Prefix of the segment names (e.g. "/dzmq-").
+    public: static void RemoveStale(const std::string &_prefix);
+
+    /// \brief Get the name of the segment.
+    /// \return Name of the segment.
+    public: std::string GetName() const;
+
+    /// \brief Get the capacity of the ring.
+    /// \return Capacity (bytes).
+    public: size_t GetCapacity() const;
+
+    /// \brief Get the number of readers attached to the segment. A reader
+    /// that crashed is never detached, so the value is an upper bound.
+    /// \return Number of readers.
+    public: uint32_t GetReaders() const;
+
+    /// \brief Get the number of times that this reader was overrun by the
+    /// writer and lost updates.
+    /// \return Number of overruns.
+    public: uint64_t GetOverruns() const;
+
+    /// \brief Unmap the segment.
+    private: void Close();
+
+    /// \brief Control block at the beginning of the segment.
+    private: struct Control
+    {
+      /// \brief Identifies an initialized segment.
+      std::atomic<uint32_t> magic;
+
+      /// \brief Size of the ring (bytes).
+      uint64_t capacity;
+
+      /// \brief Number of readers attached.
+      std::atomic<uint32_t> readers;
+
+      /// \brief Position up to which the writer may be modifying data.
+      alignas(64) std::atomic<uint64_t> reserved;
+
+      /// \brief Position up to which the data is complete.
+      alignas(64) std::atomic<uint64_t> committed;
+    };
+
+    /// \brief Name of the segment.
+    private: std::string name;
+
+    /// \brief true if this object created the segment.
+    private: bool owner;
+
+    /// \brief Mapped segment.
+    private: void *segment;
+
+    /// \brief Size of the mapped segment.
+    private: size_t segmentSize;
+
+    /// \brief Control block in the segment.
+    private: Control *control;
+
+    /// \brief Ring data in the segment.
+    private: char *data;
+
+    /// \brief Size of the ring (bytes).
+    private: uint64_t capacity;
+
+    /// \brief Position of the next record to read or write.
+    private: uint64_t position;
+
+    /// \brief Position of the last record read.
+    private: uint64_t lastRead;
+
+    /// \brief Number of overruns of this reader.
+    private: uint64_t overruns;
+  };
+}
+
+#endif
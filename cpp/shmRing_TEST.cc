@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include "shmRing.hh"
+#include "gtest/gtest.h"
+
+//////////////////////////////////////////////////
+/// \brief Get a segment name not used by other tests running at once.
+std::string SegmentName()
+{
+  return "/dzmq-test-" + std::to_string(getpid());
+}
+
+//////////////////////////////////////////////////
+TEST(ShmRingTest, WriteRead)
+{
+  transport::ShmRing writer;
+  EXPECT_EQ(writer.Create(SegmentName(), 1000), 0);
+  EXPECT_EQ(writer.GetCapacity(), 1008u);
+  EXPECT_NE(writer.Create(SegmentName(), 1000), 0);
+
+  transport::ShmRing reader;
+  EXPECT_EQ(reader.Open(SegmentName()), 0);
+  EXPECT_EQ(reader.GetName(), SegmentName());
+  EXPECT_EQ(reader.GetCapacity(), writer.GetCapacity());
+  EXPECT_EQ(writer.GetReaders(), 1u);
+  {
+    transport::ShmRing reader2;
+    EXPECT_EQ(reader2.Open(SegmentName()), 0);
+    EXPECT_EQ(writer.GetReaders(), 2u);
+  }
+  EXPECT_EQ(writer.GetReaders(), 1u);
+
+  std::string topic;
+  const char *data;
+  size_t size;
+  EXPECT_FALSE(reader.Read(topic, data, size));
+
+  // The writer cannot read and the reader cannot write
+  std::string binary("some\0Data", 9);
+  EXPECT_NE(reader.Write("foo", binary.data(), binary.size()), 0);
+  EXPECT_EQ(writer.Write("foo", binary.data(), binary.size()), 0);
+  EXPECT_FALSE(writer.Read(topic, data, size));
+
+  EXPECT_TRUE(reader.Read(topic, data, size));
+  EXPECT_EQ(topic, "foo");
+  EXPECT_EQ(std::string(data, size), binary);
+  EXPECT_TRUE(reader.Intact());
+  EXPECT_FALSE(reader.Read(topic, data, size));
+
+  // Two blocks are read back as one
+  EXPECT_EQ(writer.Write("bar", "head", 4, binary.data(), binary.size()), 0);
+  EXPECT_TRUE(reader.Read(topic, data, size));
+  EXPECT_EQ(topic, "bar");
+  EXPECT_EQ(std::string(data, size), "head" + binary);
+
+  // Too large for the ring
+  std::string large(600, 'x');
+  EXPECT_NE(writer.Write("foo", large.data(), large.size()), 0);
+}
+
+//////////////////////////////////////////////////
+TEST(ShmRingTest, WrapAround)
+{
+  transport::ShmRing writer;
+  EXPECT_EQ(writer.Create(SegmentName(), 1024), 0);
+  transport::ShmRing reader;
+  EXPECT_EQ(reader.Open(SegmentName()), 0);
+
+  std::string topic;
+  const char *data;
+  size_t size;
+
+  // The records do not divide the ring evenly, so some of them are written
+  // after a padding record.
+  for (int i = 0; i < 100; ++i)
+  {
+    std::string msg(100 + i, 'a' + i % 26);
+    EXPECT_EQ(writer.Write("bar", msg.data(), msg.size()), 0);
+    ASSERT_TRUE(reader.Read(topic, data, size));
+    EXPECT_EQ(topic, "bar");
+    EXPECT_EQ(std::string(data, size), msg);
+    EXPECT_TRUE(reader.Intact());
+  }
+  EXPECT_EQ(reader.GetOverruns(), 0u);
+}
+
+//////////////////////////////////////////////////
+TEST(ShmRingTest, Overrun)
+{
+  transport::ShmRing writer;
+  EXPECT_EQ(writer.Create(SegmentName(), 1024), 0);
+  transport::ShmRing reader;
+  EXPECT_EQ(reader.Open(SegmentName()), 0);
+
+  std::string topic;
+  const char *data;
+  size_t size;
+  std::string msg(200, 'x');
+
+  // The reader detects that the data it was reading was overwritten
+  EXPECT_EQ(writer.Write("foo", msg.data(), msg.size()), 0);
+  EXPECT_TRUE(reader.Read(topic, data, size));
+  for (int i = 0; i < 5; ++i)
+    EXPECT_EQ(writer.Write("foo", msg.data(), msg.size()), 0);
+  EXPECT_FALSE(reader.Intact());
+
+  // The reader was lapped, so it skips to the last update written
+  EXPECT_FALSE(reader.Read(topic, data, size));
+  EXPECT_GT(reader.GetOverruns(), 0u);
+  EXPECT_EQ(writer.Write("foo", msg.data(), msg.size()), 0);
+  EXPECT_TRUE(reader.Read(topic, data, size));
+  EXPECT_TRUE(reader.Intact());
+}
+
+//////////////////////////////////////////////////
+TEST(ShmRingTest, OpenMissing)
+{
+  transport::ShmRing reader;
+  EXPECT_NE(reader.Open(SegmentName()), 0);
+
+  // The segment is removed with its writer
+  {
+    transport::ShmRing writer;
+    EXPECT_EQ(writer.Create(SegmentName(), 1024), 0);
+  }
+  EXPECT_NE(reader.Open(SegmentName()), 0);
+}
+
+//////////////////////////////////////////////////
+TEST(ShmRingTest, RemoveStale)
+{
+  // Get the pid of a process that does not exist anymore
+  pid_t pid = fork();
+  if (pid == 0)
+    _exit(0);
+  ASSERT_GT(pid, 0);
+  waitpid(pid, nullptr, 0);
+
+  // Segment of a crashed writer and segment of a running one
+  std::string prefix = "/dzmq-test-stale-";
+  std::string stale = prefix + std::to_string(pid) + "-a";
+  std::string alive = prefix + std::to_string(getpid()) + "-b";
+  transport::ShmRing writer;
+  EXPECT_EQ(writer.Create(stale, 1000), 0);
+  transport::ShmRing writer2;
+  EXPECT_EQ(writer2.Create(alive, 1000), 0);
+
+  transport::ShmRing::RemoveStale(prefix);
+
+  transport::ShmRing reader;
+  EXPECT_NE(reader.Open(stale), 0);
+  EXPECT_EQ(reader.Open(alive), 0);
+}
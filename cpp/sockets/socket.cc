@@ -296,8 +296,9 @@ UDPSocket::UDPSocket(unsigned short localPort)  throw(SocketException) :
 
 UDPSocket::UDPSocket(const string &localAddress, unsigned short localPort)
      throw(SocketException) : CommunicatingSocket(SOCK_DGRAM, IPPROTO_UDP) {
-  setLocalAddressAndPort(localAddress, localPort);
+  // The address is reused only if the option is set before binding
   setBroadcast();
+  setLocalAddressAndPort(localAddress, localPort);
 }
 
 void UDPSocket::setBroadcast() {
@@ -363,23 +364,51 @@ void UDPSocket::setMulticastTTL(unsigned char multicastTTL) throw(SocketExceptio
   }
 }
 
-void UDPSocket::joinGroup(const string &multicastGroup) throw(SocketException) {
+void UDPSocket::setMulticastInterface(const string &interfaceAddress)
+    throw(SocketException) {
+  struct in_addr localInterface;
+
+  localInterface.s_addr = inet_addr(interfaceAddress.c_str());
+  if (setsockopt(sockDesc, IPPROTO_IP, IP_MULTICAST_IF,
+                 (raw_type *) &localInterface, sizeof(localInterface)) < 0) {
+    throw SocketException("Multicast interface set failed (setsockopt())",
+                          true);
+  }
+}
+
+void UDPSocket::joinGroup(const string &multicastGroup,
+    const string &interfaceAddress) throw(SocketException) {
   struct ip_mreq multicastRequest;
 
   multicastRequest.imr_multiaddr.s_addr = inet_addr(multicastGroup.c_str());
-  multicastRequest.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (interfaceAddress.empty())
+    multicastRequest.imr_interface.s_addr = htonl(INADDR_ANY);
+  else
+    multicastRequest.imr_interface.s_addr = inet_addr(interfaceAddress.c_str());
   if (setsockopt(sockDesc, IPPROTO_IP, IP_ADD_MEMBERSHIP,
                  (raw_type *) &multicastRequest,
                  sizeof(multicastRequest)) < 0) {
     throw SocketException("Multicast group join failed (setsockopt())", true);
   }
+
+#ifdef IP_MULTICAST_ALL
+  // Linux delivers the datagrams of every group joined on the host to all
+  // the sockets bound to the port. Keep the groups apart.
+  int multicastAll = 0;
+  setsockopt(sockDesc, IPPROTO_IP, IP_MULTICAST_ALL,
+             (raw_type *) &multicastAll, sizeof(multicastAll));
+#endif
 }
 
-void UDPSocket::leaveGroup(const string &multicastGroup) throw(SocketException) {
+void UDPSocket::leaveGroup(const string &multicastGroup,
+    const string &interfaceAddress) throw(SocketException) {
   struct ip_mreq multicastRequest;
 
   multicastRequest.imr_multiaddr.s_addr = inet_addr(multicastGroup.c_str());
-  multicastRequest.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (interfaceAddress.empty())
+    multicastRequest.imr_interface.s_addr = htonl(INADDR_ANY);
+  else
+    multicastRequest.imr_interface.s_addr = inet_addr(interfaceAddress.c_str());
   if (setsockopt(sockDesc, IPPROTO_IP, IP_DROP_MEMBERSHIP,
                  (raw_type *) &multicastRequest,
                  sizeof(multicastRequest)) < 0) {
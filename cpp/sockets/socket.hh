@@ -319,18 +319,33 @@ public:
   void setMulticastTTL(unsigned char multicastTTL) throw(SocketException);
 
   /**
-   *   Join the specified multicast group
+   *   Set the interface used to send multicast datagrams
+   *   @param interfaceAddress IPv4 address of the interface
+   *   @exception SocketException thrown if unable to set the interface
+   */
+  void setMulticastInterface(const string &interfaceAddress)
+      throw(SocketException);
+
+  /**
+   *   Join the specified multicast group. Only the datagrams of the groups
+   *   joined by this socket are received, not those of other sockets.
    *   @param multicastGroup multicast group address to join
+   *   @param interfaceAddress IPv4 address of the interface that joins the
+   *          group, or empty to let the system choose
    *   @exception SocketException thrown if unable to join group
    */
-  void joinGroup(const string &multicastGroup) throw(SocketException);
+  void joinGroup(const string &multicastGroup,
+                 const string &interfaceAddress = "") throw(SocketException);
 
   /**
    *   Leave the specified multicast group
    *   @param multicastGroup multicast group address to leave
+   *   @param interfaceAddress IPv4 address of the interface that joined the
+   *          group, or empty if the system chose it
    *   @exception SocketException thrown if unable to leave group
    */
-  void leaveGroup(const string &multicastGroup) throw(SocketException);
+  void leaveGroup(const string &multicastGroup,
+                  const string &interfaceAddress = "") throw(SocketException);
 
 private:
   void setBroadcast();
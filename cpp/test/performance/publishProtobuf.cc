@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <google/protobuf/wrappers.pb.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "../../discZmq.hh"
+#include "gtest/gtest.h"
+
+/// \brief Bytes serialized per message size and publishing path.
+const size_t BytesPerRun = 64 * 1024 * 1024;
+
+//////////////////////////////////////////////////
+/// \brief Callback of the subscriber. The updates are not processed.
+void RawCb(const std::string &, const char *, size_t)
+{
+}
+
+//////////////////////////////////////////////////
+/// \brief Get the average time (usecs) of publishing a message.
+/// \param[in] _publish Function that publishes one message.
+/// \param[in] _iterations Number of messages to publish.
+/// \return Average time per message.
+template<typename F> double Measure(F _publish, size_t _iterations)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < _iterations; ++i)
+    _publish();
+  std::chrono::duration<double, std::micro> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  return elapsed.count() / _iterations;
+}
+
+//////////////////////////////////////////////////
+/// \brief Compare publishing a protobuf message through a temporary string
+/// with serializing it straight into the outgoing frame.
+TEST(PublishProtobufTest, SerializationPaths)
+{
+  std::string master = "";
+  bool verbose = false;
+  std::string topic = "foo";
+
+  transport::Node node(master, verbose);
+  EXPECT_EQ(node.Advertise(topic), 0);
+
+  // Without subscribers nothing would be serialized
+  EXPECT_EQ(node.Subscribe(topic, RawCb), 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_TRUE(node.HasSubscribers(topic));
+
+  printf("%12s %12s %16s %16s\n", "size (B)", "iterations", "string (us)",
+         "frame (us)");
+
+  for (size_t size = 64; size <= 4 * 1024 * 1024; size *= 4)
+  {
+    google::protobuf::BytesValue msg;
+    msg.set_value(std::string(size, 'x'));
+    size_t iterations = std::max<size_t>(BytesPerRun / size, 100);
+
+    // Serialize into a string, then publish a copy of it
+    double stringTime = Measure([&]()
+    {
+      std::string data;
+      msg.SerializeToString(&data);
+      node.Publish(topic, data);
+    }, iterations);
+
+    // Serialize into the frame
+    double frameTime = Measure([&]()
+    {
+      node.Publish(topic, msg);
+    }, iterations);
+
+    printf("%12zu %12zu %16.3f %16.3f\n", size, iterations, stringTime,
+           frameTime);
+  }
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include "../../topicsInfo.hh"
+#include "gtest/gtest.h"
+
+/// \brief Lookups measured per number of topics.
+const size_t Lookups = 2000000;
+
+//////////////////////////////////////////////////
+/// \brief Get the average time (nsecs) of a lookup.
+/// \param[in] _lookup Function that looks up a topic and returns if it is
+/// subscribed.
+/// \param[in] _topics Topic names, looked up in round robin.
+/// \return Average time per lookup.
+template<typename F> double Measure(F _lookup,
+                                    const std::vector<std::string> &_topics)
+{
+  size_t hits = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < Lookups; ++i)
+    hits += _lookup(_topics[i % _topics.size()]);
+  std::chrono::duration<double, std::nano> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  // Every topic is subscribed
+  EXPECT_EQ(hits, Lookups);
+
+  return elapsed.count() / Lookups;
+}
+
+//////////////////////////////////////////////////
+/// \brief Compare the lookups of a std::map of TopicInfo pointers, as the
+/// original TopicsInfo, with the interned hash table of TopicsInfo.
+TEST(TopicsInfoTest, Lookup)
+{
+  printf("%10s %16s %16s\n", "topics", "std::map (ns)", "TopicsInfo (ns)");
+
+  for (size_t numTopics : {10, 1000, 100000})
+  {
+    std::vector<std::string> names;
+    for (size_t i = 0; i < numTopics; ++i)
+      names.push_back("/robot/sensors/camera_" + std::to_string(i));
+
+    std::map<std::string, transport::TopicInfo*> map;
+    transport::TopicsInfo topics;
+    for (auto &name : names)
+    {
+      map[name] = new transport::TopicInfo();
+      map[name]->subscribed = true;
+      topics.SetSubscribed(name, true);
+    }
+
+    // The original accessors checked the key and then used operator[]
+    double mapTime = Measure([&map](const std::string &_topic)
+    {
+      if (map.find(_topic) == map.end())
+        return false;
+      return map[_topic]->subscribed;
+    }, names);
+
+    double topicsTime = Measure([&topics](const std::string &_topic)
+    {
+      return topics.Subscribed(_topic);
+    }, names);
+
+    printf("%10zu %16.1f %16.1f\n", numTopics, mapTime, topicsTime);
+
+    for (auto &entry : map)
+      delete entry.second;
+  }
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+
+#include "../discZmq.hh"
+#include "../hostAgent.hh"
+
+namespace po = boost::program_options;
+
+//////////////////////////////////////////////////
+/// \brief Print program usage.
+void PrintUsage(const po::options_description &_options)
+{
+  std::cout << "Usage: agent [options]\n"
+            << _options << "\n";
+}
+
+//////////////////////////////////////////////////
+/// \brief Read the command line arguments.
+int ReadArgs(int argc, char *argv[], bool &_verbose, std::string &_endpoint,
+             int &_port, std::string &_group, int &_ttl, std::string &_iface,
+             int &_lease)
+{
+  // Optional arguments
+  po::options_description visibleDesc("Options");
+  visibleDesc.add_options()
+    ("help,h", "Produce help message")
+    ("verbose,v", "Enable verbose mode")
+    ("endpoint,e",
+       po::value<std::string>(&_endpoint)->default_value(
+         transport::HostAgentDefaultEndpoint),
+       "Set the endpoint where the local nodes connect (DZMQ_HOST_AGENT)")
+    ("port,p", po::value<int>(&_port)->default_value(
+       transport::DefaultDiscoveryPort),
+       "Set the UDP port of the network discovery")
+    ("group,g", po::value<std::string>(&_group)->default_value(""),
+       "Set the multicast group used instead of broadcast")
+    ("ttl,t", po::value<int>(&_ttl)->default_value(
+       transport::DefaultMulticastTTL),
+       "Set the TTL of the multicast discovery messages")
+    ("interface,i", po::value<std::string>(&_iface)->default_value(""),
+       "Set the IPv4 address of the interface used for multicast")
+    ("lease,l", po::value<int>(&_lease)->default_value(
+       transport::RegistryDefaultLeaseTimeout),
+       "Set the time without news from a node before it is removed (msecs)");
+
+  po::variables_map vm;
+
+  try
+  {
+    po::store(po::command_line_parser(argc, argv).
+              options(visibleDesc).run(), vm);
+    po::notify(vm);
+  }
+  catch(boost::exception &_e)
+  {
+    PrintUsage(visibleDesc);
+    return -1;
+  }
+
+  if (vm.count("help"))
+  {
+    PrintUsage(visibleDesc);
+    return -1;
+  }
+
+  _verbose = false;
+  if (vm.count("verbose"))
+    _verbose = true;
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+  // Read the command line arguments
+  std::string endpoint;
+  std::string group;
+  std::string iface;
+  bool verbose;
+  int port;
+  int ttl;
+  int lease;
+  if (ReadArgs(argc, argv, verbose, endpoint, port, group, ttl, iface,
+               lease) != 0)
+  {
+    return -1;
+  }
+
+  // Discovery agent of the host
+  transport::HostAgent agent(endpoint, port, group, verbose, ttl, iface);
+  agent.SetLeaseTimeout(lease);
+  agent.Spin();
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+
+#include "../registry.hh"
+
+namespace po = boost::program_options;
+
+//////////////////////////////////////////////////
+/// \brief Print program usage.
+void PrintUsage(const po::options_description &_options)
+{
+  std::cout << "Usage: registry [options]\n"
+            << _options << "\n";
+}
+
+//////////////////////////////////////////////////
+/// \brief Read the command line arguments.
+int ReadArgs(int argc, char *argv[], bool &_verbose, std::string &_endpoint,
+             int &_lease)
+{
+  // Optional arguments
+  po::options_description visibleDesc("Options");
+  visibleDesc.add_options()
+    ("help,h", "Produce help message")
+    ("verbose,v", "Enable verbose mode")
+    ("endpoint,e",
+       po::value<std::string>(&_endpoint)->default_value("tcp://*:11312"),
+       "Set the endpoint where the nodes connect (their master endpoint)")
+    ("lease,l", po::value<int>(&_lease)->default_value(
+       transport::RegistryDefaultLeaseTimeout),
+       "Set the time without news from a node before it is removed (msecs)");
+
+  po::variables_map vm;
+
+  try
+  {
+    po::store(po::command_line_parser(argc, argv).
+              options(visibleDesc).run(), vm);
+    po::notify(vm);
+  }
+  catch(boost::exception &_e)
+  {
+    PrintUsage(visibleDesc);
+    return -1;
+  }
+
+  if (vm.count("help"))
+  {
+    PrintUsage(visibleDesc);
+    return -1;
+  }
+
+  _verbose = false;
+  if (vm.count("verbose"))
+    _verbose = true;
+
+  return 0;
+}
+
+//////////////////////////////////////////////////
+int main(int argc, char *argv[])
+{
+  // Read the command line arguments
+  std::string endpoint;
+  bool verbose;
+  int lease;
+  if (ReadArgs(argc, argv, verbose, endpoint, lease) != 0)
+    return -1;
+
+  // Discovery registry
+  transport::Registry registry(endpoint, verbose);
+  registry.SetLeaseTimeout(lease);
+  registry.Spin();
+
+  return 0;
+}
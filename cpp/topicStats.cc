@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include "topicStats.hh"
+
+//////////////////////////////////////////////////
+const int transport::LatencyHistogram::PrecisionBits;
+const int64_t transport::LatencyHistogram::MaxValue;
+const int transport::LatencyHistogram::NumBuckets;
+
+//////////////////////////////////////////////////
+transport::LatencyHistogram::LatencyHistogram()
+  : count(0),
+    max(0)
+{
+  for (auto &bucket : this->buckets)
+    bucket.store(0, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////
+void transport::LatencyHistogram::Record(int64_t _value)
+{
+  _value = std::min(std::max(_value, int64_t(0)), MaxValue);
+
+  this->buckets[GetIndex(_value)].fetch_add(1, std::memory_order_relaxed);
+  this->count.fetch_add(1, std::memory_order_relaxed);
+
+  int64_t max = this->max.load(std::memory_order_relaxed);
+  while (_value > max &&
+         !this->max.compare_exchange_weak(max, _value,
+                                          std::memory_order_relaxed))
+  {
+  }
+}
+
+//////////////////////////////////////////////////
+uint64_t transport::LatencyHistogram::GetCount() const
+{
+  return this->count.load(std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////
+int64_t transport::LatencyHistogram::GetMax() const
+{
+  return this->max.load(std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////
+int64_t transport::LatencyHistogram::GetPercentile(double _percentile) const
+{
+  // The buckets are read one by one while other threads record values, so
+  // the total is taken from the buckets themselves.
+  uint64_t counts[NumBuckets];
+  uint64_t total = 0;
+  for (int i = 0; i < NumBuckets; ++i)
+  {
+    counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+
+  if (total == 0)
+    return 0;
+
+  _percentile = std::min(std::max(_percentile, 0.0), 100.0);
+  uint64_t target = static_cast<uint64_t>(
+    std::ceil(_percentile / 100.0 * static_cast<double>(total)));
+  target = std::max(target, uint64_t(1));
+
+  uint64_t accumulated = 0;
+  for (int i = 0; i < NumBuckets; ++i)
+  {
+    accumulated += counts[i];
+    if (accumulated >= target)
+      return std::min(GetUpperBound(i), this->GetMax());
+  }
+
+  return this->GetMax();
+}
+
+//////////////////////////////////////////////////
+int transport::LatencyHistogram::GetIndex(int64_t _value)
+{
+  // Values below 2^(PrecisionBits + 1) have a bucket each. Above, a value
+  // in [2^e, 2^(e + 1)) drops the (e - PrecisionBits) lowest bits.
+  int msb = 63 - __builtin_clzll(static_cast<uint64_t>(_value) | 1);
+  int shift = std::max(msb - PrecisionBits, 0);
+  return (shift << PrecisionBits) + static_cast<int>(_value >> shift);
+}
+
+//////////////////////////////////////////////////
+int64_t transport::LatencyHistogram::GetUpperBound(int _index)
+{
+  const int subBuckets = 1 << PrecisionBits;
+  int shift = std::max(_index / subBuckets - 1, 0);
+  int64_t base = _index - (shift << PrecisionBits);
+  return ((base + 1) << shift) - 1;
+}
+
+//////////////////////////////////////////////////
+transport::TopicStats::TopicStats()
+  : msgs(0),
+    bytes(0),
+    lost(0),
+    msgRate(0),
+    byteRate(0),
+    p50(0),
+    p99(0),
+    p999(0),
+    max(0)
+{
+}
+
+//////////////////////////////////////////////////
+transport::TopicStatsCollector::TopicStatsCollector()
+  : msgs(0),
+    bytes(0),
+    start(std::chrono::steady_clock::now())
+{
+}
+
+//////////////////////////////////////////////////
+void transport::TopicStatsCollector::Record(size_t _size, int64_t _latency)
+{
+  this->Record(_size);
+  this->latencies.Record(_latency);
+}
+
+//////////////////////////////////////////////////
+void transport::TopicStatsCollector::Record(size_t _size)
+{
+  this->msgs.fetch_add(1, std::memory_order_relaxed);
+  this->bytes.fetch_add(_size, std::memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////
+void transport::TopicStatsCollector::Get(TopicStats &_stats) const
+{
+  _stats.msgs = this->msgs.load(std::memory_order_relaxed);
+  _stats.bytes = this->bytes.load(std::memory_order_relaxed);
+  _stats.p50 = this->latencies.GetPercentile(50);
+  _stats.p99 = this->latencies.GetPercentile(99);
+  _stats.p999 = this->latencies.GetPercentile(99.9);
+  _stats.max = this->latencies.GetMax();
+
+  double elapsed = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - this->start).count();
+  if (elapsed > 0)
+  {
+    _stats.msgRate = _stats.msgs / elapsed;
+    _stats.byteRate = _stats.bytes / elapsed;
+  }
+}
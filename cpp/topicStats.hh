@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#ifndef __TOPIC_STATS_HH_INCLUDED__
+#define __TOPIC_STATS_HH_INCLUDED__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace transport
+{
+  /// \brief Histogram of latencies with a bounded relative error, in the
+  /// style of HdrHistogram. The values are grouped by powers of two and
+  /// every power of two is split in 32 linear buckets, so a value is
+  /// reported with an error below 1/32. The buckets are atomic: any number
+  /// of threads can record values while another one reads them.
+  class LatencyHistogram
+  {
+    /// \brief Number of linear buckets per power of two (log2).
+    public: static const int PrecisionBits = 5;
+
+    /// \brief Largest value recorded (nsecs). Larger values are clamped.
+    public: static const int64_t MaxValue = (int64_t(1) << 40) - 1;
+
+    /// \brief Constructor.
+    public: LatencyHistogram();
+
+    /// \brief Record a value.
+    /// \param[in] _value Value (nsecs). Negative values count as 0.
+    public: void Record(int64_t _value);
+
+    /// \brief Get the number of values recorded.
+    /// \return Number of values.
+    public: uint64_t GetCount() const;
+
+    /// \brief Get the largest value recorded, without rounding.
+    /// \return Largest value (nsecs).
+    public: int64_t GetMax() const;
+
+    /// \brief Get a percentile of the values recorded.
+    /// \param[in] _percentile Percentile in the range [0, 100].
+    /// \return Value (nsecs) equal or above the given percentage of the
+    /// values recorded, rounded up to the end of its bucket.
+    public: int64_t GetPercentile(double _percentile) const;
+
+    /// \brief Get the bucket of a value.
+    /// \param[in] _value Value in the range [0, MaxValue].
+    /// \return Index of the bucket.
+    private: static int GetIndex(int64_t _value);
+
+    /// \brief Get the largest value of a bucket.
+    /// \param[in] _index Index of the bucket.
+    /// \return Largest value.
+    private: static int64_t GetUpperBound(int _index);
+
+    /// \brief Number of buckets.
+    private: static const int NumBuckets =
+      (40 - PrecisionBits + 1) << PrecisionBits;
+
+    /// \brief Number of values of each bucket.
+    private: std::atomic<uint64_t> buckets[NumBuckets];
+
+    /// \brief Number of values recorded.
+    private: std::atomic<uint64_t> count;
+
+    /// \brief Largest value recorded.
+    private: std::atomic<int64_t> max;
+  };
+
+  /// \brief Snapshot of the statistics of a topic.
+  class TopicStats
+  {
+    /// \brief Constructor.
+    public: TopicStats();
+
+    /// \brief Number of updates received.
+    public: uint64_t msgs;
+
+    /// \brief Number of bytes received.
+    public: uint64_t bytes;
+
+    /// \brief Number of updates lost, detected from gaps in the sequence.
+    public: uint64_t lost;
+
+    /// \brief Updates received per second.
+    public: double msgRate;
+
+    /// \brief Bytes received per second.
+    public: double byteRate;
+
+    /// \brief Median publish to callback latency (nsecs), of the updates
+    /// whose latency is known.
+    public: int64_t p50;
+
+    /// \brief 99th percentile of the latency (nsecs).
+    public: int64_t p99;
+
+    /// \brief 99.9th percentile of the latency (nsecs).
+    public: int64_t p999;
+
+    /// \brief Largest latency (nsecs).
+    public: int64_t max;
+  };
+
+  /// \brief Counters and latency histogram of a topic, updated without locks
+  /// from the receive path.
+  class TopicStatsCollector
+  {
+    /// \brief Constructor. The rates are measured from now on.
+    public: TopicStatsCollector();
+
+    /// \brief Record an update.
+    /// \param[in] _size Size of the data (bytes).
+    /// \param[in] _latency Time since the update was published (nsecs).
+    public: void Record(size_t _size, int64_t _latency);
+
+    /// \brief Record an update whose latency is unknown.
+    /// \param[in] _size Size of the data (bytes).
+    public: void Record(size_t _size);
+
+    /// \brief Fill a snapshot with the current statistics. The lost
+    /// updates are not counted here.
+    /// \param[out] _stats Statistics.
+    public: void Get(TopicStats &_stats) const;
+
+    /// \brief Publish to callback latencies.
+    private: LatencyHistogram latencies;
+
+    /// \brief Number of updates received.
+    private: std::atomic<uint64_t> msgs;
+
+    /// \brief Number of bytes received.
+    private: std::atomic<uint64_t> bytes;
+
+    /// \brief Time when the collection started.
+    private: std::chrono::steady_clock::time_point start;
+  };
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2014 Open Source Robotics Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "topicStats.hh"
+#include "gtest/gtest.h"
+
+//////////////////////////////////////////////////
+TEST(TopicStatsTest, Percentiles)
+{
+  transport::LatencyHistogram histogram;
+  EXPECT_EQ(histogram.GetCount(), 0u);
+  EXPECT_EQ(histogram.GetPercentile(50), 0);
+
+  // 1..1000 usecs
+  for (int64_t i = 1; i <= 1000; ++i)
+    histogram.Record(i * 1000);
+
+  EXPECT_EQ(histogram.GetCount(), 1000u);
+  EXPECT_EQ(histogram.GetMax(), 1000000);
+
+  // The error is below 1/32
+  int64_t p50 = histogram.GetPercentile(50);
+  EXPECT_GE(p50, 500000);
+  EXPECT_LE(p50, 500000 + 500000 / 32);
+  int64_t p99 = histogram.GetPercentile(99);
+  EXPECT_GE(p99, 990000);
+  EXPECT_LE(p99, 990000 + 990000 / 32);
+  EXPECT_EQ(histogram.GetPercentile(100), 1000000);
+
+  // The small values are exact and the out of range values are clamped
+  transport::LatencyHistogram small;
+  small.Record(-5);
+  small.Record(7);
+  small.Record(transport::LatencyHistogram::MaxValue + 1);
+  EXPECT_EQ(small.GetPercentile(0), 0);
+  EXPECT_EQ(small.GetPercentile(50), 7);
+  EXPECT_EQ(small.GetMax(), transport::LatencyHistogram::MaxValue);
+}
+
+//////////////////////////////////////////////////
+TEST(TopicStatsTest, ConcurrentRecord)
+{
+  transport::TopicStatsCollector collector;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+  {
+    threads.push_back(std::thread([&collector]()
+    {
+      for (int i = 0; i < 10000; ++i)
+        collector.Record(10, i);
+    }));
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  transport::TopicStats stats;
+  collector.Get(stats);
+  EXPECT_EQ(stats.msgs, 40000u);
+  EXPECT_EQ(stats.bytes, 400000u);
+  EXPECT_EQ(stats.max, 9999);
+  EXPECT_LE(stats.p50, stats.p99);
+  EXPECT_LE(stats.p99, stats.p999);
+  EXPECT_LE(stats.p999, stats.max);
+  EXPECT_GT(stats.msgRate, 0);
+  EXPECT_GT(stats.byteRate, 0);
+}
+
+//////////////////////////////////////////////////
+TEST(TopicStatsTest, UnknownLatency)
+{
+  transport::TopicStatsCollector collector;
+  collector.Record(10, 100);
+  collector.Record(20);
+  collector.Record(30);
+
+  // The updates without latency are counted, not measured
+  transport::TopicStats stats;
+  collector.Get(stats);
+  EXPECT_EQ(stats.msgs, 3u);
+  EXPECT_EQ(stats.bytes, 60u);
+  EXPECT_EQ(stats.max, 100);
+  EXPECT_GT(stats.p50, 0);
+  EXPECT_LE(stats.p50, stats.max);
+}
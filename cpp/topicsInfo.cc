@@ -17,56 +17,157 @@
 
 #include <algorithm>
 #include <string>
+#include "packet.hh"
 #include "topicsInfo.hh"
 
+/// \brief Initial number of slots of the hash table (power of two).
+static const size_t InitialSlots = 16;
+
+/// \brief Identifier of a slot whose topic was removed. The probe sequences
+/// continue past it.
+static const transport::TopicsInfo::TopicId DeletedId = 0xFFFFFFFE;
+
+const transport::TopicsInfo::TopicId transport::TopicsInfo::InvalidId;
+
 //////////////////////////////////////////////////
 transport::TopicInfo::TopicInfo()
 {
+  this->Reset();
+}
+
+//////////////////////////////////////////////////
+transport::TopicInfo::~TopicInfo()
+{
+  this->addresses.clear();
+  this->pendingReqs.clear();
+}
+
+//////////////////////////////////////////////////
+void transport::TopicInfo::Reset()
+{
+  this->addresses.clear();
   this->connected      = false;
   this->subscribed     = false;
   this->advertisedByMe = false;
+  this->hasSubscribers = false;
   this->requested      = false;
+  this->pinned         = false;
+  this->pubSeq         = 0;
+  this->lost           = 0;
   this->cb             = nullptr;
+  this->rawCb          = nullptr;
   this->reqCb          = nullptr;
   this->repCb          = nullptr;
+  this->lastSeqs.clear();
+  this->stats.reset();
+  this->pendingReqs.clear();
 }
 
 //////////////////////////////////////////////////
-transport::TopicInfo::~TopicInfo()
+transport::RemoteNodeInfo::RemoteNodeInfo()
+  : lastSeen(std::chrono::steady_clock::now()),
+    heartbeats(false)
+{
+}
+
+//////////////////////////////////////////////////
+transport::PendingReply::PendingReply()
+  : broadcast(false)
 {
-  this->addresses.clear();
-  this->pendingReqs.clear();
 }
 
 //////////////////////////////////////////////////
 transport::TopicsInfo::TopicsInfo()
+  : slots(InitialSlots, Slot{0, InvalidId}),
+    deletedSlots(0)
 {
 }
 
 //////////////////////////////////////////////////
 transport::TopicsInfo::~TopicsInfo()
 {
-  for (auto topicInfo : this->GetTopicsInfo())
-    delete topicInfo.second;
-
-  this->topicsInfo.clear();
-};
+}
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::HasTopic(const std::string &_topic)
 {
-  return this->topicsInfo.find(_topic) != this->topicsInfo.end();
+  return this->GetTopicInfo(_topic) != nullptr;
+}
+
+//////////////////////////////////////////////////
+transport::TopicInfo *transport::TopicsInfo::GetTopicInfo(
+  const std::string &_topic)
+{
+  return this->GetTopicInfo(this->GetId(_topic));
 }
 
+//////////////////////////////////////////////////
+transport::TopicInfo *transport::TopicsInfo::GetTopicInfo(TopicId _id)
+{
+  if (_id >= this->infos.size() || !this->present[_id])
+    return nullptr;
+
+  return &this->infos[_id];
+}
+
+//////////////////////////////////////////////////
+transport::TopicsInfo::TopicId transport::TopicsInfo::GetId(
+  const std::string &_topic) const
+{
+  size_t hash = std::hash<std::string>()(_topic);
+  size_t mask = this->slots.size() - 1;
+
+  for (size_t i = hash & mask; ; i = (i + 1) & mask)
+  {
+    const Slot &slot = this->slots[i];
+    if (slot.id == InvalidId)
+      return InvalidId;
+
+    if (slot.id != DeletedId && slot.hash == hash &&
+        this->names[slot.id] == _topic)
+    {
+      return slot.id;
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+transport::TopicsInfo::TopicId transport::TopicsInfo::GetIdByHash(
+  uint64_t _hash) const
+{
+  auto it = this->hashIds.find(_hash);
+  return it == this->hashIds.end() ? InvalidId : it->second;
+}
+
+//////////////////////////////////////////////////
+const std::string &transport::TopicsInfo::GetTopicName(TopicId _id) const
+{
+  return this->names.at(_id);
+}
+
+//////////////////////////////////////////////////
+transport::TopicsInfo::TopicId transport::TopicsInfo::GetIdCount() const
+{
+  return this->names.size();
+}
+
+//////////////////////////////////////////////////
+transport::TopicInfo *transport::TopicsInfo::Pin(const std::string &_topic)
+{
+  TopicInfo *topicInfo = this->AddTopic(_topic);
+  topicInfo->pinned = true;
+  return topicInfo;
+}
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::GetAdvAddresses(const std::string &_topic,
                                             TopicInfo::Topics_L &_addresses)
 {
-  if (!this->HasTopic(_topic))
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  if (!topicInfo || topicInfo->addresses.empty())
     return false;
 
-  _addresses = topicsInfo[_topic]->addresses;
+  _addresses = topicInfo->addresses;
   return true;
 }
 
@@ -74,58 +175,63 @@ bool transport::TopicsInfo::GetAdvAddresses(const std::string &_topic,
 bool transport::TopicsInfo::HasAdvAddress(const std::string &_topic,
                                           const std::string &_address)
 {
-  if (!this->HasTopic(_topic))
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  if (!topicInfo)
     return false;
 
-  return std::find(this->topicsInfo[_topic]->addresses.begin(),
-            this->topicsInfo[_topic]->addresses.end(), _address)
-              != this->topicsInfo[_topic]->addresses.end();
+  return std::find(topicInfo->addresses.begin(), topicInfo->addresses.end(),
+                   _address) != topicInfo->addresses.end();
 }
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::Connected(const std::string &_topic)
 {
-  if (!this->HasTopic(_topic))
-    return false;
-
-  return this->topicsInfo[_topic]->connected;
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  return topicInfo && topicInfo->connected;
 }
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::Subscribed(const std::string &_topic)
 {
-  if (!this->HasTopic(_topic))
-    return false;
-
-  return this->topicsInfo[_topic]->subscribed;
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  return topicInfo && topicInfo->subscribed;
 }
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::AdvertisedByMe(const std::string &_topic)
 {
-  if (!this->HasTopic(_topic))
-    return false;
-
-  return this->topicsInfo[_topic]->advertisedByMe;
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  return topicInfo && topicInfo->advertisedByMe;
 }
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::Requested(const std::string &_topic)
 {
-  if (!this->HasTopic(_topic))
-    return false;
-
-  return this->topicsInfo[_topic]->requested;
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  return topicInfo && topicInfo->requested;
 }
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::GetCallback(const std::string &_topic,
                                         TopicInfo::Callback &_cb)
 {
-  if (!this->HasTopic(_topic))
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  if (!topicInfo)
+    return false;
+
+  _cb = topicInfo->cb;
+  return _cb != nullptr;
+}
+
+//////////////////////////////////////////////////
+bool transport::TopicsInfo::GetRawCallback(const std::string &_topic,
+                                           TopicInfo::RawCallback &_cb)
+{
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  if (!topicInfo)
     return false;
 
-  _cb = this->topicsInfo[_topic]->cb;
+  _cb = topicInfo->rawCb;
   return _cb != nullptr;
 }
 
@@ -133,10 +239,11 @@ bool transport::TopicsInfo::GetCallback(const std::string &_topic,
 bool transport::TopicsInfo::GetReqCallback(const std::string &_topic,
                                            TopicInfo::ReqCallback &_cb)
 {
-  if (!this->HasTopic(_topic))
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  if (!topicInfo)
     return false;
 
-  _cb = this->topicsInfo[_topic]->reqCb;
+  _cb = topicInfo->reqCb;
   return _cb != nullptr;
 }
 
@@ -144,36 +251,33 @@ bool transport::TopicsInfo::GetReqCallback(const std::string &_topic,
 bool transport::TopicsInfo::GetRepCallback(const std::string &_topic,
                                            TopicInfo::RepCallback &_cb)
 {
-  if (!this->HasTopic(_topic))
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  if (!topicInfo)
     return false;
 
-  _cb = this->topicsInfo[_topic]->repCb;
+  _cb = topicInfo->repCb;
   return _cb != nullptr;
 }
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::PendingReqs(const std::string &_topic)
 {
-  if (!this->HasTopic(_topic))
-    return false;
-
-  return !this->topicsInfo[_topic]->pendingReqs.empty();
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  return topicInfo && !topicInfo->pendingReqs.empty();
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::AddAdvAddress(const std::string &_topic,
                                           const std::string &_address)
 {
-  // If we don't have the topic registered, add a new TopicInfo
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
+  TopicInfo *topicInfo = this->AddTopic(_topic);
 
   // If we had the topic but not the address, add the new address
-  if (!this->HasAdvAddress(_topic, _address))
-    this->topicsInfo[_topic]->addresses.push_back(_address);
+  if (std::find(topicInfo->addresses.begin(), topicInfo->addresses.end(),
+                _address) == topicInfo->addresses.end())
+  {
+    topicInfo->addresses.push_back(_address);
+  }
 }
 
 //////////////////////////////////////////////////
@@ -181,140 +285,243 @@ void transport::TopicsInfo::RemoveAdvAddress(const std::string &_topic,
                                              const std::string &_address)
 {
   // Remove the address if we have the topic
-  if (this->HasTopic(_topic))
-  {
-    this->topicsInfo[_topic]->addresses.resize(
-      std::remove(this->topicsInfo[_topic]->addresses.begin(),
-        this->topicsInfo[_topic]->addresses.end(), _address) -
-          this->topicsInfo[_topic]->addresses.begin());
-
-    // If the addresses list is empty, just remove the topic info
-    if (this->topicsInfo[_topic]->addresses.empty())
-      this->topicsInfo.erase(_topic);
-  }
+  TopicId id = this->GetId(_topic);
+  TopicInfo *topicInfo = this->GetTopicInfo(id);
+  if (!topicInfo)
+    return;
+
+  topicInfo->addresses.erase(std::remove(topicInfo->addresses.begin(),
+    topicInfo->addresses.end(), _address), topicInfo->addresses.end());
+
+  // If the addresses list is empty, remove the topic unless this node still
+  // uses it.
+  this->Collect(id);
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::SetConnected(const std::string &_topic,
                                          const bool _value)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
-
-  this->topicsInfo[_topic]->connected = _value;
+  TopicInfo *topicInfo = this->FindTopic(_topic, _value);
+  if (topicInfo)
+    topicInfo->connected = _value;
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::SetSubscribed(const std::string &_topic,
                                           const bool _value)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
+  TopicInfo *topicInfo = this->FindTopic(_topic, _value);
+  if (!topicInfo)
+    return;
 
-  this->topicsInfo[_topic]->subscribed = _value;
+  topicInfo->subscribed = _value;
+  this->Collect(this->GetId(_topic));
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::SetRequested(const std::string &_topic,
                                          const bool _value)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
+  TopicInfo *topicInfo = this->FindTopic(_topic, _value);
+  if (!topicInfo)
+    return;
 
-  this->topicsInfo[_topic]->requested = _value;
+  topicInfo->requested = _value;
+  this->Collect(this->GetId(_topic));
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::SetAdvertisedByMe(const std::string &_topic,
                                               const bool _value)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
+  TopicInfo *topicInfo = this->FindTopic(_topic, _value);
+  if (!topicInfo)
+    return;
 
-  this->topicsInfo[_topic]->advertisedByMe = _value;
+  topicInfo->advertisedByMe = _value;
+  this->Collect(this->GetId(_topic));
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::SetCallback(const std::string &_topic,
                                         const TopicInfo::Callback &_cb)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
+  TopicInfo *topicInfo = this->FindTopic(_topic, _cb != nullptr);
+  if (topicInfo)
+    topicInfo->cb = _cb;
+}
 
-  this->topicsInfo[_topic]->cb = _cb;
+//////////////////////////////////////////////////
+void transport::TopicsInfo::SetRawCallback(const std::string &_topic,
+                                           const TopicInfo::RawCallback &_cb)
+{
+  TopicInfo *topicInfo = this->FindTopic(_topic, _cb != nullptr);
+  if (topicInfo)
+    topicInfo->rawCb = _cb;
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::SetReqCallback(const std::string &_topic,
                                            const TopicInfo::ReqCallback &_cb)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
-
-  this->topicsInfo[_topic]->reqCb = _cb;
+  TopicInfo *topicInfo = this->FindTopic(_topic, _cb != nullptr);
+  if (topicInfo)
+    topicInfo->reqCb = _cb;
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::SetRepCallback(const std::string &_topic,
                                            const TopicInfo::RepCallback &_cb)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
-
-  this->topicsInfo[_topic]->repCb = _cb;
+  TopicInfo *topicInfo = this->FindTopic(_topic, _cb != nullptr);
+  if (topicInfo)
+    topicInfo->repCb = _cb;
 }
 
 //////////////////////////////////////////////////
 void transport::TopicsInfo::AddReq(const std::string &_topic,
                                    const std::string &_data)
 {
-  if (!this->HasTopic(_topic))
-  {
-    TopicInfo *topicInfo = new TopicInfo();
-    this->topicsInfo.insert(make_pair(_topic, topicInfo));
-  }
-
-  this->topicsInfo[_topic]->pendingReqs.push_back(_data);
+  this->AddTopic(_topic)->pendingReqs.push_back(_data);
 }
 
 //////////////////////////////////////////////////
 bool transport::TopicsInfo::DelReq(const std::string &_topic,
                                    std::string &_data)
 {
-  if (!this->HasTopic(_topic))
-    return false;
-
-  if (this->topicsInfo[_topic]->pendingReqs.empty())
+  TopicInfo *topicInfo = this->GetTopicInfo(_topic);
+  if (!topicInfo || topicInfo->pendingReqs.empty())
     return false;
 
-  _data = this->topicsInfo[_topic]->pendingReqs.front();
-  this->topicsInfo[_topic]->pendingReqs.pop_front();
+  _data = topicInfo->pendingReqs.front();
+  topicInfo->pendingReqs.pop_front();
+  this->Collect(this->GetId(_topic));
   return true;
 }
 
 //////////////////////////////////////////////////
-transport::TopicInfo::Topics_M& transport::TopicsInfo::GetTopicsInfo()
+transport::TopicInfo *transport::TopicsInfo::AddTopic(
+  const std::string &_topic)
 {
-  return this->topicsInfo;
+  TopicId id = this->Intern(_topic);
+  this->present[id] = true;
+  return &this->infos[id];
+}
+
+//////////////////////////////////////////////////
+transport::TopicInfo *transport::TopicsInfo::FindTopic(
+  const std::string &_topic, bool _create)
+{
+  return _create ? this->AddTopic(_topic) : this->GetTopicInfo(_topic);
+}
+
+//////////////////////////////////////////////////
+void transport::TopicsInfo::Collect(TopicId _id)
+{
+  TopicInfo *topicInfo = this->GetTopicInfo(_id);
+  if (!topicInfo || !topicInfo->addresses.empty() ||
+      topicInfo->advertisedByMe || topicInfo->subscribed ||
+      topicInfo->requested || topicInfo->pinned ||
+      !topicInfo->pendingReqs.empty())
+  {
+    return;
+  }
+
+  // Leave a tombstone in the slot of the name
+  const std::string &topic = this->names[_id];
+  size_t mask = this->slots.size() - 1;
+  size_t i = std::hash<std::string>()(topic) & mask;
+  while (this->slots[i].id != _id)
+    i = (i + 1) & mask;
+  this->slots[i].id = DeletedId;
+  ++this->deletedSlots;
+
+  auto hashId = this->hashIds.find(HashTopic(topic));
+  if (hashId != this->hashIds.end() && hashId->second == _id)
+    this->hashIds.erase(hashId);
+
+  // The identifier is reused by the next name stored
+  this->infos[_id].Reset();
+  this->present[_id] = false;
+  this->names[_id].clear();
+  this->freeIds.push_back(_id);
+}
+
+//////////////////////////////////////////////////
+transport::TopicsInfo::TopicId transport::TopicsInfo::Intern(
+  const std::string &_topic)
+{
+  size_t hash = std::hash<std::string>()(_topic);
+  size_t mask = this->slots.size() - 1;
+
+  // The name is stored in the first tombstone found, if any
+  size_t free = this->slots.size();
+  size_t i = hash & mask;
+  for (; this->slots[i].id != InvalidId; i = (i + 1) & mask)
+  {
+    const Slot &slot = this->slots[i];
+    if (slot.id == DeletedId)
+    {
+      if (free == this->slots.size())
+        free = i;
+    }
+    else if (slot.hash == hash && this->names[slot.id] == _topic)
+      return slot.id;
+  }
+  if (free == this->slots.size())
+    free = i;
+  else
+    --this->deletedSlots;
+
+  // New name. The information is stored next to the name, with the same
+  // identifier.
+  TopicId id;
+  if (!this->freeIds.empty())
+  {
+    id = this->freeIds.back();
+    this->freeIds.pop_back();
+    this->names[id] = _topic;
+  }
+  else
+  {
+    id = this->names.size();
+    this->names.push_back(_topic);
+    this->infos.emplace_back();
+    this->present.push_back(false);
+  }
+  this->hashIds.insert(std::make_pair(HashTopic(_topic), id));
+  this->slots[free] = Slot{hash, id};
+
+  // Keep the load factor, tombstones included, under 1/2, so the probe
+  // sequences are short
+  size_t used = this->names.size() - this->freeIds.size();
+  if (2 * (used + this->deletedSlots) > this->slots.size())
+  {
+    this->Rehash(4 * used > this->slots.size() ?
+                 2 * this->slots.size() : this->slots.size());
+  }
+
+  return id;
+}
+
+//////////////////////////////////////////////////
+void transport::TopicsInfo::Rehash(size_t _size)
+{
+  std::vector<Slot> newSlots(_size, Slot{0, InvalidId});
+  size_t mask = newSlots.size() - 1;
+
+  for (auto &slot : this->slots)
+  {
+    if (slot.id == InvalidId || slot.id == DeletedId)
+      continue;
+
+    size_t i = slot.hash & mask;
+    while (newSlots[i].id != InvalidId)
+      i = (i + 1) & mask;
+    newSlots[i] = slot;
+  }
+
+  this->slots.swap(newSlots);
+  this->deletedSlots = 0;
 }
@@ -18,11 +18,19 @@
 #ifndef __TOPICS_INFO_HH_INCLUDED__
 #define __TOPICS_INFO_HH_INCLUDED__
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <list>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
+#include "topicStats.hh"
 
 namespace transport
 {
@@ -35,6 +43,13 @@ namespace transport
     /// \brief Callback used for receiving topic updates.
     public: typedef std::function<void (const std::string &,
                                         const std::string &)> Callback;
+
+    /// \brief Callback used for receiving topic updates without copies. The
+    /// data pointer references the received frame and is only valid during
+    /// the execution of the callback.
+    public: typedef std::function<void (const std::string &, const char *,
+                                        size_t)> RawCallback;
+
     /// \brief Callback used for receiving a service call request.
     public: typedef std::function<void (const std::string &, int,
                                         const std::string &)> ReqCallback;
@@ -44,23 +59,28 @@ namespace transport
                                        const std::string &,
                                        std::string &)> RepCallback;
 
-    /// \brief Map used for store all the knowledge about a given topic.
-    public: typedef std::map<std::string, TopicInfo*> Topics_M;
-
     /// \brief Constructor.
     public: TopicInfo();
 
     /// \brief Destructor.
     public: virtual ~TopicInfo();
 
+    /// \brief Restore the default values, as after the construction.
+    public: void Reset();
+
     /// \brief List of addresses known for a topic.
     public: Topics_L addresses;
 
     /// \brief Am I connected to the topic?
     public: bool connected;
 
-    /// \brief Am I advertising this topic?
-    public: bool advertisedByMe;
+    /// \brief Am I advertising this topic? It is read by the publisher
+    /// handles without holding the mutex of the node.
+    public: std::atomic<bool> advertisedByMe;
+
+    /// brief Are there subscribers connected to my publisher socket for the
+    /// topic? It is kept up to date by the node while the topic is pinned.
+    public: std::atomic<bool> hasSubscribers;
 
     /// brief Am I subscribed to the topic?
     public: bool subscribed;
@@ -68,6 +88,9 @@ namespace transport
     /// brief Callback that will be executed in case of receiving new data.
     public: Callback cb;
 
+    /// brief Callback that will receive a read-only view of the new data.
+    public: RawCallback rawCb;
+
     /// brief Is a service call pending?
     public: bool requested;
 
@@ -77,13 +100,96 @@ namespace transport
     /// brief Callback to manage the response of a service call requested by me.
     public: RepCallback repCb;
 
+    /// brief Is the information referenced from outside of the map? It is
+    /// kept stored while the map exists.
+    public: bool pinned;
+
+    /// brief Sequence number of the last update published by me. The topics
+    /// advertised by me are pinned, so it is never reset while in use.
+    public: std::atomic<uint64_t> pubSeq;
+
+    /// brief Last sequence number received from each publisher. The entry
+    /// of a publisher is removed when its node expires or leaves.
+    public: std::map<uint64_t, uint64_t> lastSeqs;
+
+    /// brief Number of updates lost, detected from gaps in the sequence.
+    public: uint64_t lost;
+
+    /// brief Statistics of the updates received, if enabled.
+    public: std::shared_ptr<TopicStatsCollector> stats;
+
     /// brief List that stores the pending service call requests. Every element
     /// of the list contains the serialized parameters for each request.
     public: std::list<std::string> pendingReqs;
   };
 
+  /// \brief Connection to the endpoint of a remote publisher. It is shared
+  /// by all the topics of the publisher, and closed when none of them is
+  /// subscribed anymore.
+  class EndpointInfo
+  {
+    /// brief GUID of the publisher bound to the endpoint.
+    public: std::string guid;
+
+    /// brief Subscribed topics received through the endpoint. The size is
+    /// the reference count of the connection.
+    public: std::set<std::string> topics;
+  };
+
+  /// \brief Remote node that advertised topics or services. Its addresses
+  /// are removed when its lease expires.
+  class RemoteNodeInfo
+  {
+    /// \brief Constructor.
+    public: RemoteNodeInfo();
+
+    /// brief Last time a discovery message was received from the node.
+    public: std::chrono::steady_clock::time_point lastSeen;
+
+    /// brief Does the node send heartbeats? The nodes that do not send them
+    /// never expire.
+    public: bool heartbeats;
+
+    /// brief Topics and addresses advertised by the node.
+    public: std::set<std::pair<std::string, std::string>> advs;
+
+    /// brief Services and addresses advertised by the node.
+    public: std::set<std::pair<std::string, std::string>> srvAdvs;
+  };
+
+  /// \brief Encoding of the records sent to a node, from the one every
+  /// version decodes to the most compact one. SingleAdvs is one ADV message
+  /// per record, for the nodes that predate ADV_BATCH; BatchAdvs is an
+  /// ADV_BATCH in version 1 and CompactAdvs one in the compact encoding.
+  enum AdvEncoding {SingleAdvs, BatchAdvs, CompactAdvs};
+
+  /// \brief Reply scheduled for the subscriptions to a topic or service.
+  class PendingReply
+  {
+    /// \brief Constructor.
+    public: PendingReply();
+
+    /// brief Time when the reply is due.
+    public: std::chrono::steady_clock::time_point due;
+
+    /// brief Is the reply broadcast? It is when a requester cannot be
+    /// reached by unicast.
+    public: bool broadcast;
+
+    /// brief Address and port of the nodes waiting for the reply, and the
+    /// encoding they decode.
+    public: std::map<std::pair<std::string, unsigned short>, AdvEncoding>
+      requesters;
+  };
+
   class TopicsInfo
   {
+    /// \brief Identifier of an interned topic name.
+    public: typedef uint32_t TopicId;
+
+    /// \brief Identifier that does not correspond to any topic.
+    public: static const TopicId InvalidId = 0xFFFFFFFF;
+
     /// \brief Constructor.
     public: TopicsInfo();
 
@@ -95,10 +201,51 @@ namespace transport
     /// \return true If there is information about the topic.
     public: bool HasTopic(const std::string &_topic);
 
+    /// \brief Get the information stored about a topic.
+    /// \param[in] _topic Topic name.
+    /// \return Pointer to the information or nullptr if the topic is unknown.
+    public: TopicInfo *GetTopicInfo(const std::string &_topic);
+
+    /// \brief Get the information stored about a topic.
+    /// \param[in] _id Topic identifier.
+    /// \return Pointer to the information or nullptr if the topic is unknown.
+    public: TopicInfo *GetTopicInfo(TopicId _id);
+
+    /// \brief Get the identifier of a topic name. The identifiers are
+    /// consecutive, starting at 0. A name keeps its identifier while its
+    /// information is stored; the identifiers of the topics removed are
+    /// reused by the next names stored.
+    /// \param[in] _topic Topic name.
+    /// \return The identifier or InvalidId if the name is not stored.
+    public: TopicId GetId(const std::string &_topic) const;
+
+    /// \brief Get the identifier of a topic name from the hash carried by
+    /// the compact discovery records (see HashTopic()).
+    /// \param[in] _hash Hash of the topic name.
+    /// \return The identifier or InvalidId if no name stored has the hash.
+    public: TopicId GetIdByHash(uint64_t _hash) const;
+
+    /// \brief Get the topic name of an identifier.
+    /// \param[in] _id Topic identifier.
+    /// \return Topic name or an empty string if the identifier is free.
+    public: const std::string &GetTopicName(TopicId _id) const;
+
+    /// \brief Get the number of identifiers assigned, including the ones
+    /// free. Use it to iterate over the topics with GetTopicInfo(TopicId).
+    /// \return Number of identifiers.
+    public: TopicId GetIdCount() const;
+
+    /// \brief Get the information about a topic, creating it if needed. The
+    /// information is never removed, so the pointer stays valid during the
+    /// lifetime of this object.
+    /// \param[in] _topic Topic name.
+    /// \return Pointer to the information.
+    public: TopicInfo *Pin(const std::string &_topic);
+
     /// \brief Get the known list of addresses associated to a given topic.
     /// \param[in] _topic Topic name.
     /// \param[out] _addresses List of addresses
-    /// \return true when we have info about this topic.
+    /// \return true when we know addresses for this topic.
     public: bool GetAdvAddresses(const std::string &_topic,
                                  std::vector<std::string> &_addresses);
 
@@ -137,6 +284,13 @@ namespace transport
     public: bool GetCallback(const std::string &_topic,
                              TopicInfo::Callback &_cb);
 
+    /// \brief Get the raw callback associated to a topic subscription.
+    /// \param[in] _topic Topic name.
+    /// \param[out] A pointer to the raw function registered for a topic.
+    /// \return true if there is a raw callback registered for the topic.
+    public: bool GetRawCallback(const std::string &_topic,
+                                TopicInfo::RawCallback &_cb);
+
     /// \brief Get the REQ callback associated to a topic subscription.
     /// \param[in] _topic Topic name.
     /// \param[out] A pointer to the REQ function registered for a topic.
@@ -162,7 +316,10 @@ namespace transport
     public: void AddAdvAddress(const std::string &_topic,
                                const std::string &_address);
 
-    /// \brief Remove an address associated to a given topic.
+    /// \brief Remove an address associated to a given topic. The topic is
+    /// removed with its last address unless it is still used locally. The
+    /// topics are also removed when they stop being subscribed, requested
+    /// or advertised by me, if they have no addresses left.
     /// \param[in] _topic Topic name.
     /// \param[int] _address Address to remove.
     public: void RemoveAdvAddress(const std::string &_topic,
@@ -195,6 +352,12 @@ namespace transport
     public: void SetCallback(const std::string &_topic,
                              const TopicInfo::Callback &_cb);
 
+    /// \brief Set a new raw callback associated to a given topic.
+    /// \param[in] _topic Topic name.
+    /// \param[in] _cb New callback.
+    public: void SetRawCallback(const std::string &_topic,
+                                const TopicInfo::RawCallback &_cb);
+
     /// \brief Set a new REQ callback associated to a given topic.
     /// \param[in] _topic Topic name.
     /// \param[in] _cb New callback.
@@ -218,12 +381,69 @@ namespace transport
     /// \return true if a request was removed.
     public: bool DelReq(const std::string &_topic, std::string &_data);
 
-    /// \brief Get a reference to the topics map.
-    /// \return Reference to the topic map.
-    public: TopicInfo::Topics_M& GetTopicsInfo();
+    /// \brief Get the information about a topic, creating it if needed.
+    /// \param[in] _topic Topic name.
+    /// \return Pointer to the information.
+    private: TopicInfo *AddTopic(const std::string &_topic);
+
+    /// \brief Get the information about a topic.
+    /// \param[in] _topic Topic name.
+    /// \param[in] _create true to create the information if needed.
+    /// \return Pointer to the information or nullptr if the topic is unknown
+    /// and _create is false.
+    private: TopicInfo *FindTopic(const std::string &_topic, bool _create);
+
+    /// \brief Remove a topic if it is not used: it has no addresses, is not
+    /// subscribed, requested or advertised by me and is not pinned. Its slot
+    /// in the hash table becomes a tombstone and its identifier is freed.
+    /// \param[in] _id Topic identifier.
+    private: void Collect(TopicId _id);
+
+    /// \brief Get the identifier of a topic name, assigning a new one if
+    /// needed.
+    /// \param[in] _topic Topic name.
+    /// \return The identifier.
+    private: TopicId Intern(const std::string &_topic);
+
+    /// \brief Rebuild the hash table without tombstones.
+    /// \param[in] _size New number of slots (power of two).
+    private: void Rehash(size_t _size);
+
+    /// \brief Slot of the hash table.
+    private: struct Slot
+    {
+      /// \brief Hash of the topic name.
+      size_t hash;
+
+      /// \brief Topic identifier, InvalidId if the slot is empty or a
+      /// tombstone if its topic was removed.
+      TopicId id;
+    };
+
+    /// \brief Open addressing hash table (linear probing) that maps the
+    /// topic names to their identifiers. The size is a power of two.
+    private: std::vector<Slot> slots;
+
+    /// \brief Topic names indexed by identifier.
+    private: std::deque<std::string> names;
+
+    /// \brief Identifiers by hash of the topic name, as sent in the compact
+    /// discovery records. The hash is computed once, when the name is
+    /// stored.
+    private: std::map<uint64_t, TopicId> hashIds;
+
+    /// \brief Topic information indexed by identifier. A deque does not move
+    /// its elements when it grows, so the pointers stay valid.
+    private: std::deque<TopicInfo> infos;
+
+    /// \brief Tells if the information of each identifier is stored.
+    private: std::vector<bool> present;
+
+    /// \brief Identifiers of the topics removed, reused first.
+    private: std::vector<TopicId> freeIds;
 
-    // Hash with the topic/topicInfo information for pub/sub.
-    private: TopicInfo::Topics_M topicsInfo;
+    /// \brief Number of tombstones in the hash table.
+    private: size_t deletedSlots;
   };
 }
 
@@ -16,6 +16,8 @@
 */
 
 #include <string>
+#include <vector>
+#include "packet.hh"
 #include "topicsInfo.hh"
 #include "gtest/gtest.h"
 
@@ -27,6 +29,12 @@ void myCb(const std::string &p1, const std::string &p2)
   callbackExecuted = true;
 }
 
+//////////////////////////////////////////////////
+void myRawCb(const std::string &p1, const char *p2, size_t p3)
+{
+  callbackExecuted = true;
+}
+
 //////////////////////////////////////////////////
 void myReqCb(const std::string &p1, int p2, const std::string &p3)
 {
@@ -48,6 +56,7 @@ TEST(PacketTest, BasicTopicsInfoAPI)
   std::string address = "tcp://10.0.0.1:6000";
   transport::TopicInfo::Topics_L v;
   transport::TopicInfo::Callback cb;
+  transport::TopicInfo::RawCallback rawCb;
   transport::TopicInfo::ReqCallback reqCb;
   transport::TopicInfo::RepCallback repCb;
 
@@ -60,6 +69,7 @@ TEST(PacketTest, BasicTopicsInfoAPI)
   EXPECT_FALSE(topics.AdvertisedByMe(topic));
   EXPECT_FALSE(topics.Requested(topic));
   EXPECT_FALSE(topics.GetCallback(topic, cb));
+  EXPECT_FALSE(topics.GetRawCallback(topic, rawCb));
   EXPECT_FALSE(topics.GetReqCallback(topic, reqCb));
   EXPECT_FALSE(topics.GetRepCallback(topic, repCb));
   EXPECT_FALSE(topics.PendingReqs(topic));
@@ -75,6 +85,7 @@ TEST(PacketTest, BasicTopicsInfoAPI)
   EXPECT_FALSE(topics.AdvertisedByMe(topic));
   EXPECT_FALSE(topics.Requested(topic));
   EXPECT_FALSE(topics.GetCallback(topic, cb));
+  EXPECT_FALSE(topics.GetRawCallback(topic, rawCb));
   EXPECT_FALSE(topics.GetReqCallback(topic, reqCb));
   EXPECT_FALSE(topics.GetRepCallback(topic, repCb));
   EXPECT_FALSE(topics.PendingReqs(topic));
@@ -107,6 +118,13 @@ TEST(PacketTest, BasicTopicsInfoAPI)
   cb("topic", "data");
   EXPECT_TRUE(callbackExecuted);
 
+  // Check SetRawCallback
+  topics.SetRawCallback(topic, myRawCb);
+  EXPECT_TRUE(topics.GetRawCallback(topic, rawCb));
+  callbackExecuted = false;
+  rawCb("topic", "data", 4);
+  EXPECT_TRUE(callbackExecuted);
+
   // Check SetReqCallback
   topics.SetReqCallback(topic, myReqCb);
   EXPECT_TRUE(topics.GetReqCallback(topic, reqCb));
@@ -127,12 +145,47 @@ TEST(PacketTest, BasicTopicsInfoAPI)
   EXPECT_FALSE(topics.HasAdvAddress(topic, address));
   EXPECT_FALSE(topics.GetAdvAddresses(topic, v));
 
+  // The topic is still used locally, so its information is kept
+  EXPECT_TRUE(topics.HasTopic(topic));
+  EXPECT_TRUE(topics.Subscribed(topic));
+
+  // Check GetTopicInfo and Pin
+  std::string topic2 = "test_topic2";
+  EXPECT_EQ(topics.GetTopicInfo(topic2), nullptr);
+  transport::TopicInfo *info = topics.Pin(topic2);
+  ASSERT_NE(info, nullptr);
+  EXPECT_EQ(topics.GetTopicInfo(topic2), info);
+  EXPECT_EQ(topics.Pin(topic2), info);
+  topics.AddAdvAddress(topic2, address);
+  topics.RemoveAdvAddress(topic2, address);
+  EXPECT_EQ(topics.GetTopicInfo(topic2), info);
+
+  // The information of a topic not used locally is removed with its last
+  // address
+  std::string topic3 = "test_topic3";
+  topics.AddAdvAddress(topic3, address);
+  EXPECT_TRUE(topics.HasTopic(topic3));
+  topics.RemoveAdvAddress(topic3, address);
+  EXPECT_FALSE(topics.HasTopic(topic3));
+
+  // The identifier of a removed topic is reused by the next name stored
+  transport::TopicsInfo::TopicId count = topics.GetIdCount();
+  EXPECT_EQ(topics.GetId(topic3), transport::TopicsInfo::InvalidId);
+  topics.AddAdvAddress(topic3, address);
+  transport::TopicsInfo::TopicId id3 = topics.GetId(topic3);
+  EXPECT_NE(id3, transport::TopicsInfo::InvalidId);
+  EXPECT_EQ(topics.GetIdCount(), count);
+  EXPECT_EQ(topics.GetTopicName(id3), topic3);
+  EXPECT_TRUE(topics.HasAdvAddress(topic3, address));
+  EXPECT_FALSE(topics.Subscribed(topic3));
+  EXPECT_EQ(topics.GetId("unknown"), transport::TopicsInfo::InvalidId);
+
   // Check the addition of asynchronous service call requests
   std::string req1 = "paramsReq1";
   std::string req2 = "paramsReq2";
   EXPECT_FALSE(topics.DelReq(topic, req1));
-  for (auto topicInfo : topics.GetTopicsInfo())
-    EXPECT_FALSE(topics.PendingReqs(topicInfo.first));
+  for (transport::TopicsInfo::TopicId id = 0; id < topics.GetIdCount(); ++id)
+    EXPECT_FALSE(topics.PendingReqs(topics.GetTopicName(id)));
 
   topics.AddReq(topic, req1);
   EXPECT_TRUE(topics.PendingReqs(topic));
@@ -150,6 +203,73 @@ TEST(PacketTest, BasicTopicsInfoAPI)
   EXPECT_FALSE(topics.PendingReqs(topic));
 }
 
+//////////////////////////////////////////////////
+TEST(PacketTest, ManyTopics)
+{
+  transport::TopicsInfo topics;
+  std::vector<transport::TopicInfo*> infos;
+
+  // The hash table grows several times. The pointers returned stay valid.
+  for (int i = 0; i < 1000; ++i)
+  {
+    std::string topic = "topic" + std::to_string(i);
+    infos.push_back(topics.Pin(topic));
+    topics.SetSubscribed(topic, i % 2 == 0);
+  }
+
+  EXPECT_EQ(topics.GetIdCount(), 1000u);
+  for (int i = 0; i < 1000; ++i)
+  {
+    std::string topic = "topic" + std::to_string(i);
+    transport::TopicsInfo::TopicId id = topics.GetId(topic);
+    EXPECT_EQ(topics.GetTopicName(id), topic);
+    EXPECT_EQ(topics.GetTopicInfo(topic), infos[i]);
+    EXPECT_EQ(topics.Subscribed(topic), i % 2 == 0);
+    EXPECT_EQ(topics.GetIdByHash(transport::HashTopic(topic)), id);
+  }
+  EXPECT_EQ(topics.GetIdByHash(transport::HashTopic("unknown")),
+            transport::TopicsInfo::InvalidId);
+}
+
+//////////////////////////////////////////////////
+TEST(PacketTest, ReclaimTopics)
+{
+  transport::TopicsInfo topics;
+  std::string address = "tcp://127.0.0.1:1234";
+  topics.SetSubscribed("kept", true);
+
+  // Topics seen and forgotten do not accumulate identifiers or tombstones
+  for (int i = 0; i < 1000; ++i)
+  {
+    std::string topic = "topic" + std::to_string(i);
+    topics.AddAdvAddress(topic, address);
+    topics.SetSubscribed(topic, true);
+    topics.RemoveAdvAddress(topic, address);
+    EXPECT_TRUE(topics.HasTopic(topic));
+    topics.SetSubscribed(topic, false);
+    EXPECT_FALSE(topics.HasTopic(topic));
+    EXPECT_EQ(topics.GetId(topic), transport::TopicsInfo::InvalidId);
+    EXPECT_EQ(topics.GetIdByHash(transport::HashTopic(topic)),
+              transport::TopicsInfo::InvalidId);
+  }
+  EXPECT_EQ(topics.GetIdCount(), 2u);
+  EXPECT_TRUE(topics.Subscribed("kept"));
+
+  // Clearing a flag of an unknown topic does not store it
+  topics.SetConnected("unknown", false);
+  topics.SetCallback("unknown", nullptr);
+  EXPECT_FALSE(topics.HasTopic("unknown"));
+
+  // A topic with pending requests is kept until they are sent
+  std::string data;
+  topics.SetRequested("service", true);
+  topics.AddReq("service", "params");
+  topics.SetRequested("service", false);
+  EXPECT_TRUE(topics.HasTopic("service"));
+  EXPECT_TRUE(topics.DelReq("service", data));
+  EXPECT_FALSE(topics.HasTopic("service"));
+}
+
 //////////////////////////////////////////////////
 int main(int argc, char **argv)
 {